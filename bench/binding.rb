@@ -0,0 +1,133 @@
+# Measures the binding layer: Object#build round trips, prepared Command#call
+# by field count (the native pack, send and unpack path), LL.read/LL.write
+# bandwidth and S<Func>::Bind call overhead.
+# Prints one JSON object per line; compare two runs with
+# tools/bench_compare.rb. Off-device it runs against the simulated backend
+# (see host/build_config.rb), where sim:echo answers with its request data.
+#
+#   bin/mruby bench/binding.rb [label] > report.jsonl
+
+TICKS_PER_SECOND = 19200000
+LABEL = ARGV[0] || "unlabelled"
+ROUNDS = 5
+
+def ticks
+  TRN::LL::SVC.get_system_tick
+end
+
+# best of ROUNDS, in seconds per iteration
+def measure(iterations)
+  best = nil
+  ROUNDS.times do
+    start = ticks
+    yield iterations
+    elapsed = ticks - start
+    best = elapsed if best == nil || elapsed < best
+  end
+  best.to_f / TICKS_PER_SECOND / iterations
+end
+
+def json_string(str)
+  "\"" + str.to_s.gsub("\\", "\\\\\\\\").gsub("\"", "\\\"") + "\""
+end
+
+def report(name, unit, value, iterations)
+  puts "{\"label\":#{json_string(LABEL)},\"name\":#{json_string(name)},\"unit\":#{json_string(unit)}," +
+       "\"value\":#{value.round(3)},\"iterations\":#{iterations}}"
+end
+
+def echo_message(fields)
+  message = TRN::IPC::Message.new(0)
+  fields.times do |i|
+    message.in_u32(i)
+    message.out_u32(i)
+  end
+  message
+end
+
+def echo_params(fields)
+  params = {}
+  fields.times do |i|
+    params[i] = i
+  end
+  params
+end
+
+echo = TRN.get_service("sim:echo")
+
+# Object#build round trips
+n = 2000
+per = measure(n) do |iterations|
+  iterations.times do
+    echo.build(0) do
+      in_u32(1)
+      out_u32(:value)
+    end
+  end
+end
+report("build.round_trip", "ops/s", 1.0 / per, n)
+
+# prepared commands skip the builder and _compile
+command = echo.prepare(0) do
+  in_u32 :value
+  out_u32 :value
+end
+n = 5000
+per = measure(n) do |iterations|
+  iterations.times do
+    command.call(:value => 1)
+  end
+end
+report("command.round_trip", "ops/s", 1.0 / per, n)
+
+# Command#call by field count; every field goes both ways, so this is native
+# pack, send and unpack together. 48 u32s still fit the 0x100-byte message
+[1, 4, 16, 48].each do |fields|
+  command = TRN::IPC::Command.new(echo, echo_message(fields))
+  params = echo_params(fields)
+  n = 20000 / fields
+  per = measure(n) do |iterations|
+    iterations.times do
+      command.call(params)
+    end
+  end
+  report("command.fields_#{fields}", "ns", per * 1000000000, n)
+end
+
+# LL.read/LL.write bandwidth
+[0x100, 0x10000].each do |size|
+  address = TRN::LL.malloc(size)
+  data = "\xa5" * size
+  n = 0x1000000 / size
+  per = measure(n) do |iterations|
+    iterations.times do
+      TRN::LL.write(address, data)
+    end
+  end
+  report("ll.write_#{size}", "MiB/s", size / per / 0x100000, n)
+  per = measure(n) do |iterations|
+    iterations.times do
+      TRN::LL.read(address, size)
+    end
+  end
+  report("ll.read_#{size}", "MiB/s", size / per / 0x100000, n)
+  TRN::LL.free(address)
+end
+
+# S<Func>::Bind overhead: a no-argument call and one with an out pointer
+n = 50000
+per = measure(n) do |iterations|
+  iterations.times do
+    TRN::LL::SVC.get_current_processor_number
+  end
+end
+report("bind.no_args", "ns", per * 1000000000, n)
+
+per = measure(n) do |iterations|
+  iterations.times do
+    TRN::LL::SVC.get_process_id(0xffff8001)
+  end
+end
+report("bind.out_pointer", "ns", per * 1000000000, n)
+
+echo.close
@@ -0,0 +1,33 @@
+# Measures round trips through TRN::IPC::Server over a local session pair.
+# A native client thread hammers command 1 while the server loop answers.
+
+REQUESTS = 100000
+TICKS_PER_SECOND = 19200000
+
+class EchoHandler
+  def echo(params)
+    {:value => params[:value]}
+  end
+end
+
+r, server_session, client_session = TRN::LL::SVC.create_session(0, 0)
+raise TRN::ResultError, "create_session: 0x#{r.to_s(16)}" if r != 0
+
+server = TRN::IPC::Server.new(EchoHandler.new)
+server.command(1, :echo) do
+  in_u32 :value
+  out_u32 :value
+end
+server.add_session(server_session)
+
+client = TRN::IPC::Server::BenchClient.new(client_session, 1, REQUESTS)
+start = TRN::LL::SVC.get_system_tick
+server.run
+ticks = TRN::LL::SVC.get_system_tick - start
+
+if client.result != 0 then
+  puts "client failed after #{client.completed} requests: 0x#{client.result.to_s(16)}"
+end
+seconds = ticks.to_f / TICKS_PER_SECOND
+puts "#{client.completed} requests in #{(seconds * 1000).round(2)} ms"
+puts "#{(client.completed / seconds).round} requests/s, #{(seconds * 1000000 / client.completed).round(2)} us/request"
@@ -0,0 +1,77 @@
+# Measures interpreter startup: time from TRN::Worker.new to the first line
+# of its script (thread creation plus mrb_open and gem init), and the time
+# and heap bytes it takes to then bring in one service group or all of them.
+# Heap figures come from TRN::LL.heap_stats, so the interpreter running this
+# has to be opened with mrb_trn_allocf (workers then inherit it); otherwise
+# they are left out. Prints one JSON object per line like bench/binding.rb.
+#
+#   bin/mruby bench/startup.rb [label] > report.jsonl
+
+TICKS_PER_SECOND = 19200000
+LABEL = ARGV[0] || "unlabelled"
+ROUNDS = 10
+
+LOADS = {
+  "none" => "",
+  "one" => "TRN::Service::IDsService",
+  "all" => "TRN::Service.load_all",
+}
+
+def json_string(str)
+  "\"" + str.to_s.gsub("\\", "\\\\\\\\").gsub("\"", "\\\"") + "\""
+end
+
+def report(name, unit, value, iterations)
+  puts "{\"label\":#{json_string(LABEL)},\"name\":#{json_string(name)},\"unit\":#{json_string(unit)}," +
+       "\"value\":#{value.round(3)},\"iterations\":#{iterations}}"
+end
+
+def worker_script(load)
+  <<-SCRIPT
+    started = TRN::LL::SVC.get_system_tick
+    GC.start
+    before = TRN::LL.heap_stats
+    #{load}
+    loaded = TRN::LL::SVC.get_system_tick
+    GC.start
+    after = TRN::LL.heap_stats
+    if after[:active] then
+      # counters are process-wide; the parent is blocked in pop meanwhile
+      TRN::Worker.push([started, loaded, after[:live_bytes] - before[:live_bytes],
+                        after[:footprint_bytes] - before[:footprint_bytes]])
+    else
+      TRN::Worker.push([started, loaded, nil, nil])
+    end
+  SCRIPT
+end
+
+# best of ROUNDS, in ticks: [init, load, live bytes, footprint bytes]
+def startup(load)
+  script = worker_script(load)
+  best_init = nil
+  best_load = nil
+  live = nil
+  footprint = nil
+  ROUNDS.times do
+    start = TRN::LL::SVC.get_system_tick
+    worker = TRN::Worker.new(script)
+    result = worker.pop
+    raise "worker failed: #{worker.error}" if !result
+    worker.close
+    started, loaded, live, footprint = result
+    best_init = started - start if best_init == nil || started - start < best_init
+    best_load = loaded - started if best_load == nil || loaded - started < best_load
+  end
+  [best_init, best_load, live, footprint]
+end
+
+LOADS.each do |name, load|
+  init, load_ticks, live, footprint = startup(load)
+  report("startup.init", "us", init * 1000000.0 / TICKS_PER_SECOND, ROUNDS) if name == "none"
+  next if name == "none"
+  report("startup.load_#{name}", "us", load_ticks * 1000000.0 / TICKS_PER_SECOND, ROUNDS)
+  if live then
+    report("startup.live_bytes_#{name}", "bytes", live, ROUNDS)
+    report("startup.footprint_bytes_#{name}", "bytes", footprint, ROUNDS)
+  end
+end
@@ -0,0 +1,26 @@
+# Linux build of the gem against host/sim.c, for benchmarking the binding
+# layer off-device:
+#
+#   cd mruby && MRUBY_CONFIG=/path/to/mruby-transistor/host/build_config.rb rake
+#   build/host/bin/mruby /path/to/mruby-transistor/bench/binding.rb $(git rev-parse --short HEAD)
+
+ENV["TRN_HOST_SIM"] = "1"
+
+MRuby::Build.new("host") do |conf|
+  toolchain :gcc
+
+  conf.gembox "default"
+  conf.gem :core => "mruby-pack"
+  conf.gem File.expand_path("../..", __FILE__)
+
+  # TRN_PROFILE=1 builds mruby with the code fetch hook TRN::Profiler samples
+  # from; it costs a check per instruction, so benchmarks leave it off
+  if ENV["TRN_PROFILE"] == "1" then
+    conf.cc.defines << "MRB_ENABLE_DEBUG_HOOK"
+    conf.cxx.defines << "MRB_ENABLE_DEBUG_HOOK"
+  end
+
+  conf.cc.flags << "-O2"
+  conf.cxx.flags << "-O2" << "-std=gnu++17"
+  conf.linker.libraries << "stdc++"
+end
@@ -0,0 +1,14 @@
+#pragma once
+
+#include<libtransistor/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *as_reserve(size_t len);
+void as_release(void *addr, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include<libtransistor/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *alloc_pages(size_t min, size_t max, size_t *actual);
+bool free_pages(void *pages);
+
+#ifdef __cplusplus
+}
+#endif
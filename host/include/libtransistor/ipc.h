@@ -0,0 +1,62 @@
+#pragma once
+
+#include<libtransistor/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	void *addr;
+	size_t size;
+	uint32_t type;
+} ipc_buffer_t;
+
+typedef struct {
+	session_h session;
+	int32_t object_id; // -1 unless the object lives on a domain
+	bool is_borrowed;
+} ipc_object_t;
+
+typedef struct {
+	uint32_t type;
+	uint32_t request_id;
+	uint32_t num_buffers;
+	ipc_buffer_t **buffers;
+	uint32_t raw_data_size;
+	void *raw_data;
+	bool send_pid;
+	uint8_t num_copy_handles;
+	uint8_t num_move_handles;
+	uint8_t num_objects;
+	handle_t *copy_handles;
+	handle_t *move_handles;
+	ipc_object_t *objects;
+} ipc_request_t;
+
+typedef struct {
+	uint32_t num_copy_handles;
+	uint32_t num_move_handles;
+	uint32_t num_objects;
+	handle_t *copy_handles;
+	handle_t *move_handles;
+	ipc_object_t *objects;
+	uint32_t raw_data_size;
+	void *raw_data;
+	bool has_pid;
+	uint64_t *pid;
+	bool ignore_raw_data;
+} ipc_response_fmt_t;
+
+extern ipc_request_t ipc_default_request;
+extern ipc_response_fmt_t ipc_default_response_fmt;
+extern ipc_object_t ipc_null_object;
+
+result_t ipc_send(ipc_object_t object, ipc_request_t *rq, ipc_response_fmt_t *rs);
+result_t ipc_convert_to_domain(ipc_object_t *session);
+result_t ipc_close(ipc_object_t object);
+result_t ipc_close_domain(ipc_object_t domain);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include<libtransistor/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+result_t pm_init();
+result_t pm_terminate_process_by_title_id(uint64_t tid);
+void pm_finalize();
+
+#ifdef __cplusplus
+}
+#endif
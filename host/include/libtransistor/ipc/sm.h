@@ -0,0 +1,15 @@
+#pragma once
+
+#include<libtransistor/ipc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+result_t sm_init();
+result_t sm_get_service(ipc_object_t *session, const char *name);
+void sm_finalize();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+#include<libtransistor/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	handle_t main_thread;
+	handle_t process_handle;
+	bool has_process_handle;
+} loader_config_t;
+
+extern loader_config_t loader_config;
+
+#ifdef __cplusplus
+}
+#endif
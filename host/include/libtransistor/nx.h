@@ -0,0 +1,11 @@
+#pragma once
+
+#include<libtransistor/types.h>
+#include<libtransistor/svc.h>
+#include<libtransistor/ipc.h>
+#include<libtransistor/ipc/sm.h>
+#include<libtransistor/address_space.h>
+#include<libtransistor/alloc_pages.h>
+#include<libtransistor/tls.h>
+#include<libtransistor/thread.h>
+#include<libtransistor/loader_config.h>
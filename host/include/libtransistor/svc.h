@@ -0,0 +1,69 @@
+#pragma once
+
+#include<libtransistor/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+result_t svcSetHeapSize(void **outAddr, uint32_t size);
+result_t svcSetMemoryPermission(void *addr, uint64_t size, uint32_t permission);
+result_t svcSetMemoryAttribute(void *addr, uint64_t size, uint32_t state0, uint32_t state1);
+result_t svcMapMemory(void *dest, void *src, uint64_t size);
+result_t svcUnmapMemory(void *dest, void *src, uint64_t size);
+result_t svcQueryMemory(memory_info_t *memory_info, uint32_t *page_info, void *addr);
+void svcExitProcess();
+result_t svcCreateThread(thread_h *out, thread_entry entry, uint64_t arg, void *stacktop, int32_t priority, int32_t processor_id);
+result_t svcStartThread(thread_h thread);
+void svcExitThread();
+result_t svcSleepThread(uint64_t nanos);
+result_t svcGetThreadPriority(uint32_t *priority, thread_h thread);
+result_t svcSetThreadCoreMask(thread_h thread, int32_t in, uint64_t in2);
+uint32_t svcGetCurrentProcessorNumber();
+result_t svcSignalEvent(wevent_h event);
+result_t svcClearEvent(handle_t event);
+result_t svcMapSharedMemory(shared_memory_h block, void *addr, size_t size, uint32_t permission);
+result_t svcUnmapSharedMemory(shared_memory_h block, void *addr, size_t size);
+result_t svcCreateTransferMemory(transfer_memory_h *out, void *addr, size_t size, uint32_t permission);
+result_t svcCloseHandle(handle_t handle);
+result_t svcResetSignal(handle_t signal);
+result_t svcWaitSynchronization(uint32_t *handle_index, const handle_t *handles, uint32_t num_handles, uint64_t timeout);
+result_t svcCancelSynchronization(handle_t thread);
+result_t svcArbitrateLock(uint32_t current_thread, uint32_t *lock, uint32_t requesting_thread);
+result_t svcArbitrateUnlock(uint32_t *lock);
+result_t svcWaitProcessWideKeyAtomic(uint32_t *ptr0, uint32_t *ptr1, uint32_t thread_handle, uint64_t timeout);
+result_t svcSignalProcessWideKey(uint32_t *ptr, uint32_t value);
+uint64_t svcGetSystemTick();
+result_t svcConnectToNamedPort(session_h *out, const char *name);
+result_t svcSendSyncRequest(session_h session);
+result_t svcSendSyncRequestWithUserBuffer(void *buffer, uint64_t size, session_h session);
+result_t svcGetProcessId(uint64_t *process_id, process_h process);
+result_t svcGetThreadId(uint64_t *thread_id, thread_h thread);
+result_t svcOutputDebugString(const char *str, uint64_t size);
+result_t svcReturnFromException(uint64_t result);
+result_t svcGetInfo(uint64_t *info, uint64_t info_id, handle_t handle, uint64_t info_sub_id);
+result_t svcCreateSession(session_h *server_handle, session_h *client_handle, uint32_t unknown0, uint64_t unknown1);
+result_t svcAcceptSession(session_h *out, port_h port);
+result_t svcReplyAndReceive(uint32_t *handle_idx, const session_h *handles, uint32_t num_handles, session_h reply_session, uint64_t timeout);
+result_t svcReplyAndReceiveWithUserBuffer(uint32_t *handle_idx, void *buffer, uint64_t size, const session_h *handles, uint32_t num_handles, session_h reply_session, uint64_t timeout);
+result_t svcReadWriteRegister(uint32_t *out_value, uint64_t addr, uint32_t rw_mask, uint32_t in_value);
+result_t svcCreateSharedMemory(shared_memory_h *out, size_t size, uint32_t local_permission, uint32_t other_permission);
+result_t svcMapTransferMemory(transfer_memory_h handle, void *addr, size_t size, uint32_t perm);
+result_t svcUnmapTransferMemory(transfer_memory_h handle, void *addr, size_t size);
+result_t svcQueryIoMapping(void *virt_addr, uint64_t phys_addr, uint64_t size);
+result_t svcAttachDeviceAddressSpace(uint64_t device, dev_addr_space_h space);
+result_t svcDetachDeviceAddressSpace(uint64_t device, dev_addr_space_h space);
+result_t svcMapDeviceAddressSpaceByForce(dev_addr_space_h space, process_h process, uint64_t dev_addr, uint64_t dev_size, uint64_t map_addr, uint32_t perm);
+result_t svcMapDeviceAddressSpaceAligned(dev_addr_space_h space, process_h process, uint64_t dev_addr, uint64_t dev_size, uint64_t map_addr, uint32_t perm);
+result_t svcUnmapDeviceAddressSpace(dev_addr_space_h space, process_h process, uint64_t map_addr, uint64_t map_size, uint32_t perm);
+result_t svcDebugActiveProcess(debug_h *out, uint64_t process_id);
+result_t svcQueryDebugProcessMemory(memory_info_t *memory_info, uint32_t *page_info, debug_h debug, uint64_t addr);
+result_t svcReadDebugProcessMemory(void *buffer, debug_h debug, uint64_t addr, uint64_t size);
+result_t svcWriteDebugProcessMemory(debug_h debug, void *buffer, uint64_t addr, uint64_t size);
+result_t svcSetProcessMemoryPermission(process_h process, uint64_t addr, uint64_t size, uint32_t perm);
+result_t svcMapProcessCodeMemory(process_h process, uint64_t dest, uint64_t src, uint64_t size);
+result_t svcUnmapProcessCodeMemory(process_h process, uint64_t dest, uint64_t src, uint64_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include<pthread.h>
+
+#include<libtransistor/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// backed by a pthread on the host
+typedef struct {
+	pthread_t pthread;
+	void (*entry)(void*);
+	void *arg;
+	bool started;
+} trn_thread_t;
+
+result_t trn_thread_create(trn_thread_t *thread, void (*entry)(void*), void *arg, int32_t priority, int32_t processor_id, size_t stack_size, void *stack_bottom);
+result_t trn_thread_start(trn_thread_t *thread);
+result_t trn_thread_join(trn_thread_t *thread, int64_t timeout);
+void trn_thread_destroy(trn_thread_t *thread);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+
+#include<libtransistor/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *get_tls();
+
+#ifdef __cplusplus
+}
+#endif
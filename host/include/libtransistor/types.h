@@ -0,0 +1,46 @@
+#pragma once
+
+// host stand-in for the libtransistor headers the gem uses; see host/sim.c
+
+#include<stdint.h>
+#include<stddef.h>
+#include<stdbool.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t i8;
+typedef int16_t i16;
+typedef int32_t i32;
+typedef int64_t i64;
+
+typedef u32 result_t;
+typedef u32 handle_t;
+
+typedef handle_t thread_h;
+typedef handle_t shared_memory_h;
+typedef handle_t transfer_memory_h;
+typedef handle_t session_h;
+typedef handle_t port_h;
+typedef handle_t revent_h;
+typedef handle_t wevent_h;
+typedef handle_t dev_addr_space_h;
+typedef handle_t debug_h;
+typedef handle_t process_h;
+
+typedef void (*thread_entry)(void *);
+
+#define RESULT_OK 0
+#define PACKED __attribute__((packed))
+
+typedef struct PACKED {
+	void *base_addr;
+	uint64_t size;
+	uint32_t memory_type;
+	uint32_t memory_attribute;
+	uint32_t permission;
+	uint32_t device_ref_count;
+	uint32_t ipc_ref_count;
+	uint32_t padding;
+} memory_info_t;
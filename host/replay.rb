@@ -0,0 +1,32 @@
+module TRN
+  module Sim
+    # result for requests the recording has no answer for
+    UNRECORDED = 0x1ad | (0x3fe << 9)
+
+    # Serves the responses from a TRN::IPC::Recorder file back through
+    # simulated services, so a session captured on hardware can be re-run
+    # on the host:
+    #
+    #   TRN::Sim.replay("sd:/trn.ipcrec")
+    #   sm = TRN::SM.new # talks to the replayed sm:, fsp-srv, ...
+    #
+    # Responses are handed out in recorded order per (service, command).
+    # Only raw data and the result come back; handles and objects in the
+    # recorded responses are not recreated.
+    def self.replay(path)
+      queues = {}
+      TRN::IPC::Recorder.load(path).each do |record|
+        next if record[:service].nil? || record[:type] == 5 # control requests are answered by the sim itself
+        services = (queues[record[:service]] ||= {})
+        (services[record[:command_id]] ||= []) << record
+      end
+      queues.each do |name, commands|
+        define_service(name) do |command_id, raw|
+          record = commands[command_id] && commands[command_id].shift
+          record ? [record[:result], record[:response]] : [UNRECORDED, ""]
+        end
+      end
+      queues.keys
+    end
+  end
+end
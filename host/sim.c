@@ -0,0 +1,594 @@
+#define _GNU_SOURCE
+
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<pthread.h>
+#include<sys/mman.h>
+#include<unistd.h>
+
+#include<mruby.h>
+#include<mruby/array.h>
+#include<mruby/hash.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include<libtransistor/nx.h>
+#include<libtransistor/ipc/pm.h>
+
+#include "../src/trn.h"
+
+// In-process stand-in for libtransistor so the gem can run on Linux. Sessions
+// live in a handle table and requests are answered by service responders,
+// either native (sim:echo, sim:null) or Ruby blocks registered through
+// TRN::Sim.define_service. Everything the host can't sensibly emulate
+// fails with SIM_RESULT_UNSUPPORTED.
+
+#define SIM_RESULT_UNSUPPORTED TRN_RESULT(0x3ff)
+#define SIM_RESULT_INVALID_HANDLE 0xe401
+#define SIM_RESULT_TIMED_OUT 0xea01
+#define SIM_RESULT_NOT_REGISTERED 0xe15 // sm
+
+#define SIM_HANDLE_BASE 0x100
+#define SIM_MAX_HANDLES 0x400
+#define SIM_MAX_SERVICES 0x40
+#define SIM_POINTER_BUFFER_SIZE 0x500
+#define SIM_TICKS_PER_SECOND ((uint64_t) TRN_TICKS_PER_SECOND) // what trn_ticks_to_ns assumes
+
+struct sim_service;
+typedef result_t (*sim_responder_t)(struct sim_service *service, ipc_request_t *rq, ipc_response_fmt_t *rs);
+
+typedef struct sim_service {
+	char name[9];
+	sim_responder_t responder;
+	mrb_state *mrb; // for ruby responders; only call them from the defining thread
+	mrb_value block;
+} sim_service_t;
+
+typedef enum {
+	SIM_HANDLE_FREE,
+	SIM_HANDLE_SESSION,
+	SIM_HANDLE_EVENT,
+	SIM_HANDLE_SHARED_MEMORY,
+} sim_handle_kind_t;
+
+typedef struct {
+	sim_handle_kind_t kind;
+	sim_service_t *service;
+	int32_t next_object_id;
+	int fd; // shared memory
+	size_t size;
+} sim_handle_t;
+
+ipc_request_t ipc_default_request = {.type = 4};
+ipc_response_fmt_t ipc_default_response_fmt = {0};
+ipc_object_t ipc_null_object = {.session = 0, .object_id = -1};
+loader_config_t loader_config = {0};
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static sim_handle_t sim_handles[SIM_MAX_HANDLES];
+static sim_service_t sim_services[SIM_MAX_SERVICES];
+static size_t sim_num_services;
+
+static handle_t sim_handle_alloc(sim_handle_kind_t kind, sim_service_t *service) {
+	pthread_mutex_lock(&sim_lock);
+	for(size_t i = 0; i < SIM_MAX_HANDLES; i++) {
+		if(sim_handles[i].kind == SIM_HANDLE_FREE) {
+			sim_handles[i].kind = kind;
+			sim_handles[i].service = service;
+			sim_handles[i].next_object_id = 1;
+			pthread_mutex_unlock(&sim_lock);
+			return SIM_HANDLE_BASE + i;
+		}
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return 0;
+}
+
+static sim_handle_t *sim_handle_get(handle_t handle) {
+	if(handle < SIM_HANDLE_BASE || handle >= SIM_HANDLE_BASE + SIM_MAX_HANDLES) {
+		return NULL;
+	}
+	sim_handle_t *h = &sim_handles[handle - SIM_HANDLE_BASE];
+	return h->kind == SIM_HANDLE_FREE ? NULL : h;
+}
+
+static sim_service_t *sim_service_find(const char *name) {
+	size_t num_services = __atomic_load_n(&sim_num_services, __ATOMIC_ACQUIRE);
+	for(size_t i = 0; i < num_services; i++) {
+		if(strncmp(sim_services[i].name, name, 8) == 0) {
+			return &sim_services[i];
+		}
+	}
+	return NULL;
+}
+
+// entries are filled in before they're published, so lookups don't lock
+static sim_service_t *sim_service_add(const char *name, sim_responder_t responder) {
+	pthread_mutex_lock(&sim_lock);
+	sim_service_t *service = sim_service_find(name);
+	bool is_new = service == NULL;
+	if(is_new) {
+		if(sim_num_services >= SIM_MAX_SERVICES) {
+			pthread_mutex_unlock(&sim_lock);
+			return NULL;
+		}
+		service = &sim_services[sim_num_services];
+	}
+	memset(service->name, 0, sizeof(service->name));
+	strncpy(service->name, name, 8);
+	service->responder = responder;
+	service->mrb = NULL;
+	service->block = mrb_nil_value();
+	if(is_new) {
+		__atomic_store_n(&sim_num_services, sim_num_services + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return service;
+}
+
+// responders
+
+static result_t sim_respond_null(sim_service_t *service, ipc_request_t *rq, ipc_response_fmt_t *rs) {
+	memset(rs->raw_data, 0, rs->raw_data_size);
+	return RESULT_OK;
+}
+
+static result_t sim_respond_echo(sim_service_t *service, ipc_request_t *rq, ipc_response_fmt_t *rs) {
+	size_t size = rq->raw_data_size < rs->raw_data_size ? rq->raw_data_size : rs->raw_data_size;
+	memcpy(rs->raw_data, rq->raw_data, size);
+	memset((uint8_t*) rs->raw_data + size, 0, rs->raw_data_size - size);
+	return RESULT_OK;
+}
+
+// block.call(command_id, raw) returns the response raw data, or [result, raw]
+static result_t sim_respond_ruby(sim_service_t *service, ipc_request_t *rq, ipc_response_fmt_t *rs) {
+	mrb_state *mrb = service->mrb;
+	mrb_value args[2] = {
+		mrb_fixnum_value(rq->request_id),
+		mrb_str_new(mrb, rq->raw_data, rq->raw_data_size),
+	};
+	mrb_value ret = mrb_funcall_argv(mrb, service->block, mrb_intern_lit(mrb, "call"), 2, args);
+	result_t r = RESULT_OK;
+	if(mrb_array_p(ret)) {
+		r = mrb_fixnum(mrb_ary_entry(ret, 0));
+		ret = mrb_ary_entry(ret, 1);
+	}
+	memset(rs->raw_data, 0, rs->raw_data_size);
+	if(mrb_string_p(ret)) {
+		size_t size = RSTRING_LEN(ret) < rs->raw_data_size ? RSTRING_LEN(ret) : rs->raw_data_size;
+		memcpy(rs->raw_data, RSTRING_PTR(ret), size);
+	}
+	return r;
+}
+
+// ipc
+
+static result_t sim_control(sim_handle_t *h, ipc_request_t *rq, ipc_response_fmt_t *rs) {
+	switch(rq->request_id) {
+	case 2: // CloneCurrentObject
+	case 4: { // CloneCurrentObjectEx
+		handle_t clone = sim_handle_alloc(SIM_HANDLE_SESSION, h->service);
+		if(clone == 0) {
+			return SIM_RESULT_UNSUPPORTED;
+		}
+		if(rs->num_move_handles > 0) {
+			rs->move_handles[0] = clone;
+		}
+		return RESULT_OK; }
+	case 3: // QueryPointerBufferSize
+		if(rs->raw_data_size >= sizeof(uint16_t)) {
+			memset(rs->raw_data, 0, rs->raw_data_size);
+			*(uint16_t*) rs->raw_data = SIM_POINTER_BUFFER_SIZE;
+		}
+		return RESULT_OK;
+	default:
+		return SIM_RESULT_UNSUPPORTED;
+	}
+}
+
+result_t ipc_send(ipc_object_t object, ipc_request_t *rq, ipc_response_fmt_t *rs) {
+	sim_handle_t *h = sim_handle_get(object.session);
+	if(h == NULL || h->kind != SIM_HANDLE_SESSION) {
+		return SIM_RESULT_INVALID_HANDLE;
+	}
+	if(rq->type == 5) {
+		return sim_control(h, rq, rs);
+	}
+	result_t r = h->service->responder(h->service, rq, rs);
+	if(r != RESULT_OK) {
+		return r;
+	}
+
+	// objects come back on the same service; on a domain they share the session
+	for(uint32_t i = 0; i < rs->num_objects; i++) {
+		rs->objects[i] = ipc_null_object;
+		if(object.object_id >= 0) {
+			rs->objects[i].session = object.session;
+			rs->objects[i].object_id = __atomic_fetch_add(&h->next_object_id, 1, __ATOMIC_RELAXED);
+		} else {
+			rs->objects[i].session = sim_handle_alloc(SIM_HANDLE_SESSION, h->service);
+		}
+	}
+	for(uint32_t i = 0; i < rs->num_copy_handles; i++) {
+		rs->copy_handles[i] = sim_handle_alloc(SIM_HANDLE_EVENT, NULL);
+	}
+	for(uint32_t i = 0; i < rs->num_move_handles; i++) {
+		rs->move_handles[i] = sim_handle_alloc(SIM_HANDLE_EVENT, NULL);
+	}
+	if(rs->has_pid) {
+		*rs->pid = 0x51;
+	}
+	return RESULT_OK;
+}
+
+result_t ipc_convert_to_domain(ipc_object_t *session) {
+	if(sim_handle_get(session->session) == NULL) {
+		return SIM_RESULT_INVALID_HANDLE;
+	}
+	session->object_id = 0;
+	return RESULT_OK;
+}
+
+result_t ipc_close(ipc_object_t object) {
+	if(object.object_id >= 0) {
+		return RESULT_OK; // domain objects don't own the session
+	}
+	return svcCloseHandle(object.session);
+}
+
+result_t ipc_close_domain(ipc_object_t domain) {
+	return svcCloseHandle(domain.session);
+}
+
+// sm, pm
+
+result_t sm_init() {
+	return RESULT_OK;
+}
+
+result_t sm_get_service(ipc_object_t *session, const char *name) {
+	sim_service_t *service = sim_service_find(name);
+	if(service == NULL) {
+		return SIM_RESULT_NOT_REGISTERED;
+	}
+	*session = ipc_null_object;
+	session->session = sim_handle_alloc(SIM_HANDLE_SESSION, service);
+	return session->session ? RESULT_OK : SIM_RESULT_UNSUPPORTED;
+}
+
+void sm_finalize() {
+}
+
+result_t pm_init() {
+	return RESULT_OK;
+}
+
+result_t pm_terminate_process_by_title_id(uint64_t tid) {
+	return SIM_RESULT_UNSUPPORTED;
+}
+
+void pm_finalize() {
+}
+
+// memory
+
+void *alloc_pages(size_t min, size_t max, size_t *actual) {
+	size_t size = (min + 0xfff) & ~0xfff;
+	void *pages = aligned_alloc(0x1000, size > 0 ? size : 0x1000);
+	if(pages && actual) {
+		*actual = size;
+	}
+	return pages;
+}
+
+bool free_pages(void *pages) {
+	free(pages);
+	return true;
+}
+
+void *as_reserve(size_t len) {
+	void *addr = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+void as_release(void *addr, size_t len) {
+	munmap(addr, len);
+}
+
+void *get_tls() {
+	static __thread uint8_t tls[0x200] __attribute__((aligned(16)));
+	return tls;
+}
+
+// threads
+
+static void *sim_thread_main(void *arg) {
+	trn_thread_t *thread = arg;
+	thread->entry(thread->arg);
+	return NULL;
+}
+
+result_t trn_thread_create(trn_thread_t *thread, void (*entry)(void*), void *arg, int32_t priority, int32_t processor_id, size_t stack_size, void *stack_bottom) {
+	thread->entry = entry;
+	thread->arg = arg;
+	thread->started = false;
+	return RESULT_OK;
+}
+
+result_t trn_thread_start(trn_thread_t *thread) {
+	if(pthread_create(&thread->pthread, NULL, sim_thread_main, thread) != 0) {
+		return SIM_RESULT_UNSUPPORTED;
+	}
+	thread->started = true;
+	return RESULT_OK;
+}
+
+result_t trn_thread_join(trn_thread_t *thread, int64_t timeout) {
+	if(thread->started) {
+		pthread_join(thread->pthread, NULL);
+		thread->started = false;
+	}
+	return RESULT_OK;
+}
+
+void trn_thread_destroy(trn_thread_t *thread) {
+}
+
+// svcs with a sensible host meaning
+
+uint64_t svcGetSystemTick() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * SIM_TICKS_PER_SECOND + (uint64_t) ts.tv_nsec * SIM_TICKS_PER_SECOND / 1000000000ull;
+}
+
+result_t svcCloseHandle(handle_t handle) {
+	sim_handle_t *h = sim_handle_get(handle);
+	if(h == NULL) {
+		return SIM_RESULT_INVALID_HANDLE;
+	}
+	pthread_mutex_lock(&sim_lock);
+	if(h->kind == SIM_HANDLE_SHARED_MEMORY) {
+		close(h->fd);
+	}
+	h->kind = SIM_HANDLE_FREE;
+	h->service = NULL;
+	pthread_mutex_unlock(&sim_lock);
+	return RESULT_OK;
+}
+
+// shared memory is a memfd mapped over the caller's as_reserve range;
+// unmapping puts the reservation back
+result_t svcCreateSharedMemory(shared_memory_h *out, size_t size, uint32_t local_permission, uint32_t other_permission) {
+	int fd = memfd_create("sim-shmem", MFD_CLOEXEC);
+	if(fd < 0) {
+		return SIM_RESULT_UNSUPPORTED;
+	}
+	if(ftruncate(fd, size) != 0) {
+		close(fd);
+		return SIM_RESULT_UNSUPPORTED;
+	}
+	handle_t handle = sim_handle_alloc(SIM_HANDLE_SHARED_MEMORY, NULL);
+	if(handle == 0) {
+		close(fd);
+		return SIM_RESULT_UNSUPPORTED;
+	}
+	sim_handle_t *h = sim_handle_get(handle);
+	h->fd = fd;
+	h->size = size;
+	*out = handle;
+	return RESULT_OK;
+}
+
+result_t svcMapSharedMemory(shared_memory_h block, void *addr, size_t size, uint32_t permission) {
+	sim_handle_t *h = sim_handle_get(block);
+	if(h == NULL || h->kind != SIM_HANDLE_SHARED_MEMORY) {
+		return SIM_RESULT_INVALID_HANDLE;
+	}
+	if(size != h->size) {
+		return SIM_RESULT_UNSUPPORTED;
+	}
+	int prot = (permission & 1 ? PROT_READ : 0) | (permission & 2 ? PROT_WRITE : 0);
+	if(mmap(addr, size, prot, MAP_SHARED | MAP_FIXED, h->fd, 0) == MAP_FAILED) {
+		return SIM_RESULT_UNSUPPORTED;
+	}
+	return RESULT_OK;
+}
+
+result_t svcUnmapSharedMemory(shared_memory_h block, void *addr, size_t size) {
+	if(sim_handle_get(block) == NULL) {
+		return SIM_RESULT_INVALID_HANDLE;
+	}
+	mmap(addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+	return RESULT_OK;
+}
+
+result_t svcSleepThread(uint64_t nanos) {
+	struct timespec ts = {nanos / 1000000000ull, nanos % 1000000000ull};
+	nanosleep(&ts, NULL);
+	return RESULT_OK;
+}
+
+uint32_t svcGetCurrentProcessorNumber() {
+	return 0;
+}
+
+result_t svcOutputDebugString(const char *str, uint64_t size) {
+	fwrite(str, 1, size, stderr);
+	return RESULT_OK;
+}
+
+// regions come from /proc/self/maps; the gaps between them are unmapped
+// (type 0). mapped regions report code static (3) when executable and heap
+// (5) otherwise.
+result_t svcQueryMemory(memory_info_t *memory_info, uint32_t *page_info, void *addr) {
+	uint64_t target = (uint64_t) addr;
+	uint64_t gap_start = 0;
+	uint64_t gap_end = 0; // end of the address space
+	memset(memory_info, 0, sizeof(*memory_info));
+	*page_info = 0;
+
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if(maps == NULL) {
+		return SIM_RESULT_UNSUPPORTED;
+	}
+	char line[512];
+	while(fgets(line, sizeof(line), maps)) {
+		uint64_t start, end;
+		char perms[5];
+		if(sscanf(line, "%lx-%lx %4s", &start, &end, perms) != 3) {
+			continue;
+		}
+		if(target < start) {
+			gap_end = start;
+			break;
+		}
+		if(target < end) {
+			memory_info->base_addr = (void*) start;
+			memory_info->size = end - start;
+			memory_info->memory_type = perms[2] == 'x' ? 3 : 5;
+			// [vvar] pages can fault on access
+			if(strstr(line, "[vvar") == NULL) {
+				memory_info->permission = (perms[0] == 'r' ? 1 : 0) | (perms[1] == 'w' ? 2 : 0) | (perms[2] == 'x' ? 4 : 0);
+			}
+			fclose(maps);
+			return RESULT_OK;
+		}
+		gap_start = end;
+	}
+	fclose(maps);
+	memory_info->base_addr = (void*) gap_start;
+	memory_info->size = gap_end - gap_start;
+	return RESULT_OK;
+}
+
+result_t svcSignalEvent(wevent_h event) {
+	return sim_handle_get(event) ? RESULT_OK : SIM_RESULT_INVALID_HANDLE;
+}
+
+result_t svcClearEvent(handle_t event) {
+	return sim_handle_get(event) ? RESULT_OK : SIM_RESULT_INVALID_HANDLE;
+}
+
+result_t svcResetSignal(handle_t signal) {
+	return sim_handle_get(signal) ? RESULT_OK : SIM_RESULT_INVALID_HANDLE;
+}
+
+result_t svcWaitSynchronization(uint32_t *handle_index, const handle_t *handles, uint32_t num_handles, uint64_t timeout) {
+	// nothing ever gets signalled on the host, so run out the timeout
+	if(timeout != UINT64_MAX) {
+		svcSleepThread(timeout);
+	}
+	return SIM_RESULT_TIMED_OUT;
+}
+
+result_t svcGetProcessId(uint64_t *process_id, process_h process) {
+	*process_id = 0x51;
+	return RESULT_OK;
+}
+
+// everything else is unsupported
+
+#define SIM_UNSUPPORTED(name, ...) \
+	result_t name(__VA_ARGS__) { \
+		return SIM_RESULT_UNSUPPORTED; \
+	}
+
+SIM_UNSUPPORTED(svcSetHeapSize, void **outAddr, uint32_t size)
+SIM_UNSUPPORTED(svcSetMemoryPermission, void *addr, uint64_t size, uint32_t permission)
+SIM_UNSUPPORTED(svcSetMemoryAttribute, void *addr, uint64_t size, uint32_t state0, uint32_t state1)
+SIM_UNSUPPORTED(svcMapMemory, void *dest, void *src, uint64_t size)
+SIM_UNSUPPORTED(svcUnmapMemory, void *dest, void *src, uint64_t size)
+SIM_UNSUPPORTED(svcCreateThread, thread_h *out, thread_entry entry, uint64_t arg, void *stacktop, int32_t priority, int32_t processor_id)
+SIM_UNSUPPORTED(svcStartThread, thread_h thread)
+SIM_UNSUPPORTED(svcGetThreadPriority, uint32_t *priority, thread_h thread)
+SIM_UNSUPPORTED(svcSetThreadCoreMask, thread_h thread, int32_t in, uint64_t in2)
+SIM_UNSUPPORTED(svcCreateTransferMemory, transfer_memory_h *out, void *addr, size_t size, uint32_t permission)
+SIM_UNSUPPORTED(svcCancelSynchronization, handle_t thread)
+SIM_UNSUPPORTED(svcArbitrateLock, uint32_t current_thread, uint32_t *lock, uint32_t requesting_thread)
+SIM_UNSUPPORTED(svcArbitrateUnlock, uint32_t *lock)
+SIM_UNSUPPORTED(svcWaitProcessWideKeyAtomic, uint32_t *ptr0, uint32_t *ptr1, uint32_t thread_handle, uint64_t timeout)
+SIM_UNSUPPORTED(svcSignalProcessWideKey, uint32_t *ptr, uint32_t value)
+SIM_UNSUPPORTED(svcConnectToNamedPort, session_h *out, const char *name)
+SIM_UNSUPPORTED(svcSendSyncRequest, session_h session)
+SIM_UNSUPPORTED(svcSendSyncRequestWithUserBuffer, void *buffer, uint64_t size, session_h session)
+SIM_UNSUPPORTED(svcGetThreadId, uint64_t *thread_id, thread_h thread)
+SIM_UNSUPPORTED(svcReturnFromException, uint64_t result)
+SIM_UNSUPPORTED(svcGetInfo, uint64_t *info, uint64_t info_id, handle_t handle, uint64_t info_sub_id)
+SIM_UNSUPPORTED(svcCreateSession, session_h *server_handle, session_h *client_handle, uint32_t unknown0, uint64_t unknown1)
+SIM_UNSUPPORTED(svcAcceptSession, session_h *out, port_h port)
+SIM_UNSUPPORTED(svcReplyAndReceive, uint32_t *handle_idx, const session_h *handles, uint32_t num_handles, session_h reply_session, uint64_t timeout)
+SIM_UNSUPPORTED(svcReplyAndReceiveWithUserBuffer, uint32_t *handle_idx, void *buffer, uint64_t size, const session_h *handles, uint32_t num_handles, session_h reply_session, uint64_t timeout)
+SIM_UNSUPPORTED(svcReadWriteRegister, uint32_t *out_value, uint64_t addr, uint32_t rw_mask, uint32_t in_value)
+SIM_UNSUPPORTED(svcMapTransferMemory, transfer_memory_h handle, void *addr, size_t size, uint32_t perm)
+SIM_UNSUPPORTED(svcUnmapTransferMemory, transfer_memory_h handle, void *addr, size_t size)
+SIM_UNSUPPORTED(svcQueryIoMapping, void *virt_addr, uint64_t phys_addr, uint64_t size)
+SIM_UNSUPPORTED(svcAttachDeviceAddressSpace, uint64_t device, dev_addr_space_h space)
+SIM_UNSUPPORTED(svcDetachDeviceAddressSpace, uint64_t device, dev_addr_space_h space)
+SIM_UNSUPPORTED(svcMapDeviceAddressSpaceByForce, dev_addr_space_h space, process_h process, uint64_t dev_addr, uint64_t dev_size, uint64_t map_addr, uint32_t perm)
+SIM_UNSUPPORTED(svcMapDeviceAddressSpaceAligned, dev_addr_space_h space, process_h process, uint64_t dev_addr, uint64_t dev_size, uint64_t map_addr, uint32_t perm)
+SIM_UNSUPPORTED(svcUnmapDeviceAddressSpace, dev_addr_space_h space, process_h process, uint64_t map_addr, uint64_t map_size, uint32_t perm)
+SIM_UNSUPPORTED(svcDebugActiveProcess, debug_h *out, uint64_t process_id)
+SIM_UNSUPPORTED(svcQueryDebugProcessMemory, memory_info_t *memory_info, uint32_t *page_info, debug_h debug, uint64_t addr)
+SIM_UNSUPPORTED(svcReadDebugProcessMemory, void *buffer, debug_h debug, uint64_t addr, uint64_t size)
+SIM_UNSUPPORTED(svcWriteDebugProcessMemory, debug_h debug, void *buffer, uint64_t addr, uint64_t size)
+SIM_UNSUPPORTED(svcSetProcessMemoryPermission, process_h process, uint64_t addr, uint64_t size, uint32_t perm)
+SIM_UNSUPPORTED(svcMapProcessCodeMemory, process_h process, uint64_t dest, uint64_t src, uint64_t size)
+SIM_UNSUPPORTED(svcUnmapProcessCodeMemory, process_h process, uint64_t dest, uint64_t src, uint64_t size)
+
+void svcExitProcess() {
+	exit(0);
+}
+
+void svcExitThread() {
+	pthread_exit(NULL);
+}
+
+// TRN::Sim
+
+static mrb_value mrb_trn_sim_define_service(mrb_state *mrb, mrb_value self) {
+	char *name;
+	mrb_value block;
+	mrb_int num_args = mrb_get_args(mrb, "z&", &name, &block);
+	if(mrb_nil_p(block)) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "no responder block given");
+	}
+	sim_service_t *service = sim_service_add(name, sim_respond_ruby);
+	if(service == NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "too many simulated services");
+	}
+	service->mrb = mrb;
+	service->block = block;
+	// keeps the block alive
+	mrb_value blocks = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__responders__"));
+	if(mrb_nil_p(blocks)) {
+		blocks = mrb_hash_new(mrb);
+		mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__responders__"), blocks);
+	}
+	mrb_hash_set(mrb, blocks, mrb_str_new_cstr(mrb, service->name), block);
+	return mrb_nil_value();
+}
+
+static mrb_value mrb_trn_sim_open_handles(mrb_state *mrb, mrb_value self) {
+	mrb_int count = 0;
+	for(size_t i = 0; i < SIM_MAX_HANDLES; i++) {
+		if(sim_handles[i].kind != SIM_HANDLE_FREE) {
+			count++;
+		}
+	}
+	return mrb_fixnum_value(count);
+}
+
+void mrb_transistor_sim_init(mrb_state *mrb) {
+	sim_service_add("sim:echo", sim_respond_echo);
+	sim_service_add("sim:null", sim_respond_null);
+
+	struct RClass *mod_sim = mrb_define_module_under(mrb, mod_transistor, "Sim");
+	mrb_define_class_method(mrb, mod_sim, "define_service", mrb_trn_sim_define_service, MRB_ARGS_ARG(1, 0) | MRB_ARGS_BLOCK());
+	mrb_define_class_method(mrb, mod_sim, "open_handles", mrb_trn_sim_open_handles, MRB_ARGS_ARG(0, 0));
+	mrb_define_const(mrb, mod_sim, "TICKS_PER_SECOND", mrb_fixnum_value(SIM_TICKS_PER_SECOND));
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include<mruby.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Page-backed size-class allocator for the mruby heap. Opt in when opening
+// the interpreter:
+//
+//   mrb_state *mrb = mrb_open_allocf(mrb_trn_allocf, NULL);
+//
+// TRN::LL.heap_stats reports live, peak and footprint bytes.
+void *mrb_trn_allocf(mrb_state *mrb, void *p, size_t size, void *ud);
+
+#ifdef __cplusplus
+}
+#endif
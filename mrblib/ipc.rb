@@ -119,6 +119,13 @@ module TRN
         end
       end
       
+      # auto-select buffer types: small payloads go inline through the
+      # server's pointer buffer, large ones are mapped (see
+      # TRN::IPC.auto_buffer_threshold). The server has to declare the
+      # buffer as auto-select too.
+      BUFFER_AUTO_IN = 0x21
+      BUFFER_AUTO_OUT = 0x22
+
       def initialize(command_id)
         @command_id = command_id
         @in_params = []
@@ -134,28 +141,28 @@ module TRN
         @in_move_handle_count = 0
         @out_move_handle_count = 0
         @buffers = []
-        _invalidate
+        @dirty = true
       end
       
       def in_object(key)
         @in_params.push(TransferObject.new(key, @in_object_count))
         @in_object_count+= 1
-        _invalidate
+        @dirty = true
       end
 
       def out_object(key)
         @out_params.push(TransferObject.new(key, @out_object_count))
         @out_object_count+= 1
-        _invalidate
+        @dirty = true
       end
 
-      def in_raw(key, size, alignment)
+      def in_raw(key, size, alignment, is_numeric=false)
         pos = @in_raw_size
         pos+= alignment - 1
         pos-= pos % alignment
         @in_raw_size = pos + size
-        @in_params.push(RawData.new(key, pos, size, alignment, nil))
-        _invalidate
+        @in_params.push(RawData.new(key, pos, size, alignment, is_numeric))
+        @dirty = true
       end
 
       def out_raw(key, size, alignment, is_numeric=false)
@@ -164,52 +171,81 @@ module TRN
         pos-= pos % alignment
         @out_raw_size = pos + size
         @out_params.push(RawData.new(key, pos, size, alignment, is_numeric))
-        _invalidate
+        @dirty = true
       end
 
       def in_copy_handle(key)
         @in_params.push(TransferCopyHandle.new(key, @in_copy_handle_count))
         @in_copy_handle_count+= 1
-        _invalidate
+        @dirty = true
       end
 
       def out_copy_handle(key)
         @out_params.push(TransferCopyHandle.new(key, @out_copy_handle_count))
         @out_copy_handle_count+= 1
-        _invalidate
+        @dirty = true
       end
 
       def in_move_handle(key)
         @in_params.push(TransferMoveHandle.new(key, @in_move_handle_count))
         @in_move_handle_count+= 1
-        _invalidate
+        @dirty = true
       end
 
       def out_move_handle(key)
         @out_params.push(TransferMoveHandle.new(key, @out_move_handle_count))
         @out_move_handle_count+= 1
-        _invalidate
+        @dirty = true
       end
 
       def buffer(key, type)
         buffer = Buffer.new(key, type, @buffers.length)
         @buffers.push(buffer)
         @in_params.push(buffer)
-        _invalidate
+        @dirty = true
       end
 
       def in_pid()
         @send_pid = true
-        _invalidate
+        @dirty = true
+      end
+
+      def in_u8(key)
+        in_raw(key, 1, 1, true)
+      end
+
+      def in_u32(key)
+        in_raw(key, 4, 4, true)
+      end
+
+      def in_u64(key)
+        in_raw(key, 8, 8, true)
+      end
+
+      def out_u8(key)
+        out_raw(key, 1, 1, true)
+      end
+
+      def out_u32(key)
+        out_raw(key, 4, 4, true)
+      end
+
+      # values that don't fit in an Integer come back as the raw 8-byte String
+      def out_u64(key)
+        out_raw(key, 8, 8, true)
       end
 
       def out_pid(key)
         @recv_pid = true
         @out_params.push(OutPid.new(key))
-        _invalidate
+        @dirty = true
       end
       
       def _pack(hash)
+        if @dirty then
+          _invalidate
+          @dirty = false
+        end
         @in_params.each do |prop|
           if !hash.has_key?(prop.key) then
             raise "missing '#{prop.key}'"
@@ -308,12 +344,109 @@ module TRN
       attr_reader :params
     end
     
+    class Command
+      def initialize(object, message)
+        @object = object
+        @message = message
+        @message._compile
+        @message.freeze
+      end
+      attr_reader :message
+
+      def call(params={})
+        @object._invoke(@message, params)
+      end
+    end # class Command
+    
     class Object
       def build(id, &block)
         mb = MessageBuilder.new(id)
         mb.instance_eval &block
         return send(mb.message, mb.params)
       end
+
+      def prepare(id, &block)
+        message = Message.new(id)
+        if block then
+          message.instance_eval &block
+        end
+        return Command.new(self, message)
+      end
+
+      # an object that sends through up to limit clones of this session
+      def pooled(limit=8)
+        SessionPool.new(self, limit).object
+      end
     end # class Object
+
+    # issues a sequence of requests from one native call instead of one
+    # interpreter round trip each:
+    #
+    #   results = TRN::IPC.batch do |b|
+    #     b.call(ds, :AddUsbStringDescriptor, "transistor")
+    #     b.call(ds, :SetUsbDeviceDescriptor, 2, descriptor)
+    #     b.add(object, message, {:value => 1})
+    #   end
+    #
+    # each result is what the request would have returned, or the exception
+    # it raised (TRN::ResultError#code has the result). with abort_on_error
+    # the first failure stops the batch and is raised instead.
+    def self.batch(abort_on_error=false)
+      batch = Batch.new
+      yield batch
+      batch.submit(abort_on_error)
+    end
+
+    class Batch
+      def initialize
+        @requests = [] # [object, message, params, ...]
+      end
+
+      def size
+        @requests.length / 3
+      end
+
+      # a Message with its parameter hash, as for Object#send; returns the
+      # index of its result
+      def add(object, message, params={})
+        @requests.push(object, message, params)
+        size - 1
+      end
+
+      def build(object, id, &block)
+        mb = MessageBuilder.new(id)
+        mb.instance_eval &block
+        add(object, mb.message, mb.params)
+      end
+
+      # a generated service stub method
+      def call(service, method, *args)
+        @requests.push(service, method.to_sym, args)
+        size - 1
+      end
+
+      def submit(abort_on_error=false)
+        IPC._submit(@requests, abort_on_error)
+      end
+    end # class Batch
+
+    class Server
+      # registers a handler method for a command; the block describes the
+      # layout from the client's point of view (in_* arrive, out_* are returned)
+      def command(id, method, &block)
+        message = Message.new(id)
+        if block then
+          message.instance_eval &block
+        end
+        message._compile
+        message.freeze
+        _register(method, message)
+      end
+
+      def run
+        while process do
+        end
+      end
+    end # class Server
   end # module IPC
 end # module TRN
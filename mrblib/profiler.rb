@@ -0,0 +1,28 @@
+module TRN
+  class Profiler
+    #   profiler = TRN::Profiler.new(500)
+    #   profiler.profile do
+    #     profiler.span(:setup) { ... }
+    #     ...
+    #   end
+    #   profiler.write_trace("sd:/trace.json") # chrome://tracing, ui.perfetto.dev
+    #   profiler.write_collapsed("sd:/stacks.txt") # flamegraph.pl
+    def profile
+      start
+      begin
+        yield
+      ensure
+        stop
+      end
+    end
+
+    def span(name)
+      begin_span(name)
+      begin
+        yield
+      ensure
+        end_span(name)
+      end
+    end
+  end
+end
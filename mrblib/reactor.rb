@@ -0,0 +1,92 @@
+module TRN
+  # runs fibers that wait on kernel handles instead of polling them.
+  #
+  #   reactor = TRN::Reactor.new
+  #   reactor.spawn do
+  #     loop do
+  #       msg = getter.await_message(reactor)
+  #       ...
+  #     end
+  #   end
+  #   reactor.run
+  #
+  # timeouts are in nanoseconds; -1 waits forever.
+  class Reactor
+    def initialize
+      @wait_set = WaitSet.new
+      @waiters = {} # slot => fiber, or :root for a wait outside any fiber
+      @current = nil
+    end
+
+    # number of waits in flight
+    def pending
+      @waiters.size
+    end
+
+    # runs the block in a new fiber up to its first await
+    def spawn(&block)
+      fiber = Fiber.new do
+        block.call(self)
+      end
+      resume_fiber(fiber, nil)
+      fiber
+    end
+
+    # returns true when the handle was signalled, false on timeout. outside a
+    # reactor fiber this drives the reactor until the wait completes.
+    def await(handle, timeout=-1)
+      suspend(@wait_set.add(handle, timeout))
+    end
+
+    def sleep(timeout)
+      suspend(@wait_set.add(0, timeout))
+      nil
+    end
+
+    # waits once and resumes every fiber whose wait completed
+    def run_once(timeout=-1)
+      @wait_set.wait(timeout).each do |slot, signalled|
+        waiter = @waiters.delete(slot)
+        if waiter == :root then
+          @root_result = signalled
+        elsif waiter then
+          resume_fiber(waiter, signalled)
+        end
+      end
+      nil
+    end
+
+    # runs until no fiber is waiting
+    def run
+      while !@waiters.empty? do
+        run_once
+      end
+    end
+
+    private
+    def suspend(slot)
+      if @current then
+        @waiters[slot] = @current
+        return Fiber.yield
+      end
+      @waiters[slot] = :root
+      @root_result = nil
+      while @root_result == nil do
+        run_once
+      end
+      result = @root_result
+      @root_result = nil
+      result
+    end
+
+    def resume_fiber(fiber, value)
+      outer = @current
+      @current = fiber
+      begin
+        fiber.resume(value)
+      ensure
+        @current = outer
+      end
+    end
+  end
+end
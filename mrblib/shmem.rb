@@ -0,0 +1,30 @@
+module TRN
+  class SharedMemory
+    #   Status = TRN::SharedMemory::Layout.new(generation: [:u32, 0], write_index: [:u32, 4])
+    #   status = memory.view(Status)
+    #   status.watch(:generation)
+    #   handle(status.write_index) if status.changed?
+    def view(layout, offset=0)
+      layout.view_class.wrap(self, layout, offset)
+    end
+
+    class Layout
+      # a View subclass with a reader and writer per field
+      def view_class
+        if !@view_class then
+          klass = Class.new(View)
+          names.each_with_index do |name, i|
+            klass.send(:define_method, name) do
+              get(i)
+            end
+            klass.send(:define_method, "#{name}=") do |value|
+              set(i, value)
+            end
+          end
+          @view_class = klass
+        end
+        @view_class
+      end
+    end
+  end
+end
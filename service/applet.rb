@@ -1,5 +1,6 @@
 module TRN
   module Service
+    # commands are generated from idl/applet.idl
     class AppletProxy
       def initialize(object)
         @object = object
@@ -12,42 +13,29 @@ module TRN
           out_object(:obj)
         end[:obj]
       end
-      def GetCommonStateGetter
-        ICommonStateGetter.new(get_session(0))
-      end
-      def GetSelfController
-        ISelfController.new(get_session(1))
-      end
-      def GetWindowController
-        get_session(2)
-      end
-      def GetAudioController
-        get_session(3)
-      end
-      def GetDisplayController
-        get_session(4)
-      end
-      def GetProcessWindingController
-        IProcessWindingController.new(get_session(10))
-      end
-      def GetLibraryAppletCreator
-        ILibraryAppletCreator.new(get_session(11))
-      end
-      def GetApplicationFunctions
-        IApplicationFunctions.new(get_session(20))
-      end
-      def GetDebugFunctions
-        IDebugFunctions.new(get_session(1000))
-      end
     end
     class ICommonStateGetter
+      RESULT_NO_MESSAGE = 0x680 # am module 128, description 3
       def initialize(object)
         @object = object
       end
-      def ReceiveMessage
-        @object.build(1) do
-          out_u32(:message)
-        end[:message]
+      def close
+        TRN::LL::SVC.close_handle(@event) if @event
+        @object.close
+      end
+      # waits on the message event from a TRN::Reactor fiber; returns the next
+      # message, or nil on timeout
+      def await_message(reactor, timeout=-1)
+        @event ||= GetEventHandle()
+        while reactor.await(@event, timeout) do
+          begin
+            return ReceiveMessage()
+          rescue TRN::ResultError => e
+            # queue drained between the signal and the receive
+            raise unless e.code == RESULT_NO_MESSAGE
+          end
+        end
+        nil
       end
     end
     class IDebugFunctions
@@ -57,12 +45,6 @@ module TRN
       def close
         @object.close
       end
-      def OpenMainApplication
-        IApplicationAccessor.new(
-          @object.build(1) do
-            out_object(:main_app)
-          end[:main_app])
-      end
     end
     class IApplicationAccessor
       def initialize(object)
@@ -71,9 +53,6 @@ module TRN
       def close
         @object.close
       end
-      def RequestForApplicationToGetForeground
-        @object.build(101) do end
-      end
     end
     class ILibraryAppletCreator
       def initialize(object)
@@ -93,24 +72,22 @@ module TRN
     end
     class IApplicationProxyService
       def initialize
-        @object = TRN::get_service("appletOE")
+        @object = TRN::get_service("appletOE", true)
+        # sub-interfaces share this session as domain objects
+        @object.convert_to_domain
       end
       def close
         @object.close
       end
       def OpenApplicationProxy
-        IApplicationProxy.new(
-          @object.build(0) do
-            in_u64(0)
-            in_pid
-            in_copy_handle(0xffff8001)
-            out_object(:proxy)
-          end[:proxy])
+        _OpenApplicationProxy(0, 0xffff8001)
       end
     end
     class IAllSystemAppletProxiesService
       def initialize
-        @object = TRN::get_service("appletAE")
+        @object = TRN::get_service("appletAE", true)
+        # sub-interfaces share this session as domain objects
+        @object.convert_to_domain
       end
       def close
         @object.close
@@ -124,24 +101,19 @@ module TRN
         end[:proxy]
       end
       def OpenSystemAppletProxy
-        ISystemAppletProxy.new(OpenProxy(100))
+        _OpenSystemAppletProxy(0, 0xffff8001)
       end
       def OpenLibraryAppletProxy
-        ILibraryAppletProxy.new(OpenProxy(200))
+        _OpenLibraryAppletProxy(0, 0xffff8001)
       end
       def OpenOverlayAppletProxy
-        IOverlayAppletProxy.new(OpenProxy(300))
+        _OpenOverlayAppletProxy(0, 0xffff8001)
       end
       def OpenSystemApplicationProxy
-        IApplicationProxy.new(OpenProxy(350))
+        _OpenSystemApplicationProxy(0, 0xffff8001)
       end
       def CreateSelfLibraryAppletCreatorForDevelop
-        ILibraryAppletCreator.new(
-          @object.build(400) do
-            in_u64
-            in_pid
-          out_object(:ilac)
-          end[:ilac])
+        _CreateSelfLibraryAppletCreatorForDevelop(0)
       end
     end
   end
@@ -0,0 +1,87 @@
+module TRN
+  module Service
+    module Descriptor
+      class StringDescriptor
+        def initialize(string)
+          @string = string
+        end
+        def pack
+          return [2 + @string.length, 3, @string].pack("CCa128")
+        end
+      end
+    end
+
+    # commands are generated from idl/usb.idl
+    class IDsEndpoint
+      def initialize(object)
+        @object = object
+      end
+      def close
+        TRN::LL::SVC.close_handle(@completion_event) if @completion_event
+        @object.close
+      end
+      # waits for the next transfer to complete from a TRN::Reactor fiber;
+      # returns the urb report, or nil on timeout
+      def await_completion(reactor, timeout=-1)
+        @completion_event ||= GetCompletionEvent()
+        return nil if !reactor.await(@completion_event, timeout)
+        TRN::LL::SVC.clear_event(@completion_event)
+        GetUrbReport()
+      end
+      # takes a page-aligned TRN::Buffer, or a size and raw address
+      def PostBufferAsync(buffer, address=nil)
+        if address then
+          _PostBufferAsync(buffer, address)
+        else
+          _PostBufferAsync(buffer.size, buffer.address)
+        end
+      end
+      # mode is :read (host to device) or :write (device to host)
+      def stream(mode, buffer_size=0x10000, depth=4)
+        UsbStream.new(self, mode, buffer_size, depth)
+      end
+    end
+    
+    class IDsInterface
+      def initialize(object)
+        @object = object
+      end
+      def close
+        @object.close
+      end
+    end
+    
+    class IDsService
+      def initialize
+        @object = TRN::get_service("usb:ds", true)
+      end
+      def close
+        TRN::LL::SVC.close_handle(@state_event) if @state_event
+        @object.close
+      end
+      # waits from a TRN::Reactor fiber until GetState returns state; false on
+      # timeout
+      def await_state(reactor, state, timeout=-1)
+        @state_event ||= GetStateChangeEvent()
+        deadline = timeout < 0 ? nil : TRN::LL::SVC.get_system_tick + TRN::LL.ns_to_ticks(timeout)
+        loop do
+          TRN::LL::SVC.clear_event(@state_event)
+          return true if GetState() == state
+          remaining = -1
+          if deadline then
+            now = TRN::LL::SVC.get_system_tick
+            return false if now >= deadline
+            remaining = TRN::LL.ticks_to_ns(deadline - now)
+          end
+          return false if !reactor.await(@state_event, remaining)
+        end
+      end
+      def BindClientProcess
+        _BindClientProcess(0xffff8001)
+      end
+      def AddUsbStringDescriptor(string)
+        _AddUsbStringDescriptor(Descriptor::StringDescriptor.new(string).pack)
+      end
+    end
+  end
+end
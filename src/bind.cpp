@@ -1,5 +1,8 @@
 #include<mruby.h>
 #include<mruby/array.h>
+#include<mruby/class.h>
+#include<mruby/data.h>
+#include<mruby/hash.h>
 #include<mruby/value.h>
 #include<mruby/string.h>
 
@@ -8,8 +11,14 @@
 #include<libtransistor/address_space.h>
 #include<libtransistor/ipc/pm.h>
 
-#include<string>
+#include<stddef.h>
+#include<stdlib.h>
+#include<string.h>
+
 #include<array>
+#include<initializer_list>
+#include<tuple>
+#include<type_traits>
 #include<utility>
 
 #include "trn.h"
@@ -20,32 +29,359 @@ struct BindTableEntry {
 	size_t num_args;
 };
 
-template<auto>
+struct StructField {
+	const char *name;
+	size_t offset;
+	size_t size;
+};
+
+// Native structs returned through out-pointers get a read-only wrapper class.
+template<typename T>
+struct StructBinding;
+
+template<>
+struct StructBinding<memory_info_t> {
+	static constexpr const char *name = "MemoryInfo";
+	static constexpr StructField fields[] = {
+		{"base_addr", offsetof(memory_info_t, base_addr), 8},
+		{"size", offsetof(memory_info_t, size), 8},
+		{"memory_type", offsetof(memory_info_t, memory_type), 4},
+		{"memory_attribute", offsetof(memory_info_t, memory_attribute), 4},
+		{"permission", offsetof(memory_info_t, permission), 4},
+		{"device_ref_count", offsetof(memory_info_t, device_ref_count), 4},
+		{"ipc_ref_count", offsetof(memory_info_t, ipc_ref_count), 4},
+	};
+};
+
+template<typename T>
+struct StructClass {
+	using B = StructBinding<T>;
+	static constexpr size_t num_fields = sizeof(B::fields) / sizeof(B::fields[0]);
+	static thread_local struct RClass *klass;
+
+	static void Free(mrb_state *mrb, void *data) {
+		mrb_free(mrb, data);
+	}
+	static constexpr mrb_data_type data_type = {B::name, Free};
+
+	static mrb_value ReadField(mrb_state *mrb, const T *value, size_t i) {
+		uint64_t v = 0;
+		memcpy(&v, (const uint8_t*) value + B::fields[i].offset, B::fields[i].size); // little-endian
+		return mrb_fixnum_value(v);
+	}
+
+	template<size_t I>
+	static mrb_value Get(mrb_state *mrb, mrb_value self) {
+		return ReadField(mrb, (T*) mrb_data_get_ptr(mrb, self, &data_type), I);
+	}
+
+	static mrb_value ToH(mrb_state *mrb, mrb_value self) {
+		T *value = (T*) mrb_data_get_ptr(mrb, self, &data_type);
+		mrb_value hash = mrb_hash_new_capa(mrb, num_fields);
+		for(size_t i = 0; i < num_fields; i++) {
+			mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_cstr(mrb, B::fields[i].name)), ReadField(mrb, value, i));
+		}
+		return hash;
+	}
+
+	static mrb_value New(mrb_state *mrb, const T &value) {
+		T *storage = (T*) mrb_malloc(mrb, sizeof(T));
+		*storage = value;
+		return mrb_obj_value(Data_Wrap_Struct(mrb, klass, &data_type, storage));
+	}
+
+	template<size_t... I>
+	static void Define(mrb_state *mrb, struct RClass *mod, std::index_sequence<I...>) {
+		klass = mrb_define_class_under(mrb, mod, B::name, mrb->object_class);
+		// instances only come out of the bound functions
+		MRB_SET_INSTANCE_TT(klass, MRB_TT_DATA);
+		mrb_undef_class_method(mrb, klass, "new");
+		(mrb_define_method(mrb, klass, B::fields[I].name, &Get<I>, MRB_ARGS_ARG(0, 0)), ...);
+		mrb_define_method(mrb, klass, "to_h", &ToH, MRB_ARGS_ARG(0, 0));
+	}
+
+	static void Define(mrb_state *mrb, struct RClass *mod) {
+		Define(mrb, mod, std::make_index_sequence<num_fields>());
+	}
+};
+
+template<typename T>
+thread_local struct RClass *StructClass<T>::klass;
+
+extern "C" mrb_value mrb_trn_memory_info_new(mrb_state *mrb, const memory_info_t *info) {
+	return StructClass<memory_info_t>::New(mrb, *info);
+}
+
+enum class ArgKind {
+	Int,       // integer or address
+	Out,       // pointer to scalar, returned
+	OutStruct, // pointer to struct, returned as a StructBinding class
+	Array,     // const pointer followed by a count, passed as an Array
+	Count,     // count belonging to the preceding Array
+	String,    // const char pointer followed by a length, passed as a String
+	Length,    // length belonging to the preceding String
+	CString,   // NUL-terminated const char pointer
+};
+
+// handles per wait is the largest array any of the bound functions take
+static constexpr size_t MaxArrayArgs = 0x40;
+
+template<bool Typed, typename... Args>
+struct Signature {
+	static constexpr size_t N = sizeof...(Args);
+
+	template<typename A>
+	using pointee = std::remove_pointer_t<A>;
+
+	template<typename A>
+	static constexpr bool is_out = std::is_pointer_v<A> && !std::is_const_v<pointee<A>> &&
+		(std::is_arithmetic_v<pointee<A>> || std::is_pointer_v<pointee<A>>);
+	template<typename A>
+	static constexpr bool is_out_struct = std::is_pointer_v<A> && !std::is_const_v<pointee<A>> &&
+		std::is_class_v<pointee<A>>;
+	template<typename A>
+	static constexpr bool is_const_array = std::is_pointer_v<A> && std::is_const_v<pointee<A>> &&
+		std::is_arithmetic_v<pointee<A>>;
+	template<typename A>
+	static constexpr bool is_char = std::is_same_v<std::remove_cv_t<pointee<A>>, char>;
+
+	// trailing sentinels keep these well-formed for empty signatures
+	static constexpr bool outs[] = {is_out<Args>..., false};
+	static constexpr bool out_structs[] = {is_out_struct<Args>..., false};
+	static constexpr bool const_arrays[] = {is_const_array<Args>..., false};
+	static constexpr bool chars[] = {is_char<Args>..., false};
+	static constexpr bool integrals[] = {std::is_integral_v<Args>..., false};
+
+	static constexpr std::array<ArgKind, N> Classify() {
+		std::array<ArgKind, N> kinds {};
+		for(size_t i = 0; i < N; i++) {
+			kinds[i] = ArgKind::Int;
+			if(!Typed) {
+				continue;
+			}
+			if(const_arrays[i] && chars[i]) {
+				if(i + 1 < N && integrals[i + 1]) {
+					kinds[i] = ArgKind::String;
+					kinds[++i] = ArgKind::Length;
+				} else {
+					kinds[i] = ArgKind::CString;
+				}
+			} else if(const_arrays[i] && i + 1 < N && integrals[i + 1]) {
+				kinds[i] = ArgKind::Array;
+				kinds[++i] = ArgKind::Count;
+			} else if(outs[i]) {
+				kinds[i] = ArgKind::Out;
+			} else if(out_structs[i]) {
+				kinds[i] = ArgKind::OutStruct;
+			}
+		}
+		return kinds;
+	}
+
+	static constexpr std::array<ArgKind, N> kinds = Classify();
+
+	static constexpr size_t CountKinds(std::initializer_list<ArgKind> which) {
+		size_t n = 0;
+		for(size_t i = 0; i < N; i++) {
+			for(ArgKind kind : which) {
+				if(kinds[i] == kind) {
+					n++;
+				}
+			}
+		}
+		return n;
+	}
+
+	static constexpr size_t num_args = CountKinds({ArgKind::Int, ArgKind::Array, ArgKind::String, ArgKind::CString});
+	static constexpr size_t num_outs = CountKinds({ArgKind::Out, ArgKind::OutStruct});
+
+	static constexpr std::array<char, num_args + 1> ArgSpec() {
+		std::array<char, num_args + 1> spec {};
+		size_t j = 0;
+		for(size_t i = 0; i < N; i++) {
+			switch(kinds[i]) {
+			case ArgKind::Int: spec[j++] = 'i'; break;
+			case ArgKind::Array: spec[j++] = 'A'; break;
+			case ArgKind::String: spec[j++] = 's'; break;
+			case ArgKind::CString: spec[j++] = 'z'; break;
+			default: break;
+			}
+		}
+		spec[j] = 0;
+		return spec;
+	}
+
+	static constexpr std::array<char, num_args + 1> arg_spec = ArgSpec();
+};
+
+template<ArgKind K, typename A>
+struct Slot {
+};
+
+template<typename A>
+struct Slot<ArgKind::Int, A> {
+	mrb_int value;
+	auto Targets() { return std::make_tuple(&value); }
+};
+
+template<typename A>
+struct Slot<ArgKind::Out, A> {
+	std::remove_pointer_t<A> value;
+	auto Targets() { return std::make_tuple(); }
+};
+
+template<typename A>
+struct Slot<ArgKind::OutStruct, A> {
+	std::remove_pointer_t<A> value;
+	auto Targets() { return std::make_tuple(); }
+};
+
+template<typename A>
+struct Slot<ArgKind::Array, A> {
+	mrb_value array;
+	std::array<std::remove_const_t<std::remove_pointer_t<A>>, MaxArrayArgs> values;
+	mrb_int count;
+	auto Targets() { return std::make_tuple(&array); }
+};
+
+template<typename A>
+struct Slot<ArgKind::String, A> {
+	char *ptr;
+	mrb_int len;
+	auto Targets() { return std::make_tuple(&ptr, &len); }
+};
+
+template<typename A>
+struct Slot<ArgKind::CString, A> {
+	char *ptr;
+	auto Targets() { return std::make_tuple(&ptr); }
+};
+
+template<typename A>
+struct Slot<ArgKind::Count, A> {
+	auto Targets() { return std::make_tuple(); }
+};
+
+template<typename A>
+struct Slot<ArgKind::Length, A> {
+	auto Targets() { return std::make_tuple(); }
+};
+
+template<auto Func, bool Typed = true>
 struct S;
 
-template<typename Ret, typename... Args, Ret (*Func)(Args...)>
-struct S<Func> {
+template<typename Ret, typename... Args, Ret (*Func)(Args...), bool Typed>
+struct S<Func, Typed> {
+	using Sig = Signature<Typed, Args...>;
+
 	template<size_t I>
 	using get_arg = std::tuple_element_t<I, std::tuple<Args...>>;
-	static mrb_value Bind(mrb_state* mrb, mrb_value self) {
-		std::string arg_spec(sizeof...(Args), 'i');
-		std::array<uint64_t, sizeof...(Args)> u64_args;
-		return std::apply([&](auto&... args) {
-				mrb_get_args(mrb, arg_spec.c_str(), &args...);
-				if constexpr(std::is_void<Ret>::value) {
-					Func(((Args) args)...);
-					return mrb_fixnum_value(0);
-				} else if constexpr(std::is_same<Ret, void*>::value) {
-					return mrb_fixnum_value((uint64_t) Func(((Args) args)...));
-				} else {
-					return mrb_fixnum_value(Func(((Args) args)...));
+
+	template<size_t I>
+	using get_slot = Slot<Sig::kinds[I], get_arg<I>>;
+
+	template<typename Seq>
+	struct SlotsFor;
+	template<size_t... I>
+	struct SlotsFor<std::index_sequence<I...>> {
+		using type = std::tuple<get_slot<I>...>;
+	};
+	using Slots = typename SlotsFor<std::index_sequence_for<Args...>>::type;
+
+	template<size_t I>
+	static void Prepare(mrb_state *mrb, Slots &slots) {
+		if constexpr(Sig::kinds[I] == ArgKind::Array) {
+			auto &slot = std::get<I>(slots);
+			slot.count = RARRAY_LEN(slot.array);
+			if(slot.count > (mrb_int) MaxArrayArgs) {
+				mrb_raise(mrb, E_ARGUMENT_ERROR, "array too long");
+			}
+			for(mrb_int i = 0; i < slot.count; i++) {
+				mrb_value value = mrb_ary_entry(slot.array, i);
+				if(!mrb_fixnum_p(value)) {
+					mrb_raise(mrb, E_TYPE_ERROR, "expected an Array of Integers");
 				}
-			}, u64_args);
+				slot.values[i] = mrb_fixnum(value);
+			}
+		}
+	}
+
+	template<size_t I>
+	static get_arg<I> Convert(Slots &slots) {
+		using A = get_arg<I>;
+		constexpr ArgKind kind = Sig::kinds[I];
+		if constexpr(kind == ArgKind::Int) {
+			if constexpr(std::is_pointer_v<A>) {
+				return reinterpret_cast<A>(static_cast<uintptr_t>(std::get<I>(slots).value));
+			} else {
+				return static_cast<A>(std::get<I>(slots).value);
+			}
+		} else if constexpr(kind == ArgKind::Out || kind == ArgKind::OutStruct) {
+			return &std::get<I>(slots).value;
+		} else if constexpr(kind == ArgKind::Array) {
+			return std::get<I>(slots).values.data();
+		} else if constexpr(kind == ArgKind::Count) {
+			return static_cast<A>(std::get<I - 1>(slots).count);
+		} else if constexpr(kind == ArgKind::String || kind == ArgKind::CString) {
+			return std::get<I>(slots).ptr;
+		} else if constexpr(kind == ArgKind::Length) {
+			return static_cast<A>(std::get<I - 1>(slots).len);
+		}
+	}
+
+	template<typename T>
+	static mrb_value ToValue(mrb_state *mrb, const T &value) {
+		if constexpr(std::is_pointer_v<T>) {
+			return mrb_fixnum_value((uint64_t) value);
+		} else if constexpr(std::is_class_v<T>) {
+			return StructClass<T>::New(mrb, value);
+		} else {
+			return mrb_fixnum_value(value);
+		}
+	}
+
+	template<size_t I>
+	static void CollectOut(mrb_state *mrb, Slots &slots, mrb_value array) {
+		if constexpr(Sig::kinds[I] == ArgKind::Out || Sig::kinds[I] == ArgKind::OutStruct) {
+			mrb_ary_push(mrb, array, ToValue(mrb, std::get<I>(slots).value));
+		}
 	}
 
+	template<size_t... I>
+	static mrb_value Call(mrb_state *mrb, std::index_sequence<I...>) {
+		Slots slots;
+		std::apply([&](auto... targets) {
+				mrb_get_args(mrb, Sig::arg_spec.data(), targets...);
+			}, std::tuple_cat(std::get<I>(slots).Targets()...));
+		(Prepare<I>(mrb, slots), ...);
+
+		mrb_value ret;
+		if constexpr(std::is_void<Ret>::value) {
+			Func(Convert<I>(slots)...);
+			ret = mrb_fixnum_value(0);
+		} else {
+			ret = ToValue(mrb, Func(Convert<I>(slots)...));
+		}
+
+		if constexpr(Sig::num_outs == 0) {
+			return ret;
+		} else {
+			// [result, out...]
+			mrb_value array = mrb_ary_new_capa(mrb, Sig::num_outs + 1);
+			if constexpr(!std::is_void<Ret>::value) {
+				mrb_ary_push(mrb, array, ret);
+			}
+			(CollectOut<I>(mrb, slots, array), ...);
+			return array;
+		}
+	}
+
+	static mrb_value Bind(mrb_state* mrb, mrb_value self) {
+		return Call(mrb, std::index_sequence_for<Args...>());
+	}
 	
 	static BindTableEntry MakeEntry(const char *name) {
-		return {name, &Bind, sizeof...(Args)};
+		return {name, &Bind, Sig::num_args};
 	}
 };
 
@@ -56,6 +392,8 @@ static void bind(mrb_state *mrb, BindTableEntry *table, struct RClass *mod) {
 }
 
 extern "C" void mrb_transistor_bind_init(mrb_state *mrb) {
+	StructClass<memory_info_t>::Define(mrb, mod_transistor_ll);
+
 	BindTableEntry bind_table[] = {
 		S<malloc>::MakeEntry("malloc"),
 		S<free>::MakeEntry("free"),
@@ -89,10 +427,10 @@ extern "C" void mrb_transistor_bind_init(mrb_state *mrb) {
 		S<svcResetSignal>::MakeEntry("reset_signal"),
 		S<svcWaitSynchronization>::MakeEntry("wait_synchronization"),
 		S<svcCancelSynchronization>::MakeEntry("cancel_synchronization"),
-		S<svcArbitrateLock>::MakeEntry("arbitrate_lock"),
-		S<svcArbitrateUnlock>::MakeEntry("arbitrate_unlock"),
-		S<svcWaitProcessWideKeyAtomic>::MakeEntry("wait_process_wide_key_atomic"),
-		S<svcSignalProcessWideKey>::MakeEntry("signal_process_wide_key"),
+		S<svcArbitrateLock, false>::MakeEntry("arbitrate_lock"),
+		S<svcArbitrateUnlock, false>::MakeEntry("arbitrate_unlock"),
+		S<svcWaitProcessWideKeyAtomic, false>::MakeEntry("wait_process_wide_key_atomic"),
+		S<svcSignalProcessWideKey, false>::MakeEntry("signal_process_wide_key"),
 		S<svcGetSystemTick>::MakeEntry("get_system_tick"),
 		S<svcConnectToNamedPort>::MakeEntry("connect_to_named_port"),
 		S<svcSendSyncRequest>::MakeEntry("send_sync_request"),
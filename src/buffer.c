@@ -0,0 +1,271 @@
+#include<stdint.h>
+#include<malloc.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/class.h>
+#include<mruby/data.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// TRN::Buffer: a pinned region of native memory. Slices and wrapped
+// regions borrow their memory and keep the owner alive through @owner.
+// Lent views (USB transfer slots, server request buffers, shared memory)
+// can be revoked by their owner, after which they and their slices are empty.
+
+__thread struct RClass *class_Buffer;
+
+static void mrb_trn_buffer_dfree(mrb_state *mrb, void *data) {
+	trn_buffer_t *buffer = data;
+	if(!buffer) {
+		return;
+	}
+	switch(buffer->owner) {
+	case TRN_BUFFER_MALLOC:
+		free(buffer->data);
+		break;
+	case TRN_BUFFER_PAGES:
+		free_pages(buffer->data);
+		break;
+	case TRN_BUFFER_BORROWED:
+		break;
+	}
+	mrb_free(mrb, buffer);
+}
+
+const mrb_data_type dt_Buffer = {"Buffer", mrb_trn_buffer_dfree};
+
+mrb_value mrb_trn_buffer_wrap(mrb_state *mrb, void *data, size_t size, trn_buffer_owner_t owner, mrb_value parent) {
+	trn_buffer_t *buffer = mrb_calloc(mrb, sizeof(*buffer), 1);
+	buffer->data = data;
+	buffer->size = size;
+	buffer->owner = owner;
+	mrb_value obj = mrb_obj_value(Data_Wrap_Struct(mrb, class_Buffer, &dt_Buffer, buffer));
+	if(!mrb_nil_p(parent)) {
+		mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "@owner"), parent);
+	}
+	return obj;
+}
+
+// borrowed memory the owner takes back with mrb_trn_buffer_revoke
+mrb_value mrb_trn_buffer_lend(mrb_state *mrb, void *data, size_t size, mrb_value parent) {
+	mrb_value obj = mrb_trn_buffer_wrap(mrb, data, size, TRN_BUFFER_BORROWED, parent);
+	trn_buffer_t *buffer = DATA_PTR(obj);
+	buffer->lease = buffer;
+	return obj;
+}
+
+// empties a lent view and, lazily, every slice of it; anything else is left alone
+void mrb_trn_buffer_revoke(mrb_state *mrb, mrb_value value) {
+	trn_buffer_t *buffer = mrb_data_check_get_ptr(mrb, value, &dt_Buffer);
+	if(buffer && buffer->lease == buffer) {
+		buffer->revoked = true;
+		buffer->data = NULL;
+		buffer->size = 0;
+	}
+}
+
+static trn_buffer_t *mrb_trn_buffer_get(mrb_state *mrb, mrb_value self) {
+	trn_buffer_t *buffer = mrb_data_get_ptr(mrb, self, &dt_Buffer);
+	if(buffer && buffer->lease && buffer->lease->revoked) {
+		buffer->data = NULL;
+		buffer->size = 0;
+	}
+	return buffer;
+}
+
+void mrb_trn_buffer_region(mrb_state *mrb, mrb_value value, void **data, size_t *size) {
+	if(mrb_string_p(value)) {
+		*data = RSTRING_PTR(value);
+		*size = RSTRING_LEN(value);
+	} else {
+		trn_buffer_t *buffer = mrb_trn_buffer_get(mrb, value);
+		if(!buffer) {
+			mrb_raise(mrb, E_TYPE_ERROR, "expected a String or TRN::Buffer");
+		}
+		*data = buffer->data;
+		*size = buffer->size;
+	}
+}
+
+static void mrb_trn_buffer_check(mrb_state *mrb, trn_buffer_t *buffer, mrb_int offset, mrb_int size) {
+	if(offset < 0 || size < 0 || (size_t) offset > buffer->size || (size_t) size > buffer->size - offset) {
+		mrb_raisef(mrb, E_INDEX_ERROR, "range %S+%S out of buffer (size %S)",
+		           mrb_fixnum_value(offset), mrb_fixnum_value(size), mrb_fixnum_value(buffer->size));
+	}
+}
+
+static mrb_value mrb_trn_buffer_new(mrb_state *mrb, mrb_value self) {
+	mrb_int size;
+	mrb_int alignment = 0x10;
+	mrb_int num_args = mrb_get_args(mrb, "i|i", &size, &alignment);
+	if(size < 0) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "negative size");
+	}
+	void *data = memalign(alignment, size > 0 ? size : 1);
+	if(data == NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	memset(data, 0, size);
+	return mrb_trn_buffer_wrap(mrb, data, size, TRN_BUFFER_MALLOC, mrb_nil_value());
+}
+
+static mrb_value mrb_trn_buffer_pages(mrb_state *mrb, mrb_value self) {
+	size_t min, max;
+	mrb_int num_args = mrb_get_args(mrb, "i|i", &min, &max);
+	if(num_args == 1) {
+		max = min;
+	}
+
+	size_t actual;
+	void *data = alloc_pages(min, max, &actual);
+	if(data == NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	return mrb_trn_buffer_wrap(mrb, data, actual, TRN_BUFFER_PAGES, mrb_nil_value());
+}
+
+// foreign memory (transfer memory, hardware buffers); the caller keeps it mapped
+static mrb_value mrb_trn_buffer_wrap_m(mrb_state *mrb, mrb_value self) {
+	uint64_t address;
+	mrb_int size;
+	mrb_value owner = mrb_nil_value();
+	mrb_int num_args = mrb_get_args(mrb, "ii|o", &address, &size, &owner);
+	return mrb_trn_buffer_wrap(mrb, (void*) address, size, TRN_BUFFER_BORROWED, owner);
+}
+
+static mrb_value mrb_trn_buffer_from(mrb_state *mrb, mrb_value self) {
+	char *str;
+	mrb_int size;
+	mrb_int num_args = mrb_get_args(mrb, "s", &str, &size);
+	void *data = memalign(0x10, size > 0 ? size : 1);
+	if(data == NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	memcpy(data, str, size);
+	return mrb_trn_buffer_wrap(mrb, data, size, TRN_BUFFER_MALLOC, mrb_nil_value());
+}
+
+static mrb_value mrb_trn_buffer_address(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value((uint64_t) mrb_trn_buffer_get(mrb, self)->data);
+}
+
+static mrb_value mrb_trn_buffer_size(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(mrb_trn_buffer_get(mrb, self)->size);
+}
+
+static mrb_value mrb_trn_buffer_slice(mrb_state *mrb, mrb_value self) {
+	trn_buffer_t *buffer = mrb_trn_buffer_get(mrb, self);
+	mrb_int offset;
+	mrb_int size;
+	mrb_int num_args = mrb_get_args(mrb, "i|i", &offset, &size);
+	if(num_args == 1) {
+		size = buffer->size - offset;
+	}
+	mrb_trn_buffer_check(mrb, buffer, offset, size);
+
+	// slices of slices still point at the allocation's owner; a lent view is
+	// the owner of its slices, so they can see it being revoked
+	mrb_value owner = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@owner"));
+	if(buffer->owner != TRN_BUFFER_BORROWED || mrb_nil_p(owner) || buffer->lease == buffer) {
+		owner = self;
+	}
+	mrb_value slice = mrb_trn_buffer_wrap(mrb, buffer->data + offset, size, TRN_BUFFER_BORROWED, owner);
+	((trn_buffer_t*) DATA_PTR(slice))->lease = buffer->lease;
+	return slice;
+}
+
+static mrb_value mrb_trn_buffer_to_s(mrb_state *mrb, mrb_value self) {
+	trn_buffer_t *buffer = mrb_trn_buffer_get(mrb, self);
+	mrb_int offset = 0;
+	mrb_int size;
+	mrb_int num_args = mrb_get_args(mrb, "|ii", &offset, &size);
+	if(num_args < 2) {
+		size = buffer->size - offset;
+	}
+	mrb_trn_buffer_check(mrb, buffer, offset, size);
+	return mrb_str_new(mrb, (const char*) buffer->data + offset, size);
+}
+
+static mrb_value mrb_trn_buffer_write(mrb_state *mrb, mrb_value self) {
+	trn_buffer_t *buffer = mrb_trn_buffer_get(mrb, self);
+	mrb_int offset;
+	mrb_value source;
+	mrb_int num_args = mrb_get_args(mrb, "io", &offset, &source);
+
+	void *data;
+	size_t size;
+	mrb_trn_buffer_region(mrb, source, &data, &size);
+	mrb_trn_buffer_check(mrb, buffer, offset, size);
+	memmove(buffer->data + offset, data, size);
+	return mrb_fixnum_value(size);
+}
+
+static mrb_value mrb_trn_buffer_fill(mrb_state *mrb, mrb_value self) {
+	trn_buffer_t *buffer = mrb_trn_buffer_get(mrb, self);
+	mrb_int byte = 0;
+	mrb_int num_args = mrb_get_args(mrb, "|i", &byte);
+	memset(buffer->data, byte, buffer->size);
+	return self;
+}
+
+#define BUFFER_ACCESSORS(name, type) \
+	static mrb_value mrb_trn_buffer_get_##name(mrb_state *mrb, mrb_value self) { \
+		trn_buffer_t *buffer = mrb_trn_buffer_get(mrb, self); \
+		mrb_int offset; \
+		mrb_int num_args = mrb_get_args(mrb, "i", &offset); \
+		mrb_trn_buffer_check(mrb, buffer, offset, sizeof(type)); \
+		type v; \
+		memcpy(&v, buffer->data + offset, sizeof(v)); /* little-endian */ \
+		return mrb_fixnum_value(v); \
+	} \
+	static mrb_value mrb_trn_buffer_set_##name(mrb_state *mrb, mrb_value self) { \
+		trn_buffer_t *buffer = mrb_trn_buffer_get(mrb, self); \
+		mrb_int offset; \
+		mrb_int value; \
+		mrb_int num_args = mrb_get_args(mrb, "ii", &offset, &value); \
+		mrb_trn_buffer_check(mrb, buffer, offset, sizeof(type)); \
+		type v = value; \
+		memcpy(buffer->data + offset, &v, sizeof(v)); /* little-endian */ \
+		return self; \
+	}
+
+BUFFER_ACCESSORS(u8, uint8_t)
+BUFFER_ACCESSORS(u16, uint16_t)
+BUFFER_ACCESSORS(u32, uint32_t)
+BUFFER_ACCESSORS(u64, uint64_t)
+BUFFER_ACCESSORS(i8, int8_t)
+BUFFER_ACCESSORS(i16, int16_t)
+BUFFER_ACCESSORS(i32, int32_t)
+BUFFER_ACCESSORS(i64, int64_t)
+
+#define DEFINE_BUFFER_ACCESSORS(name) \
+	mrb_define_method(mrb, class_Buffer, "get_" #name, mrb_trn_buffer_get_##name, MRB_ARGS_ARG(1, 0)); \
+	mrb_define_method(mrb, class_Buffer, "set_" #name, mrb_trn_buffer_set_##name, MRB_ARGS_ARG(2, 0))
+
+void mrb_transistor_buffer_init(mrb_state *mrb) {
+	class_Buffer = mrb_define_class_under(mrb, mod_transistor, "Buffer", mrb->object_class);
+	mrb_define_class_method(mrb, class_Buffer, "new", mrb_trn_buffer_new, MRB_ARGS_ARG(1, 1));
+	mrb_define_class_method(mrb, class_Buffer, "pages", mrb_trn_buffer_pages, MRB_ARGS_ARG(1, 1));
+	mrb_define_class_method(mrb, class_Buffer, "wrap", mrb_trn_buffer_wrap_m, MRB_ARGS_ARG(2, 1));
+	mrb_define_class_method(mrb, class_Buffer, "from", mrb_trn_buffer_from, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_Buffer, "address", mrb_trn_buffer_address, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Buffer, "size", mrb_trn_buffer_size, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Buffer, "slice", mrb_trn_buffer_slice, MRB_ARGS_ARG(1, 1));
+	mrb_define_method(mrb, class_Buffer, "to_s", mrb_trn_buffer_to_s, MRB_ARGS_ARG(0, 2));
+	mrb_define_method(mrb, class_Buffer, "write", mrb_trn_buffer_write, MRB_ARGS_ARG(2, 0));
+	mrb_define_method(mrb, class_Buffer, "fill", mrb_trn_buffer_fill, MRB_ARGS_ARG(0, 1));
+	DEFINE_BUFFER_ACCESSORS(u8);
+	DEFINE_BUFFER_ACCESSORS(u16);
+	DEFINE_BUFFER_ACCESSORS(u32);
+	DEFINE_BUFFER_ACCESSORS(u64);
+	DEFINE_BUFFER_ACCESSORS(i8);
+	DEFINE_BUFFER_ACCESSORS(i16);
+	DEFINE_BUFFER_ACCESSORS(i32);
+	DEFINE_BUFFER_ACCESSORS(i64);
+}
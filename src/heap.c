@@ -0,0 +1,311 @@
+#include<stdint.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/hash.h>
+#include<mruby/value.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+#include "trn_allocf.h"
+
+// mrb_allocf backed by alloc_pages. Small blocks come from 4 KiB pages that
+// each serve a single size class; pages are carved from 64 KiB regions and
+// owned by a per-thread heap. Anything above the largest class gets its own
+// pages. Every allocation's page starts with a header, so free and realloc
+// find their class by masking the pointer.
+//
+// Regions are never returned to the system; empty pages go back to their
+// heap and can be reused for any class.
+
+#define TRN_HEAP_PAGE_SIZE 0x1000
+#define TRN_HEAP_REGION_SIZE 0x10000
+#define TRN_HEAP_HEADER_SIZE 64 // keeps blocks 16-byte aligned
+#define TRN_HEAP_LARGE UINT32_MAX
+
+static const uint32_t trn_heap_class_sizes[] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512,
+	640, 768, 1024,
+};
+
+#define TRN_HEAP_NUM_CLASSES (sizeof(trn_heap_class_sizes) / sizeof(trn_heap_class_sizes[0]))
+#define TRN_HEAP_MAX_SMALL 1024
+
+struct trn_heap;
+
+typedef struct trn_heap_page {
+	uint32_t size_class; // TRN_HEAP_LARGE for large objects
+	size_t capacity; // blocks, or usable bytes for large objects
+	size_t used;
+	struct trn_heap *owner;
+	struct trn_heap_page *prev; // in the owner's partial list for this class
+	struct trn_heap_page *next;
+	void *free_list;
+} trn_heap_page_t;
+
+_Static_assert(sizeof(trn_heap_page_t) <= TRN_HEAP_HEADER_SIZE, "page header too large");
+
+typedef struct trn_heap {
+	bool lock; // only contended by frees from other threads
+	trn_heap_page_t *partial[TRN_HEAP_NUM_CLASSES];
+	trn_heap_page_t *empty; // singly linked through next
+	uint8_t *region; // uncarved remainder of the current region
+	size_t region_left;
+} trn_heap_t;
+
+static __thread trn_heap_t *trn_heap_local;
+
+static struct {
+	uint64_t live_bytes; // class-rounded size of live blocks
+	uint64_t peak_bytes;
+	uint64_t footprint_bytes; // regions and large objects obtained from alloc_pages
+	uint64_t large_bytes;
+	uint64_t allocations;
+} trn_heap_counters;
+
+static void trn_heap_count(int64_t bytes) {
+	uint64_t live = __atomic_add_fetch(&trn_heap_counters.live_bytes, bytes, __ATOMIC_RELAXED);
+	if(bytes > 0) {
+		__atomic_fetch_add(&trn_heap_counters.allocations, 1, __ATOMIC_RELAXED);
+		uint64_t peak = __atomic_load_n(&trn_heap_counters.peak_bytes, __ATOMIC_RELAXED);
+		while(live > peak && !__atomic_compare_exchange_n(&trn_heap_counters.peak_bytes, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		}
+	}
+}
+
+static void trn_heap_lock(trn_heap_t *heap) {
+	while(__atomic_test_and_set(&heap->lock, __ATOMIC_ACQUIRE)) {
+	}
+}
+
+static void trn_heap_unlock(trn_heap_t *heap) {
+	__atomic_clear(&heap->lock, __ATOMIC_RELEASE);
+}
+
+static trn_heap_page_t *trn_heap_page_of(void *p) {
+	return (trn_heap_page_t*) ((uintptr_t) p & ~(uintptr_t) (TRN_HEAP_PAGE_SIZE - 1));
+}
+
+static size_t trn_heap_class_of(size_t size) {
+	if(size <= 128) {
+		return size == 0 ? 0 : (size - 1) / 16;
+	}
+	size_t cls = 8;
+	while(trn_heap_class_sizes[cls] < size) {
+		cls++;
+	}
+	return cls;
+}
+
+static trn_heap_t *trn_heap_get() {
+	if(trn_heap_local == NULL) {
+		size_t actual;
+		trn_heap_t *heap = alloc_pages(sizeof(trn_heap_t), sizeof(trn_heap_t), &actual);
+		if(heap == NULL) {
+			return NULL;
+		}
+		memset(heap, 0, sizeof(*heap));
+		__atomic_fetch_add(&trn_heap_counters.footprint_bytes, actual, __ATOMIC_RELAXED);
+		trn_heap_local = heap;
+	}
+	return trn_heap_local;
+}
+
+static trn_heap_page_t *trn_heap_new_page(trn_heap_t *heap, size_t cls) {
+	trn_heap_page_t *page = heap->empty;
+	if(page) {
+		heap->empty = page->next;
+	} else {
+		if(heap->region_left < TRN_HEAP_PAGE_SIZE) {
+			size_t actual;
+			uint8_t *region = alloc_pages(TRN_HEAP_REGION_SIZE, TRN_HEAP_REGION_SIZE, &actual);
+			if(region == NULL) {
+				return NULL;
+			}
+			__atomic_fetch_add(&trn_heap_counters.footprint_bytes, actual, __ATOMIC_RELAXED);
+			heap->region = region;
+			heap->region_left = actual;
+		}
+		page = (trn_heap_page_t*) heap->region;
+		heap->region+= TRN_HEAP_PAGE_SIZE;
+		heap->region_left-= TRN_HEAP_PAGE_SIZE;
+	}
+
+	size_t block_size = trn_heap_class_sizes[cls];
+	page->size_class = cls;
+	page->capacity = (TRN_HEAP_PAGE_SIZE - TRN_HEAP_HEADER_SIZE) / block_size;
+	page->used = 0;
+	page->owner = heap;
+	page->prev = NULL;
+	page->next = NULL;
+	page->free_list = NULL;
+	uint8_t *blocks = (uint8_t*) page + TRN_HEAP_HEADER_SIZE;
+	for(size_t i = page->capacity; i-- > 0; ) {
+		void **block = (void**) (blocks + i * block_size);
+		*block = page->free_list;
+		page->free_list = block;
+	}
+	return page;
+}
+
+static void trn_heap_link(trn_heap_t *heap, trn_heap_page_t *page) {
+	page->prev = NULL;
+	page->next = heap->partial[page->size_class];
+	if(page->next) {
+		page->next->prev = page;
+	}
+	heap->partial[page->size_class] = page;
+}
+
+static void trn_heap_unlink(trn_heap_t *heap, trn_heap_page_t *page) {
+	if(page->prev) {
+		page->prev->next = page->next;
+	} else {
+		heap->partial[page->size_class] = page->next;
+	}
+	if(page->next) {
+		page->next->prev = page->prev;
+	}
+	page->prev = NULL;
+	page->next = NULL;
+}
+
+static void *trn_heap_alloc_small(size_t size) {
+	trn_heap_t *heap = trn_heap_get();
+	if(heap == NULL) {
+		return NULL;
+	}
+	size_t cls = trn_heap_class_of(size);
+	trn_heap_lock(heap);
+	trn_heap_page_t *page = heap->partial[cls];
+	if(page == NULL) {
+		page = trn_heap_new_page(heap, cls);
+		if(page == NULL) {
+			trn_heap_unlock(heap);
+			return NULL;
+		}
+		trn_heap_link(heap, page);
+	}
+	void **block = page->free_list;
+	page->free_list = *block;
+	if(++page->used == page->capacity) {
+		trn_heap_unlink(heap, page);
+	}
+	trn_heap_unlock(heap);
+	trn_heap_count(trn_heap_class_sizes[cls]);
+	return block;
+}
+
+static void trn_heap_free_small(trn_heap_page_t *page, void *p) {
+	trn_heap_t *heap = page->owner;
+	size_t cls = page->size_class;
+	trn_heap_lock(heap);
+	void **block = p;
+	*block = page->free_list;
+	page->free_list = block;
+	if(page->used-- == page->capacity) {
+		trn_heap_link(heap, page);
+	}
+	// keep one page per class around; the rest can serve other classes
+	if(page->used == 0 && (page->prev || page->next)) {
+		trn_heap_unlink(heap, page);
+		page->next = heap->empty;
+		heap->empty = page;
+	}
+	trn_heap_unlock(heap);
+	trn_heap_count(-(int64_t) trn_heap_class_sizes[cls]);
+}
+
+static void *trn_heap_alloc_large(size_t size) {
+	size_t actual;
+	trn_heap_page_t *page = alloc_pages(size + TRN_HEAP_HEADER_SIZE, size + TRN_HEAP_HEADER_SIZE, &actual);
+	if(page == NULL) {
+		return NULL;
+	}
+	page->size_class = TRN_HEAP_LARGE;
+	page->capacity = actual - TRN_HEAP_HEADER_SIZE;
+	page->owner = NULL;
+	__atomic_fetch_add(&trn_heap_counters.footprint_bytes, actual, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&trn_heap_counters.large_bytes, actual, __ATOMIC_RELAXED);
+	trn_heap_count(page->capacity);
+	return (uint8_t*) page + TRN_HEAP_HEADER_SIZE;
+}
+
+static void trn_heap_free_large(trn_heap_page_t *page) {
+	size_t actual = page->capacity + TRN_HEAP_HEADER_SIZE;
+	trn_heap_count(-(int64_t) page->capacity);
+	__atomic_fetch_sub(&trn_heap_counters.footprint_bytes, actual, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&trn_heap_counters.large_bytes, actual, __ATOMIC_RELAXED);
+	free_pages(page);
+}
+
+static size_t trn_heap_capacity(trn_heap_page_t *page) {
+	if(page->size_class == TRN_HEAP_LARGE) {
+		return page->capacity;
+	}
+	return trn_heap_class_sizes[page->size_class];
+}
+
+static void *trn_heap_alloc(size_t size) {
+	return size > TRN_HEAP_MAX_SMALL ? trn_heap_alloc_large(size) : trn_heap_alloc_small(size);
+}
+
+static void trn_heap_free(void *p) {
+	trn_heap_page_t *page = trn_heap_page_of(p);
+	if(page->size_class == TRN_HEAP_LARGE) {
+		trn_heap_free_large(page);
+	} else {
+		trn_heap_free_small(page, p);
+	}
+}
+
+void *mrb_trn_allocf(mrb_state *mrb, void *p, size_t size, void *ud) {
+	if(size == 0) {
+		if(p) {
+			trn_heap_free(p);
+		}
+		return NULL;
+	}
+	if(p == NULL) {
+		return trn_heap_alloc(size);
+	}
+
+	// stay put if the block still fits and isn't mostly wasted
+	trn_heap_page_t *page = trn_heap_page_of(p);
+	size_t capacity = trn_heap_capacity(page);
+	if(size <= capacity) {
+		if(page->size_class == TRN_HEAP_LARGE ? size > capacity / 2 : trn_heap_class_of(size) == page->size_class) {
+			return p;
+		}
+	}
+	void *n = trn_heap_alloc(size);
+	if(n == NULL) {
+		return NULL; // mruby keeps p
+	}
+	memcpy(n, p, size < capacity ? size : capacity);
+	trn_heap_free(p);
+	return n;
+}
+
+static mrb_value mrb_trn_heap_stats(mrb_state *mrb, mrb_value self) {
+	uint64_t live = __atomic_load_n(&trn_heap_counters.live_bytes, __ATOMIC_RELAXED);
+	uint64_t footprint = __atomic_load_n(&trn_heap_counters.footprint_bytes, __ATOMIC_RELAXED);
+
+	mrb_value stats = mrb_hash_new_capa(mrb, 7);
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "active")), mrb_bool_value(mrb->allocf == mrb_trn_allocf));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "live_bytes")), mrb_fixnum_value(live));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "peak_bytes")), mrb_fixnum_value(__atomic_load_n(&trn_heap_counters.peak_bytes, __ATOMIC_RELAXED)));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "footprint_bytes")), mrb_fixnum_value(footprint));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "large_bytes")), mrb_fixnum_value(__atomic_load_n(&trn_heap_counters.large_bytes, __ATOMIC_RELAXED)));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "allocations")), mrb_fixnum_value(__atomic_load_n(&trn_heap_counters.allocations, __ATOMIC_RELAXED)));
+	// share of the footprint not holding live blocks
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "fragmentation")),
+	             mrb_float_value(mrb, footprint ? 1.0 - (double) live / footprint : 0.0));
+	return stats;
+}
+
+void mrb_transistor_heap_init(mrb_state *mrb) {
+	mrb_define_class_method(mrb, mod_transistor_ll, "heap_stats", mrb_trn_heap_stats, MRB_ARGS_ARG(0, 0));
+}
@@ -5,6 +5,8 @@
 #include<mruby.h>
 #include<mruby/array.h>
 #include<mruby/data.h>
+#include<mruby/error.h>
+#include<mruby/hash.h>
 #include<mruby/string.h>
 #include<mruby/value.h>
 #include<mruby/variable.h>
@@ -13,91 +15,388 @@
 
 #include "trn.h"
 
-static struct RClass *mod_transistor_ipc;
-static struct RClass *class_ipc_Object;
-static struct RClass *class_ipc_Message;
+__thread struct RClass *mod_transistor_ipc;
+__thread struct RClass *class_ipc_Object;
+__thread struct RClass *class_ipc_Message;
+
+static void mrb_trn_ipc_object_release(mrb_state *mrb, trn_ipc_object_t *obj) {
+	if(obj->pool) {
+		mrb_trn_session_pool_release(obj->pool); // owns the session
+	} else if(obj->domain) {
+		// closes the object id; the session goes with the last object on the domain
+		ipc_close(obj->object);
+		if(--obj->domain->refs == 0) {
+			svcCloseHandle(obj->domain->session);
+			mrb_free(mrb, obj->domain);
+		}
+	} else {
+		ipc_close(obj->object);
+	}
+	if(obj->service) {
+		mrb_trn_service_release(mrb, obj->service);
+	}
+	mrb_free(mrb, obj);
+}
 
 static void mrb_trn_ipc_object_dfree(mrb_state *mrb, void *data) {
 	if(data) {
-		ipc_close(*((ipc_object_t*) data));
-		mrb_free(mrb, data);
+		mrb_trn_ipc_object_release(mrb, data);
 	}
 }
 
-static const mrb_data_type dt_ipc_Object = {"Object", mrb_trn_ipc_object_dfree};
+const mrb_data_type dt_ipc_Object = {"Object", mrb_trn_ipc_object_dfree};
 
-static mrb_value mrb_trn_get_service(mrb_state *mrb, mrb_value self) {
-	char *str;
-	mrb_int size;
-	mrb_int num_args = mrb_get_args(mrb, "s", &str, &size);
+mrb_value mrb_trn_ipc_object_wrap(mrb_state *mrb, ipc_object_t object) {
+	trn_ipc_object_t *storage = mrb_calloc(mrb, sizeof(*storage), 1);
+	storage->object = object;
+	return mrb_obj_value(Data_Wrap_Struct(mrb, class_ipc_Object, &dt_ipc_Object, storage));
+}
+
+mrb_value mrb_trn_ipc_object_wrap_child(mrb_state *mrb, trn_domain_t *domain, uint64_t service_label, ipc_object_t object) {
+	mrb_value value = mrb_trn_ipc_object_wrap(mrb, object);
+	((trn_ipc_object_t*) DATA_PTR(value))->service_label = service_label;
+	if(domain && object.object_id >= 0) {
+		((trn_ipc_object_t*) DATA_PTR(value))->domain = domain;
+		domain->refs++;
+	}
+	return value;
+}
+
+trn_ipc_object_t *mrb_trn_ipc_object_get(mrb_state *mrb, mrb_value value) {
+	trn_ipc_object_t *obj = mrb_data_get_ptr(mrb, value, &dt_ipc_Object);
+	if(!obj) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "ipc object is closed");
+	}
+	return obj;
+}
+
+result_t mrb_trn_ipc_clone(ipc_object_t object, ipc_object_t *out) {
+	handle_t handle;
+	ipc_request_t rq = ipc_default_request;
+	rq.type = 5; // control
+	rq.request_id = 2; // CloneCurrentObject
 
-	mrb_trn_assert_ok(mrb, sm_init());
+	ipc_response_fmt_t rs = ipc_default_response_fmt;
+	rs.num_move_handles = 1;
+	rs.move_handles = &handle;
 
-	ipc_object_t *session = mrb_malloc(mrb, sizeof(*session)); // potentital to lose sm reference here but idrc
-	result_t r = sm_get_service(session, str);
-	sm_finalize();
+	result_t r = ipc_send(object, &rq, &rs);
 	if(r != RESULT_OK) {
-		free(session);
+		return r;
 	}
-	mrb_trn_assert_ok(mrb, r);
+	*out = ipc_null_object;
+	out->session = handle;
+	return RESULT_OK;
+}
 
-	return mrb_obj_value(Data_Wrap_Struct(mrb, class_ipc_Object, &dt_ipc_Object, session));
+result_t mrb_trn_ipc_send(trn_ipc_object_t *obj, ipc_request_t *rq, ipc_response_fmt_t *rs) {
+	bool recording = __atomic_load_n(&trn_ipc_recording, __ATOMIC_RELAXED);
+	uint64_t start = recording ? svcGetSystemTick() : 0;
+	result_t r;
+	if(obj->pool) {
+		r = mrb_trn_session_pool_send(obj->pool, rq, rs);
+	} else {
+		r = ipc_send(obj->object, rq, rs);
+	}
+	if(recording) {
+		mrb_trn_ipc_recorder_record(obj, rq, rs, r, start, svcGetSystemTick());
+	}
+	return r;
 }
 
-typedef struct {
-	ipc_request_t rq;
-	ipc_response_fmt_t rs;
-	uint64_t pid_storage;
-} message_format_t;
+// auto buffers larger than this always go through mapped descriptors
+static size_t mrb_trn_ipc_auto_buffer_threshold = 0x800;
+
+// size of the server's pointer buffer receive area, queried once per session
+static uint16_t mrb_trn_ipc_pointer_buffer_size(trn_ipc_object_t *obj) {
+	bool *has_size = obj->domain ? &obj->domain->has_pointer_buffer_size : &obj->has_pointer_buffer_size;
+	uint16_t *size = obj->domain ? &obj->domain->pointer_buffer_size : &obj->pointer_buffer_size;
+	if(!*has_size) {
+		// control requests address the session itself, never a domain object
+		ipc_object_t session = ipc_null_object;
+		session.session = obj->object.session;
+
+		uint32_t response = 0;
+		ipc_request_t rq = ipc_default_request;
+		rq.type = 5; // control
+		rq.request_id = 3; // QueryPointerBufferSize
+		ipc_response_fmt_t rs = ipc_default_response_fmt;
+		rs.raw_data_size = sizeof(response);
+		rs.raw_data = (void*) &response;
+		// servers that can't answer get mapped transfers only
+		result_t r = obj->pool ? mrb_trn_session_pool_send(obj->pool, &rq, &rs) : ipc_send(session, &rq, &rs);
+		*size = r == RESULT_OK ? (uint16_t) response : 0;
+		*has_size = true;
+	}
+	return *size;
+}
+
+void mrb_trn_ipc_place_auto_buffer(trn_ipc_object_t *obj, uint32_t type, ipc_buffer_t *mapped, ipc_buffer_t *pointer, void *data, size_t size) {
+	mapped->type = (type & 3) | 0x4;
+	pointer->type = (type & 3) | 0x8;
+	bool is_inline = size <= mrb_trn_ipc_auto_buffer_threshold && size <= mrb_trn_ipc_pointer_buffer_size(obj);
+	ipc_buffer_t *used = is_inline ? pointer : mapped;
+	ipc_buffer_t *unused = is_inline ? mapped : pointer;
+	used->addr = data;
+	used->size = size;
+	unused->addr = NULL;
+	unused->size = 0;
+}
+
+void mrb_trn_ipc_message_resolve_buffers(trn_ipc_object_t *obj, message_format_t *fmt) {
+	for(size_t i = 0; i < fmt->num_declared_buffers; i++) {
+		if(!(fmt->buffer_types[i] & TRN_IPC_BUFFER_AUTO)) {
+			continue;
+		}
+		ipc_buffer_t *mapped = fmt->rq.buffers[fmt->buffer_slots[i]];
+		ipc_buffer_t *pointer = fmt->rq.buffers[fmt->buffer_slots[i] + 1];
+		// the payload sits in whichever descriptor the last send picked
+		ipc_buffer_t *current = mapped->addr ? mapped : pointer;
+		mrb_trn_ipc_place_auto_buffer(obj, fmt->buffer_types[i], mapped, pointer, current->addr, current->size);
+	}
+}
+
+static void mrb_trn_ipc_message_set_buffer_data(mrb_state *mrb, message_format_t *fmt, mrb_int index, mrb_value value) {
+	if(index < 0 || (size_t) index >= fmt->num_declared_buffers) {
+		mrb_raise(mrb, E_INDEX_ERROR, "buffer index out of range");
+	}
+	ipc_buffer_t *mapped = fmt->rq.buffers[fmt->buffer_slots[index]];
+	mrb_trn_buffer_region(mrb, value, &mapped->addr, &mapped->size);
+	if(fmt->buffer_types[index] & TRN_IPC_BUFFER_AUTO) {
+		ipc_buffer_t *pointer = fmt->rq.buffers[fmt->buffer_slots[index] + 1];
+		pointer->addr = NULL;
+		pointer->size = 0;
+	}
+}
+
+// Message arenas. Every array a message hands to ipc_send lives in one block
+// laid out by _invalidate. Blocks up to TRN_IPC_ARENA_MAX_POOLED bytes are
+// rounded up to a power of two and recycled through a per-size free list.
+
+#define TRN_IPC_ARENA_MIN_SHIFT 6 // 64 bytes
+#define TRN_IPC_ARENA_CLASSES 7 // up to 4 KiB
+#define TRN_IPC_ARENA_MAX_POOLED (1 << (TRN_IPC_ARENA_MIN_SHIFT + TRN_IPC_ARENA_CLASSES - 1))
+#define TRN_IPC_ARENA_POOL_DEPTH 8
+#define TRN_IPC_ARENA_ALIGN 16
+
+typedef struct trn_ipc_arena_free {
+	struct trn_ipc_arena_free *next;
+} trn_ipc_arena_free_t;
+
+static struct {
+	trn_ipc_arena_free_t *head;
+	size_t count;
+} trn_ipc_arena_pool[TRN_IPC_ARENA_CLASSES];
+static bool trn_ipc_arena_pool_lock;
+
+static void trn_ipc_arena_pool_acquire_lock() {
+	while(__atomic_test_and_set(&trn_ipc_arena_pool_lock, __ATOMIC_ACQUIRE)) {
+	}
+}
+
+static void trn_ipc_arena_pool_release_lock() {
+	__atomic_clear(&trn_ipc_arena_pool_lock, __ATOMIC_RELEASE);
+}
+
+static int trn_ipc_arena_class(size_t capacity) {
+	if(capacity > TRN_IPC_ARENA_MAX_POOLED) {
+		return -1;
+	}
+	int shift = TRN_IPC_ARENA_MIN_SHIFT;
+	while(((size_t) 1 << shift) < capacity) {
+		shift++;
+	}
+	return shift - TRN_IPC_ARENA_MIN_SHIFT;
+}
+
+// returns a zeroed arena of at least size bytes; its real size goes in *capacity
+static void *trn_ipc_arena_alloc(mrb_state *mrb, size_t size, size_t *capacity) {
+	int cls = trn_ipc_arena_class(size);
+	void *arena = NULL;
+	if(cls >= 0) {
+		*capacity = (size_t) 1 << (cls + TRN_IPC_ARENA_MIN_SHIFT);
+		trn_ipc_arena_pool_acquire_lock();
+		trn_ipc_arena_free_t *head = trn_ipc_arena_pool[cls].head;
+		if(head) {
+			trn_ipc_arena_pool[cls].head = head->next;
+			trn_ipc_arena_pool[cls].count--;
+		}
+		trn_ipc_arena_pool_release_lock();
+		arena = head;
+	} else {
+		*capacity = size;
+	}
+	if(arena == NULL) {
+		arena = memalign(TRN_IPC_ARENA_ALIGN, *capacity);
+		if(arena == NULL) {
+			mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+		}
+	}
+	memset(arena, 0, *capacity);
+	return arena;
+}
+
+static void trn_ipc_arena_release(void *arena, size_t capacity) {
+	if(arena == NULL) {
+		return;
+	}
+	int cls = trn_ipc_arena_class(capacity);
+	if(cls >= 0 && ((size_t) 1 << (cls + TRN_IPC_ARENA_MIN_SHIFT)) == capacity) {
+		trn_ipc_arena_pool_acquire_lock();
+		if(trn_ipc_arena_pool[cls].count < TRN_IPC_ARENA_POOL_DEPTH) {
+			trn_ipc_arena_free_t *entry = arena;
+			entry->next = trn_ipc_arena_pool[cls].head;
+			trn_ipc_arena_pool[cls].head = entry;
+			trn_ipc_arena_pool[cls].count++;
+			arena = NULL;
+		}
+		trn_ipc_arena_pool_release_lock();
+	}
+	free(arena);
+}
+
+// reserves an aligned section and returns its offset into the arena
+static size_t trn_ipc_arena_reserve(size_t *cursor, size_t size, size_t alignment) {
+	size_t offset = (*cursor + alignment - 1) & ~(alignment - 1);
+	*cursor = offset + size;
+	return offset;
+}
 
 static void mrb_trn_ipc_message_dfree(mrb_state *mrb, void *data) {
 	message_format_t *fmt = data;
-	for(int i = 0; i < fmt->rq.num_buffers; i++) {
-		mrb_free(mrb, fmt->rq.buffers[i]);
-	}
-	mrb_free(mrb, fmt->rq.buffers);
-	mrb_free(mrb, fmt->rq.raw_data);
-	mrb_free(mrb, fmt->rq.copy_handles);
-	mrb_free(mrb, fmt->rq.move_handles);
-	mrb_free(mrb, fmt->rq.objects);
-	mrb_free(mrb, fmt->rs.copy_handles);
-	mrb_free(mrb, fmt->rs.move_handles);
-	mrb_free(mrb, fmt->rs.objects);
-	mrb_free(mrb, fmt->rs.raw_data);
-	mrb_free(mrb, fmt->rs.pid);
+	trn_ipc_arena_release(fmt->arena, fmt->arena_size);
 	mrb_free(mrb, fmt);
 }
 
 static mrb_value mrb_trn_ipc_object_close(mrb_state *mrb, mrb_value self) {
-	ipc_object_t *obj = mrb_data_get_ptr(mrb, self, &dt_ipc_Object);
+	trn_ipc_object_t *obj = mrb_data_get_ptr(mrb, self, &dt_ipc_Object);
 	if(obj) {
-		ipc_close(*obj);
-		mrb_free(mrb, obj);
 		DATA_PTR(self) = NULL;
+		mrb_trn_ipc_object_release(mrb, obj);
 	}
 	return mrb_nil_value();
 }
 
-static const mrb_data_type dt_ipc_Message = {"Message", mrb_trn_ipc_message_dfree};
+const mrb_data_type dt_ipc_Message = {"Message", mrb_trn_ipc_message_dfree};
 
-static mrb_value mrb_trn_ipc_object_send(mrb_state *mrb, mrb_value self) {
-	ipc_object_t *obj = mrb_data_get_ptr(mrb, self, &dt_ipc_Object);
-	if(!obj) {
-		mrb_raise(mrb, E_RUNTIME_ERROR, "ipc object is closed");
+static mrb_value mrb_trn_ipc_object_convert_to_domain(mrb_state *mrb, mrb_value self) {
+	trn_ipc_object_t *obj = mrb_trn_ipc_object_get(mrb, self);
+	if(obj->domain) {
+		return self;
+	}
+	if(obj->pool) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "can't convert a pooled object to a domain");
 	}
+	mrb_trn_assert_ok(mrb, ipc_convert_to_domain(&obj->object));
+	obj->domain = mrb_calloc(mrb, sizeof(*obj->domain), 1);
+	obj->domain->session = obj->object.session;
+	obj->domain->refs = 1;
+	// same session, so a size already queried still holds
+	obj->domain->has_pointer_buffer_size = obj->has_pointer_buffer_size;
+	obj->domain->pointer_buffer_size = obj->pointer_buffer_size;
+	return self;
+}
+
+static mrb_value mrb_trn_ipc_object_is_domain(mrb_state *mrb, mrb_value self) {
+	trn_ipc_object_t *obj = mrb_trn_ipc_object_get(mrb, self);
+	return mrb_bool_value(obj->domain != NULL);
+}
+
+static mrb_value mrb_trn_ipc_message_compile(mrb_state *mrb, mrb_value self);
+
+// packs, sends and unpacks entirely in C; messages still being built in Ruby
+// are compiled first
+static mrb_value mrb_trn_ipc_transact(mrb_state *mrb, trn_ipc_object_t *obj, mrb_value message_value, mrb_value input_hash_value) {
+	message_format_t *fmt = mrb_data_get_ptr(mrb, message_value, &dt_ipc_Message);
+	if(!fmt->is_compiled || mrb_test(mrb_iv_get(mrb, message_value, mrb_intern_lit(mrb, "@dirty")))) {
+		mrb_trn_ipc_message_compile(mrb, message_value);
+	}
+	if(!mrb_hash_p(input_hash_value)) {
+		mrb_raise(mrb, E_TYPE_ERROR, "expected a Hash of parameters");
+	}
+	TRN_IPC_STATS_TICK(start);
+	mrb_trn_ipc_message_pack(mrb, fmt, input_hash_value);
+	fmt->domain = obj->domain;
+	fmt->service_label = obj->service_label;
+	mrb_trn_ipc_message_resolve_buffers(obj, fmt);
+	TRN_IPC_STATS_TICK(packed);
+	result_t r = mrb_trn_ipc_send(obj, &fmt->rq, &fmt->rs);
+	TRN_IPC_STATS_TICK(sent);
+	if(r != RESULT_OK) {
+		TRN_IPC_STATS_RECORD(obj->service_label, fmt->rq.request_id, start, packed, sent, sent, r);
+		mrb_trn_assert_ok(mrb, r);
+	}
+	mrb_value response = mrb_trn_ipc_message_unpack(mrb, fmt);
+	TRN_IPC_STATS_RECORD(obj->service_label, fmt->rq.request_id, start, packed, sent, svcGetSystemTick(), r);
+	return response;
+}
+
+static mrb_value mrb_trn_ipc_object_send(mrb_state *mrb, mrb_value self) {
+	trn_ipc_object_t *obj = mrb_trn_ipc_object_get(mrb, self);
 	mrb_value message_value;
 	mrb_value input_hash_value;
 	
 	mrb_int num_args = mrb_get_args(mrb, "oH!", &message_value, &input_hash_value);
-	mrb_funcall(mrb, message_value, "_pack", 1, input_hash_value); // pack
+	return mrb_trn_ipc_transact(mrb, obj, message_value, input_hash_value);
+}
+
+static mrb_value mrb_trn_ipc_object_invoke(mrb_state *mrb, mrb_value self) {
+	trn_ipc_object_t *obj = mrb_trn_ipc_object_get(mrb, self);
+	mrb_value message_value;
+	mrb_value input_hash_value;
+
+	mrb_int num_args = mrb_get_args(mrb, "oH", &message_value, &input_hash_value);
 	message_format_t *fmt = mrb_data_get_ptr(mrb, message_value, &dt_ipc_Message);
-	result_t r = ipc_send(*obj, &fmt->rq, &fmt->rs);
-	mrb_trn_assert_ok(mrb, r);
-	return mrb_funcall(mrb, message_value, "_unpack", 0);
+	if(!fmt->is_compiled) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "message layout is not compiled");
+	}
+	return mrb_trn_ipc_transact(mrb, obj, message_value, input_hash_value);
+}
+
+typedef struct {
+	mrb_value object;
+	mrb_value message; // Message, or a method name for a stub call
+	mrb_value params; // Hash, or the stub call's argument Array
+} trn_ipc_batch_entry_t;
+
+static mrb_value mrb_trn_ipc_batch_issue(mrb_state *mrb, mrb_value data) {
+	trn_ipc_batch_entry_t *entry = mrb_cptr(data);
+	if(mrb_symbol_p(entry->message)) {
+		// stubs marshal natively; this only skips the interpreter
+		return mrb_funcall_argv(mrb, entry->object, mrb_symbol(entry->message), RARRAY_LEN(entry->params), RARRAY_PTR(entry->params));
+	}
+	return mrb_trn_ipc_transact(mrb, mrb_trn_ipc_object_get(mrb, entry->object), entry->message, entry->params);
+}
+
+// _submit(requests, abort_on_error) with requests flattened into
+// [object, message, params, ...]; see TRN::IPC.batch
+static mrb_value mrb_trn_ipc_submit(mrb_state *mrb, mrb_value self) {
+	mrb_value requests;
+	mrb_bool abort_on_error = false;
+	mrb_int num_args = mrb_get_args(mrb, "A|b", &requests, &abort_on_error);
+
+	mrb_int count = RARRAY_LEN(requests) / 3;
+	mrb_value results = mrb_ary_new_capa(mrb, count);
+	int ai = mrb_gc_arena_save(mrb);
+	for(mrb_int i = 0; i < count; i++) {
+		trn_ipc_batch_entry_t entry = {
+			mrb_ary_ref(mrb, requests, i * 3),
+			mrb_ary_ref(mrb, requests, i * 3 + 1),
+			mrb_ary_ref(mrb, requests, i * 3 + 2),
+		};
+		mrb_bool failed = false;
+		mrb_value result = mrb_protect(mrb, mrb_trn_ipc_batch_issue, mrb_cptr_value(mrb, &entry), &failed);
+		if(failed && abort_on_error) {
+			mrb_exc_raise(mrb, result);
+		}
+		mrb_ary_push(mrb, results, result);
+		mrb_gc_arena_restore(mrb, ai);
+	}
+	return results;
 }
 
 static mrb_value mrb_trn_ipc_message_new(mrb_state *mrb, mrb_value self) {
-	message_format_t *fmt = mrb_malloc(mrb, sizeof(*fmt));
+	message_format_t *fmt = mrb_calloc(mrb, sizeof(*fmt), 1);
 	fmt->rq = ipc_default_request;
 	fmt->rs = ipc_default_response_fmt;
 	
@@ -116,74 +415,273 @@ static mrb_value mrb_trn_ipc_message_invalidate(mrb_state *mrb, mrb_value self)
 	// request id
 	fmt->rq.request_id = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@command_id")));
 
-	// buffers
+	// layout
 	mrb_value buffers = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@buffers"));
-	// in case we're shrinking
-	for(mrb_int i = RARRAY_LEN(buffers); i < fmt->rq.num_buffers; i++) {
-		mrb_free(mrb, fmt->rq.buffers[i]);
-	}
-	fmt->rq.buffers = mrb_realloc(
-		mrb, fmt->rq.buffers, RARRAY_LEN(buffers) * sizeof(ipc_buffer_t*));
-	// in case we grew
-	for(mrb_int i = fmt->rq.num_buffers; i < RARRAY_LEN(buffers); i++) {
-		fmt->rq.buffers[i] = mrb_calloc(mrb, sizeof(ipc_buffer_t), 1);
-	}
-	fmt->rq.num_buffers = RARRAY_LEN(buffers);
-	// adjust buffer types
-	for(int i = 0; i < fmt->rq.num_buffers; i++) {
-		ipc_buffer_t *ipc_buffer = fmt->rq.buffers[i];
+	mrb_value in_params = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_params"));
+	mrb_value out_params = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_params"));
+	size_t num_declared_buffers = RARRAY_LEN(buffers);
+	// auto buffers take a mapped and a pointer descriptor
+	uint32_t num_slots = 0;
+	for(size_t i = 0; i < num_declared_buffers; i++) {
 		mrb_value buffer = mrb_ary_entry(buffers, i);
-		ipc_buffer->type = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@type")));
+		uint32_t type = mrb_fixnum(mrb_iv_get(mrb, buffer, mrb_intern_lit(mrb, "@type")));
+		num_slots+= (type & TRN_IPC_BUFFER_AUTO) ? 2 : 1;
 	}
-	
+	size_t rq_raw_data_size = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_raw_size")));
+	size_t rs_raw_data_size = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_raw_size")));
+	uint32_t rq_num_objects = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_object_count")));
+	uint32_t rs_num_objects = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_object_count")));
+	uint32_t rq_num_copy_handles = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_copy_handle_count")));
+	uint32_t rs_num_copy_handles = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_copy_handle_count")));
+	uint32_t rq_num_move_handles = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_move_handle_count")));
+	uint32_t rs_num_move_handles = mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_move_handle_count")));
+
+	// sections in the order ipc_send walks them
+	size_t cursor = 0;
+	size_t rq_raw_data_offset = trn_ipc_arena_reserve(&cursor, rq_raw_data_size, TRN_IPC_ARENA_ALIGN);
+	size_t buffer_ptrs_offset = trn_ipc_arena_reserve(&cursor, num_slots * sizeof(ipc_buffer_t*), _Alignof(ipc_buffer_t*));
+	size_t ipc_buffers_offset = trn_ipc_arena_reserve(&cursor, num_slots * sizeof(ipc_buffer_t), _Alignof(ipc_buffer_t));
+	size_t rq_objects_offset = trn_ipc_arena_reserve(&cursor, rq_num_objects * sizeof(ipc_object_t), _Alignof(ipc_object_t));
+	size_t rq_copy_handles_offset = trn_ipc_arena_reserve(&cursor, rq_num_copy_handles * sizeof(handle_t), _Alignof(handle_t));
+	size_t rq_move_handles_offset = trn_ipc_arena_reserve(&cursor, rq_num_move_handles * sizeof(handle_t), _Alignof(handle_t));
+	size_t rs_raw_data_offset = trn_ipc_arena_reserve(&cursor, rs_raw_data_size, TRN_IPC_ARENA_ALIGN);
+	size_t rs_objects_offset = trn_ipc_arena_reserve(&cursor, rs_num_objects * sizeof(ipc_object_t), _Alignof(ipc_object_t));
+	size_t rs_copy_handles_offset = trn_ipc_arena_reserve(&cursor, rs_num_copy_handles * sizeof(handle_t), _Alignof(handle_t));
+	size_t rs_move_handles_offset = trn_ipc_arena_reserve(&cursor, rs_num_move_handles * sizeof(handle_t), _Alignof(handle_t));
+	size_t buffer_types_offset = trn_ipc_arena_reserve(&cursor, num_declared_buffers * sizeof(uint32_t), _Alignof(uint32_t));
+	size_t buffer_slots_offset = trn_ipc_arena_reserve(&cursor, num_declared_buffers * sizeof(uint32_t), _Alignof(uint32_t));
+	size_t in_fields_offset = trn_ipc_arena_reserve(&cursor, RARRAY_LEN(in_params) * sizeof(trn_field_t), _Alignof(trn_field_t));
+	size_t out_fields_offset = trn_ipc_arena_reserve(&cursor, RARRAY_LEN(out_params) * sizeof(trn_field_t), _Alignof(trn_field_t));
+
+	// relayouts that still fit keep their block
+	if(fmt->arena == NULL || cursor > fmt->arena_size) {
+		size_t capacity;
+		uint8_t *arena = trn_ipc_arena_alloc(mrb, cursor, &capacity);
+		trn_ipc_arena_release(fmt->arena, fmt->arena_size);
+		fmt->arena = arena;
+		fmt->arena_size = capacity;
+	} else {
+		memset(fmt->arena, 0, fmt->arena_size);
+	}
+	uint8_t *arena = fmt->arena;
+
+	// buffers
+	fmt->num_declared_buffers = num_declared_buffers;
+	fmt->buffer_types = (uint32_t*) (arena + buffer_types_offset);
+	fmt->buffer_slots = (uint32_t*) (arena + buffer_slots_offset);
+	fmt->rq.num_buffers = num_slots;
+	fmt->rq.buffers = (ipc_buffer_t**) (arena + buffer_ptrs_offset);
+	for(uint32_t i = 0; i < num_slots; i++) {
+		fmt->rq.buffers[i] = (ipc_buffer_t*) (arena + ipc_buffers_offset) + i;
+	}
+	num_slots = 0;
+	for(size_t i = 0; i < num_declared_buffers; i++) {
+		mrb_value buffer = mrb_ary_entry(buffers, i);
+		uint32_t type = mrb_fixnum(mrb_iv_get(mrb, buffer, mrb_intern_lit(mrb, "@type")));
+		fmt->buffer_types[i] = type;
+		fmt->buffer_slots[i] = num_slots;
+		if(type & TRN_IPC_BUFFER_AUTO) {
+			fmt->rq.buffers[num_slots]->type = (type & 3) | 0x4;
+			fmt->rq.buffers[num_slots + 1]->type = (type & 3) | 0x8;
+			num_slots+= 2;
+		} else {
+			fmt->rq.buffers[num_slots]->type = type;
+			num_slots+= 1;
+		}
+	}
+
 	// raw data
-	fmt->rq.raw_data_size =
-		mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_raw_size")));
-	fmt->rs.raw_data_size =
-		mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_raw_size")));
-	fmt->rq.raw_data = mrb_realloc(
-		mrb, fmt->rq.raw_data, fmt->rq.raw_data_size);
-	fmt->rs.raw_data = mrb_realloc(
-		mrb, fmt->rs.raw_data, fmt->rs.raw_data_size);
+	fmt->rq.raw_data_size = rq_raw_data_size;
+	fmt->rs.raw_data_size = rs_raw_data_size;
+	fmt->rq.raw_data = arena + rq_raw_data_offset;
+	fmt->rs.raw_data = arena + rs_raw_data_offset;
 
 	// objects
-	fmt->rq.num_objects =
-		mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_object_count")));
-	fmt->rs.num_objects =
-		mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_object_count")));
-	fmt->rq.objects = mrb_realloc(
-		mrb, fmt->rq.objects, fmt->rq.num_objects * sizeof(ipc_object_t));
-	fmt->rs.objects = mrb_realloc(
-		mrb, fmt->rs.objects, fmt->rs.num_objects * sizeof(ipc_object_t));
-
-	// copy handles
-	fmt->rq.num_copy_handles =
-		mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_copy_handle_count")));
-	fmt->rs.num_copy_handles =
-		mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_copy_handle_count")));
-	fmt->rq.copy_handles = mrb_realloc(
-		mrb, fmt->rq.copy_handles, fmt->rq.num_copy_handles * sizeof(handle_t));
-	fmt->rs.copy_handles = mrb_realloc(
-		mrb, fmt->rs.copy_handles, fmt->rs.num_copy_handles * sizeof(handle_t));
+	fmt->rq.num_objects = rq_num_objects;
+	fmt->rs.num_objects = rs_num_objects;
+	fmt->rq.objects = (ipc_object_t*) (arena + rq_objects_offset);
+	fmt->rs.objects = (ipc_object_t*) (arena + rs_objects_offset);
 
 	// copy handles
-	fmt->rq.num_move_handles =
-		mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_move_handle_count")));
-	fmt->rs.num_move_handles =
-		mrb_fixnum(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_move_handle_count")));
-	fmt->rq.move_handles = mrb_realloc(
-		mrb, fmt->rq.move_handles, fmt->rq.num_move_handles * sizeof(handle_t));
-	fmt->rs.move_handles = mrb_realloc(
-		mrb, fmt->rs.move_handles, fmt->rs.num_move_handles * sizeof(handle_t));
+	fmt->rq.num_copy_handles = rq_num_copy_handles;
+	fmt->rs.num_copy_handles = rs_num_copy_handles;
+	fmt->rq.copy_handles = (handle_t*) (arena + rq_copy_handles_offset);
+	fmt->rs.copy_handles = (handle_t*) (arena + rs_copy_handles_offset);
+
+	// move handles
+	fmt->rq.num_move_handles = rq_num_move_handles;
+	fmt->rs.num_move_handles = rs_num_move_handles;
+	fmt->rq.move_handles = (handle_t*) (arena + rq_move_handles_offset);
+	fmt->rs.move_handles = (handle_t*) (arena + rs_move_handles_offset);
+
+	// filled in by _compile
+	fmt->num_in_fields = 0;
+	fmt->num_out_fields = 0;
+	fmt->in_fields = (trn_field_t*) (arena + in_fields_offset);
+	fmt->out_fields = (trn_field_t*) (arena + out_fields_offset);
 
 	// pid
 	fmt->rq.send_pid = mrb_bool(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@send_pid")));
 	fmt->rs.has_pid  = mrb_bool(mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@recv_pid")));
 	fmt->rs.pid = &fmt->pid_storage;
+
+	fmt->is_compiled = false;
 	
 	return mrb_nil_value();
 }
 
+static void mrb_trn_ipc_message_compile_fields(mrb_state *mrb, mrb_value params, trn_field_t *fields, size_t *count) {
+	struct RClass *class_RawData = mrb_class_get_under(mrb, class_ipc_Message, "RawData");
+	struct RClass *class_OutPid = mrb_class_get_under(mrb, class_ipc_Message, "OutPid");
+	struct RClass *class_TransferObject = mrb_class_get_under(mrb, class_ipc_Message, "TransferObject");
+	struct RClass *class_TransferCopyHandle = mrb_class_get_under(mrb, class_ipc_Message, "TransferCopyHandle");
+	struct RClass *class_TransferMoveHandle = mrb_class_get_under(mrb, class_ipc_Message, "TransferMoveHandle");
+	struct RClass *class_Buffer = mrb_class_get_under(mrb, class_ipc_Message, "Buffer");
+
+	size_t num_params = RARRAY_LEN(params);
+	for(size_t i = 0; i < num_params; i++) {
+		mrb_value param = mrb_ary_entry(params, i);
+		struct RClass *klass = mrb_obj_class(mrb, param);
+		trn_field_t *field = &fields[i];
+		field->key = mrb_iv_get(mrb, param, mrb_intern_lit(mrb, "@key"));
+		if(klass == class_RawData) {
+			field->kind = TRN_FIELD_RAW;
+			field->offset = mrb_fixnum(mrb_iv_get(mrb, param, mrb_intern_lit(mrb, "@pos")));
+			field->size = mrb_fixnum(mrb_iv_get(mrb, param, mrb_intern_lit(mrb, "@size")));
+			field->is_numeric = mrb_test(mrb_iv_get(mrb, param, mrb_intern_lit(mrb, "@is_numeric")));
+			if(field->is_numeric && field->size > sizeof(uint64_t)) {
+				field->is_numeric = false;
+			}
+		} else if(klass == class_OutPid) {
+			field->kind = TRN_FIELD_PID;
+		} else {
+			if(klass == class_TransferObject) {
+				field->kind = TRN_FIELD_OBJECT;
+			} else if(klass == class_TransferCopyHandle) {
+				field->kind = TRN_FIELD_COPY_HANDLE;
+			} else if(klass == class_TransferMoveHandle) {
+				field->kind = TRN_FIELD_MOVE_HANDLE;
+			} else if(klass == class_Buffer) {
+				field->kind = TRN_FIELD_BUFFER;
+			} else {
+				mrb_raisef(mrb, E_TYPE_ERROR, "can't compile parameter %S", param);
+			}
+			field->offset = mrb_fixnum(mrb_iv_get(mrb, param, mrb_intern_lit(mrb, "@index")));
+		}
+	}
+	*count = num_params;
+}
+
+static mrb_value mrb_trn_ipc_message_compile(mrb_state *mrb, mrb_value self) {
+	mrb_trn_ipc_message_invalidate(mrb, self);
+	message_format_t *fmt = mrb_data_get_ptr(mrb, self, &dt_ipc_Message);
+
+	// _invalidate sized the field arrays from the same params
+	mrb_trn_ipc_message_compile_fields(
+		mrb, mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@in_params")), fmt->in_fields, &fmt->num_in_fields);
+	mrb_trn_ipc_message_compile_fields(
+		mrb, mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@out_params")), fmt->out_fields, &fmt->num_out_fields);
+	fmt->is_compiled = true;
+
+	mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "@dirty"), mrb_false_value());
+	return self;
+}
+
+void mrb_trn_ipc_message_pack(mrb_state *mrb, message_format_t *fmt, mrb_value hash) {
+	for(size_t i = 0; i < fmt->num_in_fields; i++) {
+		trn_field_t *field = &fmt->in_fields[i];
+		mrb_value value = mrb_hash_fetch(mrb, hash, field->key, mrb_undef_value());
+		if(mrb_undef_p(value)) {
+			mrb_raisef(mrb, E_ARGUMENT_ERROR, "missing '%S'", field->key);
+		}
+		switch(field->kind) {
+		case TRN_FIELD_RAW: {
+			uint8_t *dst = (uint8_t*) fmt->rq.raw_data + field->offset;
+			if(mrb_string_p(value)) {
+				if(RSTRING_LEN(value) != field->size) {
+					mrb_raisef(mrb, E_ARGUMENT_ERROR, "invalid value for '%S'", field->key);
+				}
+				memcpy(dst, RSTRING_PTR(value), field->size);
+			} else if(mrb_fixnum_p(value) && field->size <= sizeof(uint64_t)) {
+				uint64_t v = mrb_fixnum(value);
+				memcpy(dst, &v, field->size); // little-endian
+			} else {
+				mrb_raisef(mrb, E_TYPE_ERROR, "invalid value for '%S'", field->key);
+			}
+			break; }
+		case TRN_FIELD_OBJECT: {
+			fmt->rq.objects[field->offset] = mrb_trn_ipc_object_get(mrb, value)->object;
+			break; }
+		case TRN_FIELD_COPY_HANDLE:
+			if(!mrb_fixnum_p(value)) {
+				mrb_raisef(mrb, E_TYPE_ERROR, "invalid value for '%S'", field->key);
+			}
+			fmt->rq.copy_handles[field->offset] = mrb_fixnum(value);
+			break;
+		case TRN_FIELD_MOVE_HANDLE:
+			if(!mrb_fixnum_p(value)) {
+				mrb_raisef(mrb, E_TYPE_ERROR, "invalid value for '%S'", field->key);
+			}
+			fmt->rq.move_handles[field->offset] = mrb_fixnum(value);
+			break;
+		case TRN_FIELD_BUFFER:
+			mrb_trn_ipc_message_set_buffer_data(mrb, fmt, field->offset, value);
+			break;
+		case TRN_FIELD_PID:
+			break;
+		}
+	}
+}
+
+// values that don't fit in a Fixnum (u64 at or above 2^63, or 2^62 on boxed
+// builds) come back as their raw little-endian bytes, which pack accepts as is
+mrb_value mrb_trn_ipc_unpack_numeric(mrb_state *mrb, const void *src, size_t size, bool is_signed) {
+	uint64_t v = 0;
+	memcpy(&v, src, size); // little-endian
+	if(is_signed && size < sizeof(v) && (v >> (size * 8 - 1)) != 0) {
+		v|= ~0ull << (size * 8); // sign-extend
+	}
+	int64_t i = v;
+	if(is_signed ? (i <= MRB_INT_MAX && i >= -MRB_INT_MAX - 1) : v <= (uint64_t) MRB_INT_MAX) {
+		return mrb_fixnum_value(i);
+	}
+	return mrb_str_new(mrb, (const char*) src, size);
+}
+
+mrb_value mrb_trn_ipc_message_unpack(mrb_state *mrb, message_format_t *fmt) {
+	mrb_value hash = mrb_hash_new_capa(mrb, fmt->num_out_fields);
+	for(size_t i = 0; i < fmt->num_out_fields; i++) {
+		trn_field_t *field = &fmt->out_fields[i];
+		mrb_value value = mrb_nil_value();
+		switch(field->kind) {
+		case TRN_FIELD_RAW: {
+			uint8_t *src = (uint8_t*) fmt->rs.raw_data + field->offset;
+			if(field->is_numeric) {
+				value = mrb_trn_ipc_unpack_numeric(mrb, src, field->size, false);
+			} else {
+				value = mrb_str_new(mrb, (const char*) src, field->size);
+			}
+			break; }
+		case TRN_FIELD_OBJECT:
+			value = mrb_trn_ipc_object_wrap_child(mrb, fmt->domain, fmt->service_label, fmt->rs.objects[field->offset]);
+			break;
+		case TRN_FIELD_COPY_HANDLE:
+			value = mrb_fixnum_value(fmt->rs.copy_handles[field->offset]);
+			break;
+		case TRN_FIELD_MOVE_HANDLE:
+			value = mrb_fixnum_value(fmt->rs.move_handles[field->offset]);
+			break;
+		case TRN_FIELD_PID:
+			value = mrb_fixnum_value(fmt->pid_storage);
+			break;
+		case TRN_FIELD_BUFFER:
+			continue;
+		}
+		mrb_hash_set(mrb, hash, field->key, value);
+	}
+	return hash;
+}
+
 static mrb_value mrb_trn_ipc_message_copy_in_raw(mrb_state *mrb, mrb_value self) {
 	message_format_t *fmt = mrb_data_get_ptr(mrb, self, &dt_ipc_Message);
 	mrb_int pos;
@@ -208,8 +706,7 @@ static mrb_value mrb_trn_ipc_message_copy_in_object(mrb_state *mrb, mrb_value se
 	mrb_value object;
 	mrb_int num_args = mrb_get_args(mrb, "io", &index, &object);
 
-	ipc_object_t *ipc_object = mrb_data_get_ptr(mrb, object, &dt_ipc_Object);
-	fmt->rq.objects[index] = *ipc_object;
+	fmt->rq.objects[index] = mrb_trn_ipc_object_get(mrb, object)->object;
 	return mrb_nil_value();
 }
 
@@ -218,10 +715,7 @@ static mrb_value mrb_trn_ipc_message_copy_out_object(mrb_state *mrb, mrb_value s
 	mrb_int index;
 	mrb_int num_args = mrb_get_args(mrb, "i", &index);
 
-	ipc_object_t ipc_object = fmt->rs.objects[index];
-	ipc_object_t *storage = malloc(sizeof(ipc_object));
-	*storage = ipc_object;
-	return mrb_obj_value(Data_Wrap_Struct(mrb, class_ipc_Object, &dt_ipc_Object, storage));
+	return mrb_trn_ipc_object_wrap_child(mrb, fmt->domain, fmt->service_label, fmt->rs.objects[index]);
 }
 
 static mrb_value mrb_trn_ipc_message_copy_in_copy_handle(mrb_state *mrb, mrb_value self) {
@@ -239,7 +733,7 @@ static mrb_value mrb_trn_ipc_message_copy_out_copy_handle(mrb_state *mrb, mrb_va
 	mrb_int index;
 	mrb_int num_args = mrb_get_args(mrb, "i", &index);
 
-	return mrb_fixnum_value(fmt->rq.copy_handles[index]);
+	return mrb_fixnum_value(fmt->rs.copy_handles[index]);
 }
 
 static mrb_value mrb_trn_ipc_message_copy_in_move_handle(mrb_state *mrb, mrb_value self) {
@@ -257,7 +751,7 @@ static mrb_value mrb_trn_ipc_message_copy_out_move_handle(mrb_state *mrb, mrb_va
 	mrb_int index;
 	mrb_int num_args = mrb_get_args(mrb, "i", &index);
 
-	return mrb_fixnum_value(fmt->rq.move_handles[index]);
+	return mrb_fixnum_value(fmt->rs.move_handles[index]);
 }
 
 static mrb_value mrb_trn_ipc_message_copy_out_pid(mrb_state *mrb, mrb_value self) {
@@ -269,27 +763,46 @@ static mrb_value mrb_trn_ipc_message_copy_out_pid(mrb_state *mrb, mrb_value self
 static mrb_value mrb_trn_ipc_message_set_buffer(mrb_state *mrb, mrb_value self) {
 	message_format_t *fmt = mrb_data_get_ptr(mrb, self, &dt_ipc_Message);
 	mrb_int index;
-	mrb_value string;
-	mrb_int num_args = mrb_get_args(mrb, "is", &index, &string);
+	mrb_value buffer;
+	mrb_int num_args = mrb_get_args(mrb, "io", &index, &buffer);
 
-	fmt->rq.buffers[index]->addr = (void*) mrb_string_value_ptr(mrb, string);
-	fmt->rq.buffers[index]->size = mrb_string_value_len(mrb, string);
+	mrb_trn_ipc_message_set_buffer_data(mrb, fmt, index, buffer);
 
 	return mrb_nil_value();
 }
 
+static mrb_value mrb_trn_ipc_get_auto_buffer_threshold(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(mrb_trn_ipc_auto_buffer_threshold);
+}
+
+static mrb_value mrb_trn_ipc_set_auto_buffer_threshold(mrb_state *mrb, mrb_value self) {
+	mrb_int threshold;
+	mrb_int num_args = mrb_get_args(mrb, "i", &threshold);
+	if(threshold < 0) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "negative threshold");
+	}
+	mrb_trn_ipc_auto_buffer_threshold = threshold;
+	return mrb_fixnum_value(threshold);
+}
+
 void mrb_transistor_ipc_init(mrb_state *mrb) {
 	mod_transistor_ipc = mrb_define_module_under(mrb, mod_transistor, "IPC");
+	mrb_define_class_method(mrb, mod_transistor_ipc, "auto_buffer_threshold", mrb_trn_ipc_get_auto_buffer_threshold, MRB_ARGS_ARG(0, 0));
+	mrb_define_class_method(mrb, mod_transistor_ipc, "auto_buffer_threshold=", mrb_trn_ipc_set_auto_buffer_threshold, MRB_ARGS_ARG(1, 0));
+	mrb_define_class_method(mrb, mod_transistor_ipc, "_submit", mrb_trn_ipc_submit, MRB_ARGS_ARG(1, 1));
 	class_ipc_Object = mrb_define_class_under(mrb, mod_transistor_ipc, "Object", mrb->object_class);
-	mrb_define_class_method(mrb, mod_transistor, "get_service", mrb_trn_get_service, MRB_ARGS_ARG(1, 0));
 	mrb_define_method(mrb, class_ipc_Object, "close", mrb_trn_ipc_object_close, MRB_ARGS_ARG(0, 0));
 	mrb_define_method(mrb, class_ipc_Object, "send", mrb_trn_ipc_object_send, MRB_ARGS_ARG(1, 1));
+	mrb_define_method(mrb, class_ipc_Object, "convert_to_domain", mrb_trn_ipc_object_convert_to_domain, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_ipc_Object, "domain?", mrb_trn_ipc_object_is_domain, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_ipc_Object, "_invoke", mrb_trn_ipc_object_invoke, MRB_ARGS_ARG(2, 0));
 	class_ipc_Message = mrb_define_class_under(mrb, mod_transistor_ipc, "Message", mrb->object_class);
 	mrb_define_class_method(mrb, class_ipc_Message, "new", mrb_trn_ipc_message_new, MRB_ARGS_ARG(1, 0));
 	mrb_define_method(mrb, class_ipc_Message, "_invalidate", mrb_trn_ipc_message_invalidate, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_ipc_Message, "_compile", mrb_trn_ipc_message_compile, MRB_ARGS_ARG(0, 0));
 	mrb_define_method(mrb, class_ipc_Message, "_copy_in_raw", mrb_trn_ipc_message_copy_in_raw, MRB_ARGS_ARG(2, 0));
 	mrb_define_method(mrb, class_ipc_Message, "_copy_out_raw", mrb_trn_ipc_message_copy_out_raw, MRB_ARGS_ARG(2, 0));
-	mrb_define_method(mrb, class_ipc_Message, "_copy_in_object", mrb_trn_ipc_message_copy_out_object, MRB_ARGS_ARG(2, 0));
+	mrb_define_method(mrb, class_ipc_Message, "_copy_in_object", mrb_trn_ipc_message_copy_in_object, MRB_ARGS_ARG(2, 0));
 	mrb_define_method(mrb, class_ipc_Message, "_copy_out_object", mrb_trn_ipc_message_copy_out_object, MRB_ARGS_ARG(1, 0));
 	mrb_define_method(mrb, class_ipc_Message, "_copy_in_copy_handle", mrb_trn_ipc_message_copy_in_copy_handle, MRB_ARGS_ARG(2, 0));
 	mrb_define_method(mrb, class_ipc_Message, "_copy_out_copy_handle", mrb_trn_ipc_message_copy_out_copy_handle, MRB_ARGS_ARG(1, 0));
@@ -1,4 +1,5 @@
 #include<stdint.h>
+#include<stdio.h>
 #include<malloc.h>
 #include<string.h>
 
@@ -7,22 +8,35 @@
 #include<mruby/value.h>
 #include<mruby/string.h>
 #include<mruby/data.h>
+#include<mruby/variable.h>
 
 #include<libtransistor/nx.h>
 
 #include "trn.h"
 
-struct RClass *mod_transistor;
-struct RClass *mod_transistor_ll;
-struct RClass *exc_ResultError;
+__thread struct RClass *mod_transistor;
+__thread struct RClass *mod_transistor_ll;
+__thread struct RClass *exc_ResultError;
+
+mrb_value mrb_trn_result_error_new(mrb_state *mrb, result_t r) {
+	char message[32];
+	snprintf(message, sizeof(message), "ResultError (0x%x)", r);
+	mrb_value exc = mrb_exc_new_str(mrb, exc_ResultError, mrb_str_new_cstr(mrb, message));
+	mrb_iv_set(mrb, exc, mrb_intern_lit(mrb, "@code"), mrb_fixnum_value(r));
+	return exc;
+}
 
 void mrb_trn_assert_ok(mrb_state *mrb, result_t r) {
 	if(r != RESULT_OK) {
 		printf("result error: 0x%x\n", r);
-		mrb_raise(mrb, exc_ResultError, "ResultError");
+		mrb_exc_raise(mrb, mrb_trn_result_error_new(mrb, r));
 	}
 }
 
+static mrb_value mrb_trn_result_error_code(mrb_state *mrb, mrb_value self) {
+	return mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@code"));
+}
+
 static mrb_value mrb_trn_alloc_pages(mrb_state *mrb, mrb_value self) {
 	size_t min, max;
 	mrb_int num_args = mrb_get_args(mrb, "ii", &min, &max);
@@ -75,6 +89,25 @@ static mrb_value mrb_trn_write(mrb_state *mrb, mrb_value self) {
 	return mrb_fixnum_value(0);
 }
 
+// system tick conversions, shared with the C side so Ruby deadlines don't overflow either
+static mrb_value mrb_trn_ns_to_ticks(mrb_state *mrb, mrb_value self) {
+	mrb_int ns;
+	mrb_int num_args = mrb_get_args(mrb, "i", &ns);
+	if(ns < 0) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "negative duration");
+	}
+	return mrb_fixnum_value(trn_ns_to_ticks(ns));
+}
+
+static mrb_value mrb_trn_ticks_to_ns(mrb_state *mrb, mrb_value self) {
+	mrb_int ticks;
+	mrb_int num_args = mrb_get_args(mrb, "i", &ticks);
+	if(ticks < 0) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "negative duration");
+	}
+	return mrb_fixnum_value(trn_ticks_to_ns(ticks));
+}
+
 static mrb_value mrb_trn_get_process_handle(mrb_state *mrb, mrb_value self) {
 	return mrb_fixnum_value(loader_config.process_handle);
 }
@@ -83,6 +116,7 @@ void mrb_transistor_gem_init(mrb_state *mrb) {
 	mod_transistor = mrb_define_module(mrb, "TRN");
 
 	exc_ResultError = mrb_define_class_under(mrb, mod_transistor, "ResultError", E_RUNTIME_ERROR);
+	mrb_define_method(mrb, exc_ResultError, "code", mrb_trn_result_error_code, MRB_ARGS_ARG(0, 0));
 	
 	// lowlevel
 	mod_transistor_ll = mrb_define_module_under(mrb, mod_transistor, "LL");
@@ -92,10 +126,30 @@ void mrb_transistor_gem_init(mrb_state *mrb) {
 	mrb_define_class_method(mrb, mod_transistor_ll, "read", mrb_trn_read, MRB_ARGS_ARG(2, 0));
 	mrb_define_class_method(mrb, mod_transistor_ll, "write", mrb_trn_write, MRB_ARGS_ARG(2, 0));
 	mrb_define_class_method(mrb, mod_transistor_ll, "process_handle", mrb_trn_get_process_handle, MRB_ARGS_ARG(0, 0));
+	mrb_define_class_method(mrb, mod_transistor_ll, "ns_to_ticks", mrb_trn_ns_to_ticks, MRB_ARGS_ARG(1, 0));
+	mrb_define_class_method(mrb, mod_transistor_ll, "ticks_to_ns", mrb_trn_ticks_to_ns, MRB_ARGS_ARG(1, 0));
+	mrb_define_const(mrb, mod_transistor_ll, "TICKS_PER_SECOND", mrb_fixnum_value(TRN_TICKS_PER_SECOND));
 
 	// other modules
+	mrb_transistor_buffer_init(mrb);
 	mrb_transistor_bind_init(mrb);
 	mrb_transistor_ipc_init(mrb);
+	mrb_transistor_recorder_init(mrb);
+	mrb_transistor_stats_init(mrb);
+	mrb_transistor_heap_init(mrb);
+	mrb_transistor_sm_init(mrb);
+	mrb_transistor_server_init(mrb);
+	mrb_transistor_pool_init(mrb);
+	mrb_transistor_service_init(mrb);
+	mrb_transistor_usb_init(mrb);
+	mrb_transistor_worker_init(mrb);
+	mrb_transistor_reactor_init(mrb);
+	mrb_transistor_memory_init(mrb);
+	mrb_transistor_shmem_init(mrb);
+	mrb_transistor_profiler_init(mrb);
+#ifdef TRN_HOST_SIM
+	mrb_transistor_sim_init(mrb);
+#endif
 }
 
 void mrb_transistor_gem_final(mrb_state *mrb) {
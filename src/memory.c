@@ -0,0 +1,290 @@
+#include<stdint.h>
+#include<string.h>
+
+#if defined(__aarch64__)
+#include<arm_neon.h>
+#elif defined(__SSE2__)
+#include<immintrin.h>
+#endif
+
+#include<mruby.h>
+#include<mruby/array.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// TRN::Memory: address space walks and pattern scans over the local process
+// or a debugged one (debug handle), without going through Ruby strings.
+
+#define TRN_MEMORY_PERM_R 1
+#define TRN_MEMORY_PERM_W 2
+#define TRN_MEMORY_PERM_X 4
+
+#define TRN_MEMORY_TYPE_IO 0x01
+
+#define TRN_MEMORY_CHUNK_SIZE 0x100000
+#define TRN_MEMORY_MAX_PATTERNS 64
+
+static void trn_memory_query(mrb_state *mrb, handle_t debug, uint64_t addr, memory_info_t *info) {
+	uint32_t page_info;
+	if(debug) {
+		mrb_trn_assert_ok(mrb, svcQueryDebugProcessMemory(info, &page_info, debug, addr));
+	} else {
+		mrb_trn_assert_ok(mrb, svcQueryMemory(info, &page_info, (void*) addr));
+	}
+}
+
+// walks the whole address space into an array of memory_info_t backed by a
+// String (so a failed query doesn't leak it), keeping regions that have every
+// bit of permission set and, if type is non-negative, are of that type
+static mrb_value trn_memory_walk(mrb_state *mrb, handle_t debug, uint32_t permission, mrb_int type, size_t *count) {
+	size_t capacity = 64;
+	mrb_value store = mrb_str_new(mrb, NULL, capacity * sizeof(memory_info_t));
+	*count = 0;
+
+	uint64_t addr = 0;
+	do {
+		memory_info_t info;
+		trn_memory_query(mrb, debug, addr, &info);
+		uint64_t end = (uint64_t) info.base_addr + info.size;
+		if(info.size == 0 || (end != 0 && end <= addr)) {
+			break;
+		}
+		addr = end; // wraps to 0 after the last region
+
+		if((info.permission & permission) != permission) {
+			continue;
+		}
+		if(type >= 0 && (info.memory_type & 0xff) != type) {
+			continue;
+		}
+		if(*count == capacity) {
+			capacity*= 2;
+			store = mrb_str_resize(mrb, store, capacity * sizeof(memory_info_t));
+		}
+		memcpy(RSTRING_PTR(store) + *count * sizeof(memory_info_t), &info, sizeof(info));
+		(*count)++;
+	} while(addr != 0);
+	return store;
+}
+
+static handle_t trn_memory_debug_handle(mrb_value debug) {
+	return mrb_nil_p(debug) ? 0 : (handle_t) mrb_fixnum(debug);
+}
+
+// regions(debug = nil, permission = 0, type = nil) -> [TRN::LL::MemoryInfo]
+static mrb_value mrb_trn_memory_regions(mrb_state *mrb, mrb_value self) {
+	mrb_value debug = mrb_nil_value();
+	mrb_int permission = 0;
+	mrb_value type = mrb_nil_value();
+	mrb_int num_args = mrb_get_args(mrb, "|oio", &debug, &permission, &type);
+
+	size_t count;
+	mrb_value store = trn_memory_walk(mrb, trn_memory_debug_handle(debug), permission, mrb_nil_p(type) ? -1 : mrb_fixnum(type), &count);
+	const memory_info_t *infos = (const memory_info_t*) RSTRING_PTR(store);
+	mrb_value regions = mrb_ary_new_capa(mrb, count);
+	int ai = mrb_gc_arena_save(mrb);
+	for(size_t i = 0; i < count; i++) {
+		mrb_ary_push(mrb, regions, mrb_trn_memory_info_new(mrb, &infos[i]));
+		mrb_gc_arena_restore(mrb, ai);
+	}
+	return regions;
+}
+
+// block scans compare the first and last pattern bytes at once and yield a
+// mask with TRN_SCAN_LANE set for every candidate offset
+#if defined(__aarch64__)
+#define TRN_SCAN_WIDTH 16
+#define TRN_SCAN_LANE 0xfull
+typedef uint64_t trn_scan_mask_t;
+static inline trn_scan_mask_t trn_scan_block(const uint8_t *p, size_t k, uint8x16_t first, uint8x16_t last) {
+	uint8x16_t eq = vandq_u8(vceqq_u8(vld1q_u8(p), first), vceqq_u8(vld1q_u8(p + k - 1), last));
+	// no movemask on NEON; narrow to four bits per byte instead
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+#define TRN_SCAN_SPLAT(b) vdupq_n_u8(b)
+typedef uint8x16_t trn_scan_vec_t;
+#elif defined(__AVX2__)
+#define TRN_SCAN_WIDTH 32
+#define TRN_SCAN_LANE 0x1ull
+typedef uint32_t trn_scan_mask_t;
+static inline trn_scan_mask_t trn_scan_block(const uint8_t *p, size_t k, __m256i first, __m256i last) {
+	__m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) p), first);
+	__m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (p + k - 1)), last);
+	return (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(a, b));
+}
+#define TRN_SCAN_SPLAT(b) _mm256_set1_epi8((char) (b))
+typedef __m256i trn_scan_vec_t;
+#elif defined(__SSE2__)
+#define TRN_SCAN_WIDTH 16
+#define TRN_SCAN_LANE 0x1ull
+typedef uint32_t trn_scan_mask_t;
+static inline trn_scan_mask_t trn_scan_block(const uint8_t *p, size_t k, __m128i first, __m128i last) {
+	__m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), first);
+	__m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + k - 1)), last);
+	return (uint32_t) _mm_movemask_epi8(_mm_and_si128(a, b));
+}
+#define TRN_SCAN_SPLAT(b) _mm_set1_epi8((char) (b))
+typedef __m128i trn_scan_vec_t;
+#endif
+
+typedef struct {
+	const uint8_t *bytes;
+	size_t size;
+} trn_scan_pattern_t;
+
+typedef struct {
+	mrb_value results;
+	mrb_int remaining; // negative for no limit
+} trn_scan_state_t;
+
+static bool trn_scan_match(mrb_state *mrb, trn_scan_state_t *state, const uint8_t *buf, size_t off, size_t step, const trn_scan_pattern_t *pattern, mrb_int index, uint64_t base) {
+	if(off >= step) {
+		return true; // the next window reports it
+	}
+	if(pattern->size > 2 && memcmp(buf + off + 1, pattern->bytes + 1, pattern->size - 2) != 0) {
+		return true;
+	}
+	int ai = mrb_gc_arena_save(mrb);
+	mrb_value match = mrb_ary_new_capa(mrb, 2);
+	mrb_ary_push(mrb, match, mrb_fixnum_value(base + off));
+	mrb_ary_push(mrb, match, mrb_fixnum_value(index));
+	mrb_ary_push(mrb, state->results, match);
+	mrb_gc_arena_restore(mrb, ai);
+	return state->remaining < 0 || --state->remaining > 0;
+}
+
+// reports matches of one pattern starting before step in buf[0, len);
+// returns false once the limit is reached
+static bool trn_scan_pattern(mrb_state *mrb, trn_scan_state_t *state, const uint8_t *buf, size_t len, size_t step, const trn_scan_pattern_t *pattern, mrb_int index, uint64_t base) {
+	size_t k = pattern->size;
+	if(k > len) {
+		return true;
+	}
+	uint8_t first = pattern->bytes[0];
+	uint8_t last = pattern->bytes[k - 1];
+	size_t i = 0;
+#ifdef TRN_SCAN_WIDTH
+	trn_scan_vec_t first_v = TRN_SCAN_SPLAT(first);
+	trn_scan_vec_t last_v = TRN_SCAN_SPLAT(last);
+	for(; i + TRN_SCAN_WIDTH + k - 1 <= len && i < step; i+= TRN_SCAN_WIDTH) {
+		trn_scan_mask_t mask = trn_scan_block(buf + i, k, first_v, last_v);
+		while(mask) {
+			int bit = __builtin_ctzll(mask);
+			mask&= ~((trn_scan_mask_t) TRN_SCAN_LANE << bit);
+			if(!trn_scan_match(mrb, state, buf, i + bit / __builtin_popcountll(TRN_SCAN_LANE), step, pattern, index, base)) {
+				return false;
+			}
+		}
+	}
+#endif
+	for(; i + k <= len && i < step; i++) {
+		if(buf[i] == first && buf[i + k - 1] == last) {
+			if(!trn_scan_match(mrb, state, buf, i, step, pattern, index, base)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// scan(patterns, debug = nil, permission = PERM_R, limit = -1, chunk_size = 0x100000)
+//   -> [[address, pattern_index], ...]
+// patterns is a String or an Array of Strings. every readable region is read
+// in chunk_size windows (through one reused buffer for debug processes) that
+// overlap by the longest pattern, so matches across chunk edges are found;
+// matches spanning two regions are not.
+static mrb_value mrb_trn_memory_scan(mrb_state *mrb, mrb_value self) {
+	mrb_value patterns_v;
+	mrb_value debug_v = mrb_nil_value();
+	mrb_int permission = TRN_MEMORY_PERM_R;
+	mrb_int limit = -1;
+	mrb_int chunk_size = TRN_MEMORY_CHUNK_SIZE;
+	mrb_int num_args = mrb_get_args(mrb, "o|oiii", &patterns_v, &debug_v, &permission, &limit, &chunk_size);
+
+	if(mrb_string_p(patterns_v)) {
+		mrb_value array = mrb_ary_new_capa(mrb, 1);
+		mrb_ary_push(mrb, array, patterns_v);
+		patterns_v = array;
+	}
+	if(!mrb_array_p(patterns_v)) {
+		mrb_raise(mrb, E_TYPE_ERROR, "expected String or Array of Strings");
+	}
+	mrb_int num_patterns = RARRAY_LEN(patterns_v);
+	if(num_patterns == 0 || num_patterns > TRN_MEMORY_MAX_PATTERNS) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid number of patterns");
+	}
+	if(chunk_size <= 0) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid chunk size");
+	}
+
+	trn_scan_pattern_t patterns[TRN_MEMORY_MAX_PATTERNS];
+	size_t overlap = 0;
+	for(mrb_int i = 0; i < num_patterns; i++) {
+		mrb_value pattern = mrb_ary_ref(mrb, patterns_v, i);
+		if(!mrb_string_p(pattern) || RSTRING_LEN(pattern) == 0) {
+			mrb_raise(mrb, E_ARGUMENT_ERROR, "patterns must be non-empty Strings");
+		}
+		patterns[i].bytes = (const uint8_t*) RSTRING_PTR(pattern);
+		patterns[i].size = RSTRING_LEN(pattern);
+		if(patterns[i].size - 1 > overlap) {
+			overlap = patterns[i].size - 1;
+		}
+	}
+
+	handle_t debug = trn_memory_debug_handle(debug_v);
+	size_t count;
+	mrb_value store = trn_memory_walk(mrb, debug, permission | TRN_MEMORY_PERM_R, -1, &count);
+	mrb_value buffer = debug ? mrb_str_new(mrb, NULL, chunk_size + overlap) : mrb_nil_value();
+
+	trn_scan_state_t state = {mrb_ary_new(mrb), limit};
+	if(limit == 0) {
+		return state.results;
+	}
+	for(size_t r = 0; r < count; r++) {
+		memory_info_t info;
+		memcpy(&info, RSTRING_PTR(store) + r * sizeof(info), sizeof(info));
+		if((info.memory_type & 0xff) == TRN_MEMORY_TYPE_IO) {
+			continue; // device registers
+		}
+		uint64_t base = (uint64_t) info.base_addr;
+		for(uint64_t pos = 0; pos < info.size; pos+= chunk_size) {
+			size_t len = info.size - pos;
+			size_t step = len;
+			if(len > chunk_size + overlap) {
+				len = chunk_size + overlap;
+				step = chunk_size;
+			}
+			const uint8_t *window;
+			if(debug) {
+				mrb_trn_assert_ok(mrb, svcReadDebugProcessMemory(RSTRING_PTR(buffer), debug, base + pos, len));
+				window = (const uint8_t*) RSTRING_PTR(buffer);
+			} else {
+				window = (const uint8_t*) (base + pos);
+			}
+			for(mrb_int i = 0; i < num_patterns; i++) {
+				if(!trn_scan_pattern(mrb, &state, window, len, step, &patterns[i], i, base + pos)) {
+					return state.results;
+				}
+			}
+			if(step == len) {
+				break;
+			}
+		}
+	}
+	return state.results;
+}
+
+void mrb_transistor_memory_init(mrb_state *mrb) {
+	struct RClass *mod_memory = mrb_define_module_under(mrb, mod_transistor, "Memory");
+	mrb_define_class_method(mrb, mod_memory, "regions", mrb_trn_memory_regions, MRB_ARGS_ARG(0, 3));
+	mrb_define_class_method(mrb, mod_memory, "scan", mrb_trn_memory_scan, MRB_ARGS_ARG(1, 4));
+	mrb_define_const(mrb, mod_memory, "PERM_R", mrb_fixnum_value(TRN_MEMORY_PERM_R));
+	mrb_define_const(mrb, mod_memory, "PERM_W", mrb_fixnum_value(TRN_MEMORY_PERM_W));
+	mrb_define_const(mrb, mod_memory, "PERM_X", mrb_fixnum_value(TRN_MEMORY_PERM_X));
+	mrb_define_const(mrb, mod_memory, "PERM_RW", mrb_fixnum_value(TRN_MEMORY_PERM_R | TRN_MEMORY_PERM_W));
+	mrb_define_const(mrb, mod_memory, "PERM_RX", mrb_fixnum_value(TRN_MEMORY_PERM_R | TRN_MEMORY_PERM_X));
+}
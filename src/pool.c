@@ -0,0 +1,284 @@
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/class.h>
+#include<mruby/data.h>
+#include<mruby/value.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// TRN::IPC::SessionPool: clones of one session, checked out per request so
+// several requests to a service can be in flight at once. Sessions are
+// cloned lazily up to the limit; a bitmap tracks which ones are in use.
+// Pools are refcounted and safe to share between threads; shared pools are
+// registered by service name so every worker's mrb_state finds the same one.
+
+#define TRN_SESSION_POOL_MAX 64 // bits in the busy map
+#define TRN_SESSION_POOL_SPIN 64
+#define TRN_SESSION_POOL_SLEEP_NS 50000
+
+struct trn_session_pool {
+	struct trn_session_pool *next; // in the shared registry
+	char name[9]; // shared pools only
+	uint32_t refs;
+	uint64_t service_label;
+	ipc_object_t source; // only used to clone from, under growing
+	bool growing;
+	uint32_t limit;
+	uint32_t count; // sessions[0, count) are open
+	uint64_t busy;
+	ipc_object_t sessions[TRN_SESSION_POOL_MAX];
+};
+
+static trn_session_pool_t *trn_session_pool_shared;
+static bool trn_session_pool_shared_lock;
+
+static void trn_session_pool_lock(bool *lock) {
+	while(__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) {
+	}
+}
+
+static void trn_session_pool_unlock(bool *lock) {
+	__atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+static trn_session_pool_t *trn_session_pool_create(ipc_object_t source, uint64_t service_label, uint32_t limit) {
+	trn_session_pool_t *pool = calloc(1, sizeof(*pool));
+	if(pool == NULL) {
+		return NULL;
+	}
+	pool->refs = 1;
+	pool->source = source;
+	pool->service_label = service_label;
+	pool->limit = limit;
+	return pool;
+}
+
+static void trn_session_pool_destroy(trn_session_pool_t *pool) {
+	for(uint32_t i = 0; i < pool->count; i++) {
+		ipc_close(pool->sessions[i]);
+	}
+	ipc_close(pool->source);
+	free(pool);
+}
+
+static void trn_session_pool_retain(trn_session_pool_t *pool) {
+	__atomic_fetch_add(&pool->refs, 1, __ATOMIC_RELAXED);
+}
+
+void mrb_trn_session_pool_release(trn_session_pool_t *pool) {
+	// shared pools are looked up under the registry lock, so drop them under it too
+	trn_session_pool_lock(&trn_session_pool_shared_lock);
+	if(__atomic_sub_fetch(&pool->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+		trn_session_pool_unlock(&trn_session_pool_shared_lock);
+		return;
+	}
+	for(trn_session_pool_t **head = &trn_session_pool_shared; *head != NULL; head = &(*head)->next) {
+		if(*head == pool) {
+			*head = pool->next;
+			break;
+		}
+	}
+	trn_session_pool_unlock(&trn_session_pool_shared_lock);
+	trn_session_pool_destroy(pool);
+}
+
+// clones one more session; the caller holds growing
+static result_t trn_session_pool_grow(trn_session_pool_t *pool, uint32_t *index) {
+	uint32_t count = __atomic_load_n(&pool->count, __ATOMIC_RELAXED);
+	result_t r = mrb_trn_ipc_clone(pool->source, &pool->sessions[count]);
+	if(r != RESULT_OK) {
+		return r;
+	}
+	// claimed before it becomes visible
+	__atomic_fetch_or(&pool->busy, 1ull << count, __ATOMIC_RELAXED);
+	__atomic_store_n(&pool->count, count + 1, __ATOMIC_RELEASE);
+	*index = count;
+	return RESULT_OK;
+}
+
+static result_t trn_session_pool_checkout(trn_session_pool_t *pool, uint32_t *index) {
+	size_t polls = 0;
+	while(true) {
+		uint32_t count = __atomic_load_n(&pool->count, __ATOMIC_ACQUIRE);
+		uint64_t busy = __atomic_load_n(&pool->busy, __ATOMIC_RELAXED);
+		uint64_t open = count == 64 ? UINT64_MAX : (1ull << count) - 1;
+		uint64_t idle = open & ~busy;
+		if(idle) {
+			uint32_t i = __builtin_ctzll(idle);
+			if(__atomic_compare_exchange_n(&pool->busy, &busy, busy | (1ull << i), true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				*index = i;
+				return RESULT_OK;
+			}
+			continue;
+		}
+		if(count < pool->limit && !__atomic_test_and_set(&pool->growing, __ATOMIC_ACQUIRE)) {
+			result_t r = RESULT_OK;
+			bool grew = false;
+			// someone else may have grown it while we looked
+			if(__atomic_load_n(&pool->count, __ATOMIC_ACQUIRE) == count) {
+				r = trn_session_pool_grow(pool, index);
+				grew = r == RESULT_OK;
+			}
+			trn_session_pool_unlock(&pool->growing);
+			if(grew) {
+				return RESULT_OK;
+			}
+			if(r != RESULT_OK && count == 0) {
+				return r; // nothing to wait for
+			}
+		}
+		if(++polls > TRN_SESSION_POOL_SPIN) {
+			svcSleepThread(TRN_SESSION_POOL_SLEEP_NS);
+		}
+	}
+}
+
+static void trn_session_pool_checkin(trn_session_pool_t *pool, uint32_t index) {
+	__atomic_fetch_and(&pool->busy, ~(1ull << index), __ATOMIC_RELEASE);
+}
+
+result_t mrb_trn_session_pool_send(trn_session_pool_t *pool, ipc_request_t *rq, ipc_response_fmt_t *rs) {
+	uint32_t index;
+	result_t r = trn_session_pool_checkout(pool, &index);
+	if(r != RESULT_OK) {
+		return r;
+	}
+	r = ipc_send(pool->sessions[index], rq, rs);
+	trn_session_pool_checkin(pool, index);
+	return r;
+}
+
+static void mrb_trn_session_pool_dfree(mrb_state *mrb, void *data) {
+	if(data) {
+		mrb_trn_session_pool_release(data);
+	}
+}
+
+static const mrb_data_type dt_SessionPool = {"SessionPool", mrb_trn_session_pool_dfree};
+
+static trn_session_pool_t *mrb_trn_session_pool_get(mrb_state *mrb, mrb_value self) {
+	return mrb_data_get_ptr(mrb, self, &dt_SessionPool);
+}
+
+static uint32_t mrb_trn_session_pool_check_limit(mrb_state *mrb, mrb_int limit) {
+	if(limit < 1 || limit > TRN_SESSION_POOL_MAX) {
+		mrb_raisef(mrb, E_ARGUMENT_ERROR, "pool limit must be between 1 and %S", mrb_fixnum_value(TRN_SESSION_POOL_MAX));
+	}
+	return limit;
+}
+
+static mrb_value mrb_trn_session_pool_new(mrb_state *mrb, mrb_value self) {
+	mrb_value object;
+	mrb_int limit = 8;
+	mrb_int num_args = mrb_get_args(mrb, "o|i", &object, &limit);
+	uint32_t checked_limit = mrb_trn_session_pool_check_limit(mrb, limit);
+	trn_ipc_object_t *obj = mrb_trn_ipc_object_get(mrb, object);
+	if(obj->domain) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "can't pool a domain object");
+	}
+
+	// the pool gets its own session so the object stays usable on its own
+	ipc_object_t source;
+	if(obj->pool) {
+		trn_session_pool_lock(&obj->pool->growing);
+		result_t r = mrb_trn_ipc_clone(obj->pool->source, &source);
+		trn_session_pool_unlock(&obj->pool->growing);
+		mrb_trn_assert_ok(mrb, r);
+	} else {
+		mrb_trn_assert_ok(mrb, mrb_trn_ipc_clone(obj->object, &source));
+	}
+	trn_session_pool_t *pool = trn_session_pool_create(source, obj->service_label, checked_limit);
+	if(pool == NULL) {
+		ipc_close(source);
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	return mrb_obj_value(Data_Wrap_Struct(mrb, mrb_class_ptr(self), &dt_SessionPool, pool));
+}
+
+static mrb_value mrb_trn_session_pool_shared_m(mrb_state *mrb, mrb_value self) {
+	char *str;
+	mrb_int size;
+	mrb_int limit = 8;
+	mrb_int num_args = mrb_get_args(mrb, "s|i", &str, &size, &limit);
+	uint32_t checked_limit = mrb_trn_session_pool_check_limit(mrb, limit);
+	char name[9] = {0};
+	if(size >= sizeof(name)) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "service name too long");
+	}
+	memcpy(name, str, size);
+
+	trn_session_pool_lock(&trn_session_pool_shared_lock);
+	trn_session_pool_t *pool = trn_session_pool_shared;
+	while(pool != NULL && strcmp(pool->name, name) != 0) {
+		pool = pool->next;
+	}
+	if(pool) {
+		trn_session_pool_retain(pool);
+		trn_session_pool_unlock(&trn_session_pool_shared_lock);
+	} else {
+		// sm is refcounted, so this is fine from any thread
+		ipc_object_t source;
+		result_t r = sm_init();
+		if(r == RESULT_OK) {
+			r = sm_get_service(&source, name);
+			sm_finalize();
+		}
+		if(r == RESULT_OK) {
+			uint64_t label = 0;
+			memcpy(&label, name, 8);
+			pool = trn_session_pool_create(source, label, checked_limit);
+			if(pool == NULL) {
+				ipc_close(source);
+			} else {
+				memcpy(pool->name, name, sizeof(name));
+				pool->next = trn_session_pool_shared;
+				trn_session_pool_shared = pool;
+			}
+		}
+		trn_session_pool_unlock(&trn_session_pool_shared_lock);
+		mrb_trn_assert_ok(mrb, r);
+		if(pool == NULL) {
+			mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+		}
+	}
+	return mrb_obj_value(Data_Wrap_Struct(mrb, mrb_class_ptr(self), &dt_SessionPool, pool));
+}
+
+// an Object whose requests go through the pool
+static mrb_value mrb_trn_session_pool_object(mrb_state *mrb, mrb_value self) {
+	trn_session_pool_t *pool = mrb_trn_session_pool_get(mrb, self);
+	mrb_value object = mrb_trn_ipc_object_wrap(mrb, pool->source);
+	trn_ipc_object_t *obj = DATA_PTR(object);
+	trn_session_pool_retain(pool);
+	obj->pool = pool;
+	obj->service_label = pool->service_label;
+	return object;
+}
+
+static mrb_value mrb_trn_session_pool_size(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(__atomic_load_n(&mrb_trn_session_pool_get(mrb, self)->count, __ATOMIC_ACQUIRE));
+}
+
+static mrb_value mrb_trn_session_pool_limit(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(mrb_trn_session_pool_get(mrb, self)->limit);
+}
+
+static mrb_value mrb_trn_session_pool_in_use(mrb_state *mrb, mrb_value self) {
+	uint64_t busy = __atomic_load_n(&mrb_trn_session_pool_get(mrb, self)->busy, __ATOMIC_RELAXED);
+	return mrb_fixnum_value(__builtin_popcountll(busy));
+}
+
+void mrb_transistor_pool_init(mrb_state *mrb) {
+	struct RClass *class_SessionPool = mrb_define_class_under(mrb, mod_transistor_ipc, "SessionPool", mrb->object_class);
+	mrb_define_class_method(mrb, class_SessionPool, "new", mrb_trn_session_pool_new, MRB_ARGS_ARG(1, 1));
+	mrb_define_class_method(mrb, class_SessionPool, "shared", mrb_trn_session_pool_shared_m, MRB_ARGS_ARG(1, 1));
+	mrb_define_method(mrb, class_SessionPool, "object", mrb_trn_session_pool_object, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_SessionPool, "size", mrb_trn_session_pool_size, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_SessionPool, "limit", mrb_trn_session_pool_limit, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_SessionPool, "in_use", mrb_trn_session_pool_in_use, MRB_ARGS_ARG(0, 0));
+}
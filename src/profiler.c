@@ -0,0 +1,542 @@
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/class.h>
+#include<mruby/data.h>
+#include<mruby/debug.h>
+#include<mruby/hash.h>
+#include<mruby/irep.h>
+#include<mruby/proc.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// TRN::Profiler: a sampler thread bumps a counter every interval and the
+// interpreter thread takes the sample itself, from mruby's code fetch hook,
+// at its next instruction. Walking the call stack from the sampler thread
+// would race the VM. Time spent blocked in native code (IPC, sleeps) shows
+// up as one sample weighted by the ticks it missed, attributed to the
+// calling line.
+//
+// Stacks are interned into a frame table and a tree of call nodes, so a
+// sample is just (tick, node, weight). All tables are allocated up front;
+// when one fills up, further samples are dropped and counted.
+//
+// Sampling needs mruby built with MRB_ENABLE_DEBUG_HOOK (TRN_PROFILE=1 for
+// host/build_config.rb). Without it only spans are recorded.
+
+#define TRN_PROFILER_DEFAULT_INTERVAL_US 1000
+#define TRN_PROFILER_DEFAULT_CAPACITY 0x10000 // samples
+#define TRN_PROFILER_MAX_SPANS 0x4000
+#define TRN_PROFILER_MAX_FRAMES 0x1000
+#define TRN_PROFILER_MAX_NODES 0x4000
+#define TRN_PROFILER_MAX_DEPTH 64 // innermost frames kept per sample
+#define TRN_PROFILER_LABEL_MAX 256
+
+typedef struct {
+	const mrb_irep *irep; // NULL for C functions
+	uint32_t pc;
+	mrb_sym mid;
+	const struct RClass *klass;
+	char *label; // "Class#method (file:line)"
+} trn_profiler_frame_t;
+
+typedef struct {
+	uint32_t parent; // 0 is the root
+	uint32_t frame;
+	uint32_t depth;
+} trn_profiler_node_t;
+
+typedef struct {
+	uint64_t tick;
+	uint32_t node;
+	uint32_t weight; // sampler intervals this sample stands for
+} trn_profiler_sample_t;
+
+typedef struct {
+	uint64_t tick;
+	mrb_sym name;
+	bool end;
+} trn_profiler_span_t;
+
+#ifdef MRB_ENABLE_DEBUG_HOOK
+typedef void (*trn_profiler_hook_t)(struct mrb_state *mrb, struct mrb_irep *irep, mrb_code *pc, mrb_value *regs);
+#endif
+
+typedef struct {
+	mrb_state *mrb;
+	uint64_t interval_ns; // 0 records spans only
+	bool running;
+	bool stopping;
+	trn_thread_t thread;
+	uint32_t pending; // sampler intervals since the last sample
+#ifdef MRB_ENABLE_DEBUG_HOOK
+	trn_profiler_hook_t prev_hook;
+#endif
+
+	trn_profiler_frame_t *frames; // index 0 unused
+	uint32_t *frame_buckets; // frame index, 0 if empty
+	uint32_t num_frames;
+	trn_profiler_node_t *nodes; // index 0 is the root
+	uint32_t *node_buckets;
+	uint32_t num_nodes;
+
+	trn_profiler_sample_t *samples;
+	size_t num_samples;
+	size_t capacity;
+	trn_profiler_span_t *spans;
+	size_t num_spans;
+	uint64_t dropped;
+	uint64_t start_tick;
+	uint64_t stop_tick;
+} trn_profiler_t;
+
+static __thread trn_profiler_t *trn_profiler_current; // running on this thread's mrb_state
+
+static void trn_profiler_reset(trn_profiler_t *prof) {
+	for(uint32_t i = 1; i <= prof->num_frames; i++) {
+		free(prof->frames[i].label);
+	}
+	memset(prof->frame_buckets, 0, TRN_PROFILER_MAX_FRAMES * 2 * sizeof(uint32_t));
+	memset(prof->node_buckets, 0, TRN_PROFILER_MAX_NODES * 2 * sizeof(uint32_t));
+	prof->num_frames = 0;
+	prof->num_nodes = 0;
+	prof->num_samples = 0;
+	prof->num_spans = 0;
+	prof->dropped = 0;
+}
+
+#ifdef MRB_ENABLE_DEBUG_HOOK
+static uint32_t trn_profiler_hash(uint64_t a, uint64_t b) {
+	uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+	return h >> 32;
+}
+
+static void trn_profiler_label(mrb_state *mrb, char *label, const struct RClass *klass, mrb_sym mid, bool block) {
+	const char *owner = "";
+	const char *separator = "";
+	if(klass != NULL && mid != 0) {
+		mrb_value attached = mrb_nil_value();
+		if(mrb_type(mrb_obj_value((void*) klass)) == MRB_TT_SCLASS) {
+			attached = mrb_iv_get(mrb, mrb_obj_value((void*) klass), mrb_intern_lit(mrb, "__attached__"));
+		}
+		if(mrb_type(attached) == MRB_TT_CLASS || mrb_type(attached) == MRB_TT_MODULE) {
+			owner = mrb_class_name(mrb, mrb_class_ptr(attached));
+			separator = ".";
+		} else {
+			owner = mrb_class_name(mrb, (struct RClass*) klass);
+			separator = "#";
+		}
+		if(owner == NULL) {
+			owner = "?";
+		}
+	}
+	snprintf(label, TRN_PROFILER_LABEL_MAX, "%s%s%s%s", block ? "block in " : "", owner, separator, mid != 0 ? mrb_sym2name(mrb, mid) : "<main>");
+}
+
+// index of the frame, or 0 if the table is full
+static uint32_t trn_profiler_frame(mrb_state *mrb, trn_profiler_t *prof, mrb_callinfo *ci, const mrb_code *pc) {
+	const mrb_irep *irep = MRB_PROC_CFUNC_P(ci->proc) ? NULL : ci->proc->body.irep;
+	uint32_t offset = irep != NULL && pc != NULL ? pc - irep->iseq : 0;
+	uint32_t mask = TRN_PROFILER_MAX_FRAMES * 2 - 1;
+	uint32_t bucket = trn_profiler_hash((uintptr_t) irep ^ ((uint64_t) offset << 48), ((uint64_t) ci->mid << 32) ^ (uintptr_t) ci->target_class) & mask;
+	while(prof->frame_buckets[bucket] != 0) {
+		trn_profiler_frame_t *frame = &prof->frames[prof->frame_buckets[bucket]];
+		if(frame->irep == irep && frame->pc == offset && frame->mid == ci->mid && frame->klass == ci->target_class) {
+			return prof->frame_buckets[bucket];
+		}
+		bucket = (bucket + 1) & mask;
+	}
+	if(prof->num_frames + 1 >= TRN_PROFILER_MAX_FRAMES) {
+		return 0;
+	}
+
+	// first time this position is seen; resolve its name while the irep is alive
+	char label[TRN_PROFILER_LABEL_MAX];
+	int ai = mrb_gc_arena_save(mrb);
+	trn_profiler_label(mrb, label, ci->target_class, ci->mid, irep != NULL && !MRB_PROC_STRICT_P(ci->proc));
+	mrb_gc_arena_restore(mrb, ai);
+	if(irep != NULL) {
+		const char *file = mrb_debug_get_filename((mrb_irep*) irep, offset);
+		int32_t line = mrb_debug_get_line((mrb_irep*) irep, offset);
+		if(file != NULL) {
+			size_t len = strlen(label);
+			snprintf(label + len, sizeof(label) - len, " (%s:%d)", file, line);
+		}
+	}
+	char *copy = strdup(label);
+	if(copy == NULL) {
+		return 0;
+	}
+
+	uint32_t index = ++prof->num_frames;
+	trn_profiler_frame_t *frame = &prof->frames[index];
+	frame->irep = irep;
+	frame->pc = offset;
+	frame->mid = ci->mid;
+	frame->klass = ci->target_class;
+	frame->label = copy;
+	prof->frame_buckets[bucket] = index;
+	return index;
+}
+
+// child of parent for frame, or 0 if the table is full
+static uint32_t trn_profiler_node(trn_profiler_t *prof, uint32_t parent, uint32_t frame) {
+	uint32_t mask = TRN_PROFILER_MAX_NODES * 2 - 1;
+	uint32_t bucket = trn_profiler_hash(parent, frame) & mask;
+	while(prof->node_buckets[bucket] != 0) {
+		trn_profiler_node_t *node = &prof->nodes[prof->node_buckets[bucket]];
+		if(node->parent == parent && node->frame == frame) {
+			return prof->node_buckets[bucket];
+		}
+		bucket = (bucket + 1) & mask;
+	}
+	if(prof->num_nodes + 1 >= TRN_PROFILER_MAX_NODES) {
+		return 0;
+	}
+	uint32_t index = ++prof->num_nodes;
+	prof->nodes[index].parent = parent;
+	prof->nodes[index].frame = frame;
+	prof->nodes[index].depth = prof->nodes[parent].depth + 1;
+	prof->node_buckets[bucket] = index;
+	return index;
+}
+
+static void trn_profiler_sample(mrb_state *mrb, trn_profiler_t *prof, mrb_code *pc, uint32_t weight) {
+	uint64_t tick = svcGetSystemTick();
+	if(prof->num_samples >= prof->capacity) {
+		prof->dropped++;
+		return;
+	}
+	struct mrb_context *c = mrb->c;
+	ptrdiff_t top = c->ci - c->cibase;
+	ptrdiff_t bottom = top >= TRN_PROFILER_MAX_DEPTH ? top - TRN_PROFILER_MAX_DEPTH + 1 : 0;
+	uint32_t node = 0;
+	for(ptrdiff_t i = bottom; i <= top; i++) {
+		mrb_callinfo *ci = &c->cibase[i];
+		if(ci->proc == NULL) {
+			continue;
+		}
+		// callers are at the instruction before their callee's return address
+		const mrb_code *frame_pc = pc;
+		if(i < top) {
+			frame_pc = c->cibase[i + 1].pc != NULL ? c->cibase[i + 1].pc - 1 : NULL;
+		}
+		uint32_t frame = trn_profiler_frame(mrb, prof, ci, frame_pc);
+		node = frame != 0 ? trn_profiler_node(prof, node, frame) : 0;
+		if(node == 0) {
+			prof->dropped++;
+			return;
+		}
+	}
+	trn_profiler_sample_t *sample = &prof->samples[prof->num_samples++];
+	sample->tick = tick;
+	sample->node = node;
+	sample->weight = weight;
+}
+
+static void trn_profiler_hook(struct mrb_state *mrb, struct mrb_irep *irep, mrb_code *pc, mrb_value *regs) {
+	trn_profiler_t *prof = trn_profiler_current;
+	if(prof->prev_hook != NULL) {
+		prof->prev_hook(mrb, irep, pc, regs);
+	}
+	if(__atomic_load_n(&prof->pending, __ATOMIC_RELAXED) != 0) {
+		trn_profiler_sample(mrb, prof, pc, __atomic_exchange_n(&prof->pending, 0, __ATOMIC_RELAXED));
+	}
+}
+#endif
+
+static void trn_profiler_main(void *arg) {
+	trn_profiler_t *prof = arg;
+	while(!__atomic_load_n(&prof->stopping, __ATOMIC_ACQUIRE)) {
+		svcSleepThread(prof->interval_ns);
+		__atomic_fetch_add(&prof->pending, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void trn_profiler_stop(trn_profiler_t *prof) {
+	if(!prof->running) {
+		return;
+	}
+	if(prof->interval_ns != 0) {
+		__atomic_store_n(&prof->stopping, true, __ATOMIC_RELEASE);
+		trn_thread_join(&prof->thread, -1);
+		trn_thread_destroy(&prof->thread);
+#ifdef MRB_ENABLE_DEBUG_HOOK
+		prof->mrb->code_fetch_hook = prof->prev_hook;
+#endif
+	}
+	trn_profiler_current = NULL;
+	prof->running = false;
+	prof->stop_tick = svcGetSystemTick();
+}
+
+static void mrb_trn_profiler_dfree(mrb_state *mrb, void *data) {
+	trn_profiler_t *prof = data;
+	trn_profiler_stop(prof);
+	for(uint32_t i = 1; i <= prof->num_frames; i++) {
+		free(prof->frames[i].label);
+	}
+	free(prof->frames);
+	free(prof->frame_buckets);
+	free(prof->nodes);
+	free(prof->node_buckets);
+	free(prof->samples);
+	free(prof->spans);
+	mrb_free(mrb, prof);
+}
+
+static const mrb_data_type dt_Profiler = {"Profiler", mrb_trn_profiler_dfree};
+
+static trn_profiler_t *mrb_trn_profiler_get(mrb_state *mrb, mrb_value self) {
+	return mrb_data_get_ptr(mrb, self, &dt_Profiler);
+}
+
+// new(interval_us = 1000, capacity = 0x10000); interval 0 records spans only
+static mrb_value mrb_trn_profiler_new(mrb_state *mrb, mrb_value self) {
+	mrb_int interval = TRN_PROFILER_DEFAULT_INTERVAL_US;
+	mrb_int capacity = TRN_PROFILER_DEFAULT_CAPACITY;
+	mrb_int num_args = mrb_get_args(mrb, "|ii", &interval, &capacity);
+	if(interval < 0) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "negative interval");
+	}
+	if(capacity < 1 || capacity > (1 << 24)) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid capacity");
+	}
+#ifndef MRB_ENABLE_DEBUG_HOOK
+	if(interval != 0) {
+		mrb_raise(mrb, E_NOTIMP_ERROR, "sampling needs mruby built with MRB_ENABLE_DEBUG_HOOK");
+	}
+#endif
+	trn_profiler_t *prof = mrb_calloc(mrb, sizeof(*prof), 1);
+	struct RData *data = Data_Wrap_Struct(mrb, mrb_class_ptr(self), &dt_Profiler, prof);
+	prof->mrb = mrb;
+	prof->interval_ns = (uint64_t) interval * 1000;
+	prof->capacity = capacity;
+	prof->frames = calloc(TRN_PROFILER_MAX_FRAMES, sizeof(*prof->frames));
+	prof->frame_buckets = calloc(TRN_PROFILER_MAX_FRAMES * 2, sizeof(uint32_t));
+	prof->nodes = calloc(TRN_PROFILER_MAX_NODES, sizeof(*prof->nodes));
+	prof->node_buckets = calloc(TRN_PROFILER_MAX_NODES * 2, sizeof(uint32_t));
+	prof->samples = calloc(capacity, sizeof(*prof->samples));
+	prof->spans = calloc(TRN_PROFILER_MAX_SPANS, sizeof(*prof->spans));
+	if(prof->frames == NULL || prof->frame_buckets == NULL || prof->nodes == NULL || prof->node_buckets == NULL || prof->samples == NULL || prof->spans == NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	return mrb_obj_value(data);
+}
+
+// discards anything recorded before and starts sampling this thread's interpreter
+static mrb_value mrb_trn_profiler_start(mrb_state *mrb, mrb_value self) {
+	trn_profiler_t *prof = mrb_trn_profiler_get(mrb, self);
+	if(trn_profiler_current != NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "a profiler is already running");
+	}
+	trn_profiler_reset(prof);
+	prof->pending = 0;
+	prof->stopping = false;
+	prof->start_tick = svcGetSystemTick();
+	prof->stop_tick = prof->start_tick;
+	if(prof->interval_ns != 0) {
+		result_t r = trn_thread_create(&prof->thread, trn_profiler_main, prof, -1, -2, 0x1000, NULL);
+		if(r == RESULT_OK) {
+			r = trn_thread_start(&prof->thread);
+			if(r != RESULT_OK) {
+				trn_thread_destroy(&prof->thread);
+			}
+		}
+		mrb_trn_assert_ok(mrb, r);
+#ifdef MRB_ENABLE_DEBUG_HOOK
+		prof->prev_hook = mrb->code_fetch_hook;
+		mrb->code_fetch_hook = trn_profiler_hook;
+#endif
+	}
+	trn_profiler_current = prof;
+	prof->running = true;
+	return self;
+}
+
+static mrb_value mrb_trn_profiler_stop(mrb_state *mrb, mrb_value self) {
+	trn_profiler_stop(mrb_trn_profiler_get(mrb, self));
+	return self;
+}
+
+static mrb_value mrb_trn_profiler_running_p(mrb_state *mrb, mrb_value self) {
+	return mrb_bool_value(mrb_trn_profiler_get(mrb, self)->running);
+}
+
+static mrb_value mrb_trn_profiler_mark(mrb_state *mrb, mrb_value self, bool end) {
+	trn_profiler_t *prof = mrb_trn_profiler_get(mrb, self);
+	mrb_sym name;
+	mrb_int num_args = mrb_get_args(mrb, "n", &name);
+	if(!prof->running) {
+		return mrb_nil_value();
+	}
+	if(prof->num_spans >= TRN_PROFILER_MAX_SPANS) {
+		prof->dropped++;
+		return mrb_nil_value();
+	}
+	trn_profiler_span_t *span = &prof->spans[prof->num_spans++];
+	span->tick = svcGetSystemTick();
+	span->name = name;
+	span->end = end;
+	return mrb_nil_value();
+}
+
+static mrb_value mrb_trn_profiler_begin_span(mrb_state *mrb, mrb_value self) {
+	return mrb_trn_profiler_mark(mrb, self, false);
+}
+
+static mrb_value mrb_trn_profiler_end_span(mrb_state *mrb, mrb_value self) {
+	return mrb_trn_profiler_mark(mrb, self, true);
+}
+
+static mrb_value mrb_trn_profiler_stats(mrb_state *mrb, mrb_value self) {
+	trn_profiler_t *prof = mrb_trn_profiler_get(mrb, self);
+	uint64_t weight = 0;
+	for(size_t i = 0; i < prof->num_samples; i++) {
+		weight+= prof->samples[i].weight;
+	}
+	mrb_value stats = mrb_hash_new_capa(mrb, 5);
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "samples")), mrb_fixnum_value(prof->num_samples));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "intervals")), mrb_fixnum_value(weight));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "spans")), mrb_fixnum_value(prof->num_spans));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "frames")), mrb_fixnum_value(prof->num_frames));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "dropped")), mrb_fixnum_value(prof->dropped));
+	return stats;
+}
+
+// output
+
+static FILE *trn_profiler_open(mrb_state *mrb, trn_profiler_t *prof, const char *path) {
+	if(prof->running) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "profiler is still running");
+	}
+	FILE *file = fopen(path, "w");
+	if(file == NULL) {
+		mrb_raisef(mrb, E_RUNTIME_ERROR, "could not open %S", mrb_str_new_cstr(mrb, path));
+	}
+	return file;
+}
+
+static void trn_profiler_write_path(FILE *file, trn_profiler_t *prof, uint32_t node) {
+	if(prof->nodes[node].parent != 0) {
+		trn_profiler_write_path(file, prof, prof->nodes[node].parent);
+		fputc(';', file);
+	}
+	fputs(prof->frames[prof->nodes[node].frame].label, file);
+}
+
+// write_collapsed(path): "outer;inner;leaf weight" lines for flamegraph.pl
+static mrb_value mrb_trn_profiler_write_collapsed(mrb_state *mrb, mrb_value self) {
+	trn_profiler_t *prof = mrb_trn_profiler_get(mrb, self);
+	char *path;
+	mrb_int num_args = mrb_get_args(mrb, "z", &path);
+	FILE *file = trn_profiler_open(mrb, prof, path);
+	uint64_t *weights = calloc(prof->num_nodes + 1, sizeof(uint64_t));
+	if(weights == NULL) {
+		fclose(file);
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	for(size_t i = 0; i < prof->num_samples; i++) {
+		weights[prof->samples[i].node]+= prof->samples[i].weight;
+	}
+	for(uint32_t node = 1; node <= prof->num_nodes; node++) {
+		if(weights[node] != 0) {
+			trn_profiler_write_path(file, prof, node);
+			fprintf(file, " %llu\n", (unsigned long long) weights[node]);
+		}
+	}
+	free(weights);
+	fclose(file);
+	return mrb_nil_value();
+}
+
+static void trn_profiler_write_json_string(FILE *file, const char *str) {
+	fputc('"', file);
+	for(; *str; str++) {
+		unsigned char ch = *str;
+		if(ch == '"' || ch == '\\') {
+			fputc('\\', file);
+			fputc(ch, file);
+		} else if(ch < 0x20) {
+			fprintf(file, "\\u%04x", ch);
+		} else {
+			fputc(ch, file);
+		}
+	}
+	fputc('"', file);
+}
+
+static void trn_profiler_write_event(FILE *file, trn_profiler_t *prof, const char *name, char phase, int tid, uint64_t tick) {
+	// timestamps are in microseconds
+	fprintf(file, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"name\":", phase, tid, trn_ticks_to_ns(tick - prof->start_tick) / 1000.0);
+	trn_profiler_write_json_string(file, name);
+	fputc('}', file);
+}
+
+// write_trace(path): Chrome trace_event JSON for chrome://tracing or Perfetto;
+// samples become nested slices on one track, spans on another
+static mrb_value mrb_trn_profiler_write_trace(mrb_state *mrb, mrb_value self) {
+	trn_profiler_t *prof = mrb_trn_profiler_get(mrb, self);
+	char *path;
+	mrb_int num_args = mrb_get_args(mrb, "z", &path);
+	FILE *file = trn_profiler_open(mrb, prof, path);
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+	fputs("{\"ph\":\"M\",\"pid\":1,\"tid\":1,\"name\":\"thread_name\",\"args\":{\"name\":\"samples\"}},\n", file);
+	fputs("{\"ph\":\"M\",\"pid\":1,\"tid\":2,\"name\":\"thread_name\",\"args\":{\"name\":\"spans\"}}", file);
+
+	// close the frames the previous sample had that this one doesn't, then open the new ones
+	uint32_t current = 0;
+	for(size_t i = 0; i <= prof->num_samples; i++) {
+		uint32_t next = i < prof->num_samples ? prof->samples[i].node : 0;
+		uint64_t tick = i < prof->num_samples ? prof->samples[i].tick : prof->stop_tick;
+		uint32_t opened[TRN_PROFILER_MAX_DEPTH];
+		size_t num_opened = 0;
+		uint32_t a = current, b = next;
+		while(a != b) {
+			if(prof->nodes[a].depth >= prof->nodes[b].depth) {
+				trn_profiler_write_event(file, prof, prof->frames[prof->nodes[a].frame].label, 'E', 1, tick);
+				a = prof->nodes[a].parent;
+			} else {
+				opened[num_opened++] = b;
+				b = prof->nodes[b].parent;
+			}
+		}
+		while(num_opened > 0) {
+			trn_profiler_write_event(file, prof, prof->frames[prof->nodes[opened[--num_opened]].frame].label, 'B', 1, tick);
+		}
+		current = next;
+	}
+	for(size_t i = 0; i < prof->num_spans; i++) {
+		trn_profiler_write_event(file, prof, mrb_sym2name(mrb, prof->spans[i].name), prof->spans[i].end ? 'E' : 'B', 2, prof->spans[i].tick);
+	}
+	fputs("\n]}\n", file);
+	fclose(file);
+	return mrb_nil_value();
+}
+
+void mrb_transistor_profiler_init(mrb_state *mrb) {
+	struct RClass *class_Profiler = mrb_define_class_under(mrb, mod_transistor, "Profiler", mrb->object_class);
+	MRB_SET_INSTANCE_TT(class_Profiler, MRB_TT_DATA);
+	mrb_define_class_method(mrb, class_Profiler, "new", mrb_trn_profiler_new, MRB_ARGS_ARG(0, 2));
+	mrb_define_method(mrb, class_Profiler, "start", mrb_trn_profiler_start, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Profiler, "stop", mrb_trn_profiler_stop, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Profiler, "running?", mrb_trn_profiler_running_p, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Profiler, "begin_span", mrb_trn_profiler_begin_span, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_Profiler, "end_span", mrb_trn_profiler_end_span, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_Profiler, "stats", mrb_trn_profiler_stats, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Profiler, "write_collapsed", mrb_trn_profiler_write_collapsed, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_Profiler, "write_trace", mrb_trn_profiler_write_trace, MRB_ARGS_ARG(1, 0));
+#ifdef MRB_ENABLE_DEBUG_HOOK
+	mrb_define_const(mrb, class_Profiler, "SAMPLING", mrb_true_value());
+#else
+	mrb_define_const(mrb, class_Profiler, "SAMPLING", mrb_false_value());
+#endif
+}
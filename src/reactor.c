@@ -0,0 +1,169 @@
+#include<stdint.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/array.h>
+#include<mruby/class.h>
+#include<mruby/data.h>
+#include<mruby/value.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// TRN::Reactor::WaitSet: one-shot waits on kernel handles with deadlines.
+// The fiber scheduling on top of it is in mrblib/reactor.rb.
+
+#define TRN_WAIT_SET_MAX 0x40 // svcWaitSynchronization limit
+#define TRN_WAIT_NONE UINT64_MAX
+
+#define TRN_RESULT_TIMED_OUT 0xea01
+#define TRN_RESULT_CANCELLED 0xec01
+
+typedef struct {
+	bool used;
+	handle_t handle; // 0 for plain timers
+	uint64_t deadline; // system ticks, or TRN_WAIT_NONE
+} trn_wait_entry_t;
+
+typedef struct {
+	trn_wait_entry_t entries[TRN_WAIT_SET_MAX];
+	size_t count;
+} trn_wait_set_t;
+
+static uint64_t trn_wait_deadline(mrb_int timeout) {
+	if(timeout < 0) {
+		return TRN_WAIT_NONE;
+	}
+	return svcGetSystemTick() + trn_ns_to_ticks(timeout);
+}
+
+static void mrb_trn_wait_set_dfree(mrb_state *mrb, void *data) {
+	mrb_free(mrb, data);
+}
+
+static const mrb_data_type dt_WaitSet = {"WaitSet", mrb_trn_wait_set_dfree};
+
+static trn_wait_set_t *mrb_trn_wait_set_get(mrb_state *mrb, mrb_value self) {
+	return mrb_data_get_ptr(mrb, self, &dt_WaitSet);
+}
+
+static mrb_value mrb_trn_wait_set_new(mrb_state *mrb, mrb_value self) {
+	trn_wait_set_t *set = mrb_calloc(mrb, sizeof(*set), 1);
+	return mrb_obj_value(Data_Wrap_Struct(mrb, mrb_class_ptr(self), &dt_WaitSet, set));
+}
+
+// add(handle, timeout_ns = -1) -> slot; handle 0 waits for the timeout only
+static mrb_value mrb_trn_wait_set_add(mrb_state *mrb, mrb_value self) {
+	trn_wait_set_t *set = mrb_trn_wait_set_get(mrb, self);
+	mrb_int handle;
+	mrb_int timeout = -1;
+	mrb_int num_args = mrb_get_args(mrb, "i|i", &handle, &timeout);
+	if(handle == 0 && timeout < 0) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "a timer needs a timeout");
+	}
+	for(size_t i = 0; i < TRN_WAIT_SET_MAX; i++) {
+		trn_wait_entry_t *entry = &set->entries[i];
+		if(!entry->used) {
+			entry->used = true;
+			entry->handle = handle;
+			entry->deadline = trn_wait_deadline(timeout);
+			set->count++;
+			return mrb_fixnum_value(i);
+		}
+	}
+	mrb_raise(mrb, E_RUNTIME_ERROR, "wait set is full");
+}
+
+static mrb_value mrb_trn_wait_set_remove(mrb_state *mrb, mrb_value self) {
+	trn_wait_set_t *set = mrb_trn_wait_set_get(mrb, self);
+	mrb_int slot;
+	mrb_int num_args = mrb_get_args(mrb, "i", &slot);
+	if(slot >= 0 && slot < TRN_WAIT_SET_MAX && set->entries[slot].used) {
+		set->entries[slot].used = false;
+		set->count--;
+	}
+	return mrb_nil_value();
+}
+
+static mrb_value mrb_trn_wait_set_size(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(mrb_trn_wait_set_get(mrb, self)->count);
+}
+
+static void mrb_trn_wait_set_fire(mrb_state *mrb, trn_wait_set_t *set, mrb_value ready, size_t slot, bool signalled) {
+	set->entries[slot].used = false;
+	set->count--;
+	mrb_value pair = mrb_ary_new_capa(mrb, 2);
+	mrb_ary_push(mrb, pair, mrb_fixnum_value(slot));
+	mrb_ary_push(mrb, pair, mrb_bool_value(signalled));
+	mrb_ary_push(mrb, ready, pair);
+}
+
+// wait(timeout_ns = -1) -> [[slot, signalled], ...]
+// blocks until a handle is signalled, a deadline passes or the timeout runs
+// out; entries that fire are removed
+static mrb_value mrb_trn_wait_set_wait(mrb_state *mrb, mrb_value self) {
+	trn_wait_set_t *set = mrb_trn_wait_set_get(mrb, self);
+	mrb_int timeout = -1;
+	mrb_int num_args = mrb_get_args(mrb, "|i", &timeout);
+
+	handle_t handles[TRN_WAIT_SET_MAX];
+	uint8_t slots[TRN_WAIT_SET_MAX];
+	uint32_t num_handles = 0;
+	uint64_t deadline = trn_wait_deadline(timeout);
+	for(size_t i = 0; i < TRN_WAIT_SET_MAX; i++) {
+		trn_wait_entry_t *entry = &set->entries[i];
+		if(!entry->used) {
+			continue;
+		}
+		if(entry->handle != 0) {
+			handles[num_handles] = entry->handle;
+			slots[num_handles] = i;
+			num_handles++;
+		}
+		if(entry->deadline < deadline) {
+			deadline = entry->deadline;
+		}
+	}
+
+	mrb_value ready = mrb_ary_new(mrb);
+	if(num_handles == 0 && deadline == TRN_WAIT_NONE) {
+		return ready; // would never wake up
+	}
+
+	uint64_t now = svcGetSystemTick();
+	uint64_t wait_ns = deadline == TRN_WAIT_NONE ? UINT64_MAX : deadline > now ? trn_ticks_to_ns(deadline - now) : 0;
+	if(num_handles == 0) {
+		if(wait_ns > 0) {
+			svcSleepThread(wait_ns);
+		}
+	} else {
+		uint32_t index;
+		result_t r = svcWaitSynchronization(&index, handles, num_handles, wait_ns);
+		if(r == RESULT_OK) {
+			mrb_trn_wait_set_fire(mrb, set, ready, slots[index], true);
+		} else if(r != TRN_RESULT_TIMED_OUT && r != TRN_RESULT_CANCELLED) {
+			mrb_trn_assert_ok(mrb, r);
+		}
+	}
+
+	now = svcGetSystemTick();
+	for(size_t i = 0; i < TRN_WAIT_SET_MAX; i++) {
+		trn_wait_entry_t *entry = &set->entries[i];
+		if(entry->used && entry->deadline <= now) {
+			mrb_trn_wait_set_fire(mrb, set, ready, i, false);
+		}
+	}
+	return ready;
+}
+
+void mrb_transistor_reactor_init(mrb_state *mrb) {
+	struct RClass *class_Reactor = mrb_define_class_under(mrb, mod_transistor, "Reactor", mrb->object_class);
+	struct RClass *class_WaitSet = mrb_define_class_under(mrb, class_Reactor, "WaitSet", mrb->object_class);
+	mrb_define_class_method(mrb, class_WaitSet, "new", mrb_trn_wait_set_new, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_WaitSet, "add", mrb_trn_wait_set_add, MRB_ARGS_ARG(1, 1));
+	mrb_define_method(mrb, class_WaitSet, "remove", mrb_trn_wait_set_remove, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_WaitSet, "size", mrb_trn_wait_set_size, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_WaitSet, "wait", mrb_trn_wait_set_wait, MRB_ARGS_ARG(0, 1));
+	mrb_define_const(mrb, class_WaitSet, "MAX", mrb_fixnum_value(TRN_WAIT_SET_MAX));
+}
@@ -0,0 +1,391 @@
+#include<stdint.h>
+#include<stdio.h>
+#include<string.h>
+#include<malloc.h>
+
+#include<mruby.h>
+#include<mruby/array.h>
+#include<mruby/hash.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// TRN::IPC::Recorder: every request sent through mrb_trn_ipc_send while
+// recording is copied into a fixed-size record in a preallocated ring.
+// Senders claim slots with a CAS and never block; when the ring is full the
+// record is dropped and counted. A flusher thread numbers runs of finished
+// records, leaving a gap in seq for every drop, and writes them to the file.
+// tools/ipc_decode.rb reads the format on the host.
+
+#define TRN_RECORD_MAGIC "TRNIPCR1"
+#define TRN_RECORD_SIZE 0x200
+#define TRN_RECORD_RAW_MAX 0xd0
+#define TRN_RECORD_HANDLES_MAX 8
+#define TRN_RECORD_FLAG_PID 1
+#define TRN_RECORDER_FLUSH_NS 1000000
+#define TRN_RECORDER_DEFAULT_CAPACITY 4096
+#define TRN_RECORDER_FILE_BUFFER 0x10000
+
+typedef struct {
+	char magic[8];
+	uint32_t record_size;
+	uint32_t raw_max;
+	uint64_t ticks_per_second;
+} trn_ipc_record_header_t;
+
+typedef struct {
+	uint64_t seq; // 1-based position among all sends while recording; gaps are dropped records
+	uint64_t start; // system ticks around the send
+	uint64_t end;
+	uint64_t service; // packed sm name, as in TRN::IPC.stats; 0 if unknown
+	uint32_t session;
+	int32_t object_id;
+	uint32_t type;
+	uint32_t command_id;
+	uint32_t result;
+	uint16_t rq_raw_size; // full sizes; only TRN_RECORD_RAW_MAX bytes of each are kept
+	uint16_t rs_raw_size;
+	uint8_t rq_num_copy_handles;
+	uint8_t rq_num_move_handles;
+	uint8_t rq_num_objects;
+	uint8_t rq_num_buffers;
+	uint8_t rs_num_copy_handles;
+	uint8_t rs_num_move_handles;
+	uint8_t rs_num_objects;
+	uint8_t flags;
+	uint32_t handles[TRN_RECORD_HANDLES_MAX]; // rq copy, rq move, rs copy, rs move; as many as fit
+	uint8_t rq_raw[TRN_RECORD_RAW_MAX];
+	uint8_t rs_raw[TRN_RECORD_RAW_MAX];
+} trn_ipc_record_t;
+
+_Static_assert(sizeof(trn_ipc_record_t) == TRN_RECORD_SIZE, "records are fixed-size");
+
+typedef struct {
+	trn_ipc_record_t *ring;
+	uint64_t *turns; // per slot: its position while free to claim, position + 1 once filled
+	uint64_t mask;
+	uint64_t head __attribute__((aligned(64))); // next position to claim
+	uint64_t tail __attribute__((aligned(64))); // next position to flush; flusher only
+	uint64_t numbered; // seq of the last record written; flusher only
+	uint64_t dropped;
+	uint64_t unreported; // drops not yet carried by a claimed record
+	uint64_t written;
+	bool stopping;
+	FILE *file;
+	char *file_buffer;
+	trn_thread_t thread;
+} trn_ipc_recorder_t;
+
+bool trn_ipc_recording;
+static trn_ipc_recorder_t *trn_ipc_recorder;
+static uint64_t trn_ipc_recorder_writers;
+
+static void trn_ipc_record_fill(trn_ipc_record_t *record, trn_ipc_object_t *obj, ipc_request_t *rq, ipc_response_fmt_t *rs, result_t r, uint64_t start, uint64_t end) {
+	record->start = start;
+	record->end = end;
+	record->service = obj->service_label;
+	record->session = obj->object.session;
+	record->object_id = obj->object.object_id;
+	record->type = rq->type;
+	record->command_id = rq->request_id;
+	record->result = r;
+	record->rq_raw_size = rq->raw_data_size;
+	record->rs_raw_size = rs->raw_data_size;
+	record->rq_num_copy_handles = rq->num_copy_handles;
+	record->rq_num_move_handles = rq->num_move_handles;
+	record->rq_num_objects = rq->num_objects;
+	record->rq_num_buffers = rq->num_buffers;
+	record->rs_num_copy_handles = rs->num_copy_handles;
+	record->rs_num_move_handles = rs->num_move_handles;
+	record->rs_num_objects = rs->num_objects;
+	record->flags = rq->send_pid ? TRN_RECORD_FLAG_PID : 0;
+
+	size_t h = 0;
+	for(uint32_t i = 0; i < rq->num_copy_handles && h < TRN_RECORD_HANDLES_MAX; i++) {
+		record->handles[h++] = rq->copy_handles[i];
+	}
+	for(uint32_t i = 0; i < rq->num_move_handles && h < TRN_RECORD_HANDLES_MAX; i++) {
+		record->handles[h++] = rq->move_handles[i];
+	}
+	for(uint32_t i = 0; r == RESULT_OK && i < rs->num_copy_handles && h < TRN_RECORD_HANDLES_MAX; i++) {
+		record->handles[h++] = rs->copy_handles[i];
+	}
+	for(uint32_t i = 0; r == RESULT_OK && i < rs->num_move_handles && h < TRN_RECORD_HANDLES_MAX; i++) {
+		record->handles[h++] = rs->move_handles[i];
+	}
+	memset(record->handles + h, 0, (TRN_RECORD_HANDLES_MAX - h) * sizeof(record->handles[0]));
+
+	size_t rq_size = rq->raw_data_size < TRN_RECORD_RAW_MAX ? rq->raw_data_size : TRN_RECORD_RAW_MAX;
+	size_t rs_size = rs->raw_data_size < TRN_RECORD_RAW_MAX ? rs->raw_data_size : TRN_RECORD_RAW_MAX;
+	memcpy(record->rq_raw, rq->raw_data, rq_size);
+	memset(record->rq_raw + rq_size, 0, TRN_RECORD_RAW_MAX - rq_size);
+	if(r == RESULT_OK) {
+		memcpy(record->rs_raw, rs->raw_data, rs_size);
+	} else {
+		rs_size = 0;
+	}
+	memset(record->rs_raw + rs_size, 0, TRN_RECORD_RAW_MAX - rs_size);
+}
+
+void mrb_trn_ipc_recorder_record(trn_ipc_object_t *obj, ipc_request_t *rq, ipc_response_fmt_t *rs, result_t r, uint64_t start, uint64_t end) {
+	__atomic_fetch_add(&trn_ipc_recorder_writers, 1, __ATOMIC_SEQ_CST);
+	trn_ipc_recorder_t *rec = __atomic_load_n(&trn_ipc_recorder, __ATOMIC_SEQ_CST);
+	if(rec != NULL) {
+		uint64_t pos = __atomic_load_n(&rec->head, __ATOMIC_RELAXED);
+		trn_ipc_record_t *record;
+		while(true) {
+			record = &rec->ring[pos & rec->mask];
+			uint64_t turn = __atomic_load_n(&rec->turns[pos & rec->mask], __ATOMIC_ACQUIRE);
+			if(turn == pos) {
+				if(__atomic_compare_exchange_n(&rec->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					break;
+				}
+			} else if(turn < pos) {
+				// the flusher hasn't caught up
+				__atomic_fetch_add(&rec->dropped, 1, __ATOMIC_RELAXED);
+				__atomic_fetch_add(&rec->unreported, 1, __ATOMIC_RELAXED);
+				record = NULL;
+				break;
+			} else {
+				pos = __atomic_load_n(&rec->head, __ATOMIC_RELAXED);
+			}
+		}
+		if(record != NULL) {
+			// seq holds the drops since the previous record until the flusher numbers it
+			record->seq = __atomic_exchange_n(&rec->unreported, 0, __ATOMIC_RELAXED);
+			trn_ipc_record_fill(record, obj, rq, rs, r, start, end);
+			__atomic_store_n(&rec->turns[pos & rec->mask], pos + 1, __ATOMIC_RELEASE);
+		}
+	}
+	__atomic_fetch_sub(&trn_ipc_recorder_writers, 1, __ATOMIC_RELEASE);
+}
+
+// writes the finished records at the tail, up to the end of the ring, in one go
+static size_t trn_ipc_recorder_drain(trn_ipc_recorder_t *rec) {
+	uint64_t tail = rec->tail;
+	uint64_t capacity = rec->mask + 1;
+	size_t count = 0;
+	size_t contiguous = capacity - (tail & rec->mask);
+	while(count < contiguous &&
+	      __atomic_load_n(&rec->turns[(tail + count) & rec->mask], __ATOMIC_ACQUIRE) == tail + count + 1) {
+		trn_ipc_record_t *record = &rec->ring[(tail + count) & rec->mask];
+		rec->numbered+= record->seq + 1;
+		record->seq = rec->numbered;
+		count++;
+	}
+	if(count == 0) {
+		return 0;
+	}
+	fwrite(&rec->ring[tail & rec->mask], TRN_RECORD_SIZE, count, rec->file);
+	for(size_t i = 0; i < count; i++) {
+		__atomic_store_n(&rec->turns[(tail + i) & rec->mask], tail + i + capacity, __ATOMIC_RELEASE);
+	}
+	rec->tail = tail + count;
+	__atomic_fetch_add(&rec->written, count, __ATOMIC_RELAXED);
+	return count;
+}
+
+static void trn_ipc_recorder_main(void *arg) {
+	trn_ipc_recorder_t *rec = arg;
+	while(true) {
+		bool stopping = __atomic_load_n(&rec->stopping, __ATOMIC_ACQUIRE);
+		if(trn_ipc_recorder_drain(rec) > 0) {
+			continue;
+		}
+		if(stopping) {
+			break;
+		}
+		// stdio batches these into TRN_RECORDER_FILE_BUFFER sized writes
+		svcSleepThread(TRN_RECORDER_FLUSH_NS);
+	}
+	fflush(rec->file);
+}
+
+static void trn_ipc_recorder_free(trn_ipc_recorder_t *rec) {
+	if(rec->file) {
+		fclose(rec->file);
+	}
+	free(rec->file_buffer);
+	free(rec->turns);
+	free(rec->ring);
+	free(rec);
+}
+
+static mrb_value mrb_trn_ipc_recorder_stats_hash(mrb_state *mrb, uint64_t records, uint64_t written, uint64_t dropped) {
+	mrb_value stats = mrb_hash_new_capa(mrb, 3);
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "records")), mrb_fixnum_value(records));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "written")), mrb_fixnum_value(written));
+	mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "dropped")), mrb_fixnum_value(dropped));
+	return stats;
+}
+
+// start(path, capacity = 4096); capacity is in records and rounded up to a power of two
+static mrb_value mrb_trn_ipc_recorder_start(mrb_state *mrb, mrb_value self) {
+	char *path;
+	mrb_int capacity = TRN_RECORDER_DEFAULT_CAPACITY;
+	mrb_int num_args = mrb_get_args(mrb, "z|i", &path, &capacity);
+	if(capacity < 2 || capacity > (1 << 20)) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid capacity");
+	}
+	if(__atomic_load_n(&trn_ipc_recorder, __ATOMIC_ACQUIRE) != NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "already recording");
+	}
+	uint64_t size = 1;
+	while(size < (uint64_t) capacity) {
+		size<<= 1;
+	}
+
+	trn_ipc_recorder_t *rec = memalign(64, sizeof(*rec));
+	if(rec == NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	memset(rec, 0, sizeof(*rec));
+	rec->mask = size - 1;
+	rec->ring = memalign(64, size * TRN_RECORD_SIZE);
+	rec->turns = malloc(size * sizeof(rec->turns[0]));
+	rec->file_buffer = malloc(TRN_RECORDER_FILE_BUFFER);
+	if(rec->ring == NULL || rec->turns == NULL || rec->file_buffer == NULL) {
+		trn_ipc_recorder_free(rec);
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	for(uint64_t i = 0; i < size; i++) {
+		rec->turns[i] = i;
+	}
+	rec->file = fopen(path, "wb");
+	if(rec->file == NULL) {
+		trn_ipc_recorder_free(rec);
+		mrb_raisef(mrb, E_RUNTIME_ERROR, "could not open %S", mrb_str_new_cstr(mrb, path));
+	}
+	setvbuf(rec->file, rec->file_buffer, _IOFBF, TRN_RECORDER_FILE_BUFFER);
+	trn_ipc_record_header_t header = {TRN_RECORD_MAGIC, TRN_RECORD_SIZE, TRN_RECORD_RAW_MAX, TRN_TICKS_PER_SECOND};
+	fwrite(&header, sizeof(header), 1, rec->file);
+
+	result_t r = trn_thread_create(&rec->thread, trn_ipc_recorder_main, rec, -1, -2, 0x4000, NULL);
+	if(r == RESULT_OK) {
+		r = trn_thread_start(&rec->thread);
+		if(r != RESULT_OK) {
+			trn_thread_destroy(&rec->thread);
+		}
+	}
+	if(r != RESULT_OK) {
+		trn_ipc_recorder_free(rec);
+		mrb_trn_assert_ok(mrb, r);
+	}
+	__atomic_store_n(&trn_ipc_recorder, rec, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&trn_ipc_recording, true, __ATOMIC_RELEASE);
+	return mrb_nil_value();
+}
+
+// waits for in-flight senders, flushes what's left and closes the file
+static mrb_value mrb_trn_ipc_recorder_stop(mrb_state *mrb, mrb_value self) {
+	trn_ipc_recorder_t *rec = __atomic_exchange_n(&trn_ipc_recorder, NULL, __ATOMIC_SEQ_CST);
+	if(rec == NULL) {
+		return mrb_nil_value();
+	}
+	__atomic_store_n(&trn_ipc_recording, false, __ATOMIC_RELEASE);
+	while(__atomic_load_n(&trn_ipc_recorder_writers, __ATOMIC_SEQ_CST) != 0) {
+	}
+	__atomic_store_n(&rec->stopping, true, __ATOMIC_RELEASE);
+	trn_thread_join(&rec->thread, -1);
+	trn_thread_destroy(&rec->thread);
+	mrb_value stats = mrb_trn_ipc_recorder_stats_hash(mrb, rec->head, rec->written, rec->dropped);
+	trn_ipc_recorder_free(rec);
+	return stats;
+}
+
+static mrb_value mrb_trn_ipc_recorder_recording_p(mrb_state *mrb, mrb_value self) {
+	return mrb_bool_value(__atomic_load_n(&trn_ipc_recording, __ATOMIC_ACQUIRE));
+}
+
+static mrb_value mrb_trn_ipc_recorder_stats(mrb_state *mrb, mrb_value self) {
+	// counts as a writer so stop on another thread can't free the recorder under us
+	__atomic_fetch_add(&trn_ipc_recorder_writers, 1, __ATOMIC_SEQ_CST);
+	trn_ipc_recorder_t *rec = __atomic_load_n(&trn_ipc_recorder, __ATOMIC_SEQ_CST);
+	uint64_t records = 0, written = 0, dropped = 0;
+	if(rec != NULL) {
+		records = __atomic_load_n(&rec->head, __ATOMIC_RELAXED);
+		written = __atomic_load_n(&rec->written, __ATOMIC_RELAXED);
+		dropped = __atomic_load_n(&rec->dropped, __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_sub(&trn_ipc_recorder_writers, 1, __ATOMIC_RELEASE);
+	return rec ? mrb_trn_ipc_recorder_stats_hash(mrb, records, written, dropped) : mrb_nil_value();
+}
+
+static mrb_value mrb_trn_ipc_record_handles(mrb_state *mrb, const trn_ipc_record_t *record, size_t *h, size_t count) {
+	mrb_value handles = mrb_ary_new_capa(mrb, count);
+	for(size_t i = 0; i < count && *h < TRN_RECORD_HANDLES_MAX; i++) {
+		mrb_ary_push(mrb, handles, mrb_fixnum_value(record->handles[(*h)++]));
+	}
+	return handles;
+}
+
+#define RECORD_SET(key, value) mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, key)), value)
+
+static mrb_value mrb_trn_ipc_record_to_h(mrb_state *mrb, const trn_ipc_record_t *record) {
+	mrb_value hash = mrb_hash_new_capa(mrb, 20);
+	char service[9] = {0};
+	memcpy(service, &record->service, 8);
+	size_t h = 0;
+	RECORD_SET("seq", mrb_fixnum_value(record->seq));
+	RECORD_SET("start", mrb_fixnum_value(record->start));
+	RECORD_SET("end", mrb_fixnum_value(record->end));
+	RECORD_SET("service", record->service ? mrb_str_new_cstr(mrb, service) : mrb_nil_value());
+	RECORD_SET("session", mrb_fixnum_value(record->session));
+	RECORD_SET("object_id", mrb_fixnum_value(record->object_id));
+	RECORD_SET("type", mrb_fixnum_value(record->type));
+	RECORD_SET("command_id", mrb_fixnum_value(record->command_id));
+	RECORD_SET("result", mrb_fixnum_value(record->result));
+	RECORD_SET("pid", mrb_bool_value(record->flags & TRN_RECORD_FLAG_PID));
+	RECORD_SET("buffers", mrb_fixnum_value(record->rq_num_buffers));
+	RECORD_SET("objects", mrb_fixnum_value(record->rq_num_objects));
+	RECORD_SET("copy_handles", mrb_trn_ipc_record_handles(mrb, record, &h, record->rq_num_copy_handles));
+	RECORD_SET("move_handles", mrb_trn_ipc_record_handles(mrb, record, &h, record->rq_num_move_handles));
+	RECORD_SET("request", mrb_str_new(mrb, (const char*) record->rq_raw, record->rq_raw_size < TRN_RECORD_RAW_MAX ? record->rq_raw_size : TRN_RECORD_RAW_MAX));
+	RECORD_SET("request_size", mrb_fixnum_value(record->rq_raw_size));
+	RECORD_SET("response", mrb_str_new(mrb, (const char*) record->rs_raw, record->rs_raw_size < TRN_RECORD_RAW_MAX ? record->rs_raw_size : TRN_RECORD_RAW_MAX));
+	RECORD_SET("response_size", mrb_fixnum_value(record->rs_raw_size));
+	RECORD_SET("response_objects", mrb_fixnum_value(record->rs_num_objects));
+	if(record->result == RESULT_OK) {
+		RECORD_SET("response_copy_handles", mrb_trn_ipc_record_handles(mrb, record, &h, record->rs_num_copy_handles));
+		RECORD_SET("response_move_handles", mrb_trn_ipc_record_handles(mrb, record, &h, record->rs_num_move_handles));
+	}
+	return hash;
+}
+
+// load(path) -> [record hash, ...]
+static mrb_value mrb_trn_ipc_recorder_load(mrb_state *mrb, mrb_value self) {
+	char *path;
+	mrb_int num_args = mrb_get_args(mrb, "z", &path);
+	FILE *file = fopen(path, "rb");
+	if(file == NULL) {
+		mrb_raisef(mrb, E_RUNTIME_ERROR, "could not open %S", mrb_str_new_cstr(mrb, path));
+	}
+	trn_ipc_record_header_t header;
+	if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRN_RECORD_MAGIC, 8) != 0 ||
+	   header.record_size != TRN_RECORD_SIZE || header.raw_max != TRN_RECORD_RAW_MAX) {
+		fclose(file);
+		mrb_raise(mrb, E_RUNTIME_ERROR, "not an IPC recording");
+	}
+	mrb_value records = mrb_ary_new(mrb);
+	int ai = mrb_gc_arena_save(mrb);
+	trn_ipc_record_t record;
+	while(fread(&record, sizeof(record), 1, file) == 1) {
+		mrb_ary_push(mrb, records, mrb_trn_ipc_record_to_h(mrb, &record));
+		mrb_gc_arena_restore(mrb, ai);
+	}
+	fclose(file);
+	return records;
+}
+
+void mrb_transistor_recorder_init(mrb_state *mrb) {
+	struct RClass *mod_recorder = mrb_define_module_under(mrb, mod_transistor_ipc, "Recorder");
+	mrb_define_class_method(mrb, mod_recorder, "start", mrb_trn_ipc_recorder_start, MRB_ARGS_ARG(1, 1));
+	mrb_define_class_method(mrb, mod_recorder, "stop", mrb_trn_ipc_recorder_stop, MRB_ARGS_ARG(0, 0));
+	mrb_define_class_method(mrb, mod_recorder, "recording?", mrb_trn_ipc_recorder_recording_p, MRB_ARGS_ARG(0, 0));
+	mrb_define_class_method(mrb, mod_recorder, "stats", mrb_trn_ipc_recorder_stats, MRB_ARGS_ARG(0, 0));
+	mrb_define_class_method(mrb, mod_recorder, "load", mrb_trn_ipc_recorder_load, MRB_ARGS_ARG(1, 0));
+	mrb_define_const(mrb, mod_recorder, "RAW_MAX", mrb_fixnum_value(TRN_RECORD_RAW_MAX));
+}
@@ -0,0 +1,700 @@
+#include<stdint.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/array.h>
+#include<mruby/class.h>
+#include<mruby/data.h>
+#include<mruby/error.h>
+#include<mruby/hash.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// Hosts IPC services: a wait loop over a port and its sessions built on
+// svcReplyAndReceive, with requests decoded through compiled Message
+// layouts and dispatched to Ruby handler methods.
+
+#define TRN_SERVER_MAX_HANDLES 0x40
+#define TRN_SERVER_MESSAGE_SIZE 0x100
+
+#define TRN_SERVER_MAX_DESCRIPTORS 0x10
+#define TRN_SERVER_MAX_HANDLE_DESCRIPTORS 0xf // counts are 4-bit fields in the handle descriptor
+
+#define KERNEL_RESULT_TIMED_OUT 0xea01
+#define KERNEL_RESULT_SESSION_CLOSED 0xf601
+
+#define SFCI_MAGIC 0x49434653
+#define SFCO_MAGIC 0x4f434653
+
+typedef struct {
+	handle_t handle;
+	uint32_t message[TRN_SERVER_MESSAGE_SIZE / sizeof(uint32_t)];
+} trn_server_session_t;
+
+typedef struct {
+	uint32_t id;
+	mrb_sym method;
+	message_format_t *fmt;
+} trn_server_command_t;
+
+typedef struct {
+	port_h port; // 0 if sessions are only added by hand
+	size_t num_sessions;
+	trn_server_session_t *sessions[TRN_SERVER_MAX_HANDLES];
+	handle_t handles[TRN_SERVER_MAX_HANDLES]; // port first, then sessions
+	int reply_index; // session with a pending reply, or -1
+
+	size_t num_commands;
+	trn_server_command_t *commands;
+} trn_server_t;
+
+typedef struct {
+	uint64_t addr;
+	uint64_t size;
+} trn_server_descriptor_t;
+
+typedef struct {
+	uint32_t type;
+	uint32_t num_x, num_a, num_b;
+	trn_server_descriptor_t x[TRN_SERVER_MAX_DESCRIPTORS];
+	trn_server_descriptor_t a[TRN_SERVER_MAX_DESCRIPTORS];
+	trn_server_descriptor_t b[TRN_SERVER_MAX_DESCRIPTORS];
+	bool has_pid;
+	uint64_t pid;
+	uint32_t num_copy_handles, num_move_handles;
+	handle_t copy_handles[TRN_SERVER_MAX_HANDLE_DESCRIPTORS];
+	handle_t move_handles[TRN_SERVER_MAX_HANDLE_DESCRIPTORS];
+	uint64_t command_id;
+	uint8_t *raw; // parameters following the SFCI header
+	size_t raw_size;
+} trn_server_request_t;
+
+static __thread struct RClass *class_ipc_Server;
+
+static size_t mrb_trn_server_handle_base(trn_server_t *server) {
+	return server->port ? 1 : 0;
+}
+
+static void mrb_trn_server_remove_session(mrb_state *mrb, trn_server_t *server, size_t index) {
+	trn_server_session_t *session = server->sessions[index];
+	svcCloseHandle(session->handle);
+	mrb_free(mrb, session);
+
+	size_t base = mrb_trn_server_handle_base(server);
+	server->num_sessions--;
+	for(size_t i = index; i < server->num_sessions; i++) {
+		server->sessions[i] = server->sessions[i + 1];
+		server->handles[base + i] = server->handles[base + i + 1];
+	}
+	if(server->reply_index == (int) index) {
+		server->reply_index = -1;
+	} else if(server->reply_index > (int) index) {
+		server->reply_index--;
+	}
+}
+
+static void mrb_trn_server_add_session(mrb_state *mrb, trn_server_t *server, handle_t handle) {
+	size_t base = mrb_trn_server_handle_base(server);
+	if(base + server->num_sessions >= TRN_SERVER_MAX_HANDLES) {
+		svcCloseHandle(handle);
+		mrb_raise(mrb, E_RUNTIME_ERROR, "too many sessions");
+	}
+	trn_server_session_t *session = mrb_calloc(mrb, sizeof(*session), 1);
+	session->handle = handle;
+	server->sessions[server->num_sessions] = session;
+	server->handles[base + server->num_sessions] = handle;
+	server->num_sessions++;
+}
+
+static void mrb_trn_server_dfree(mrb_state *mrb, void *data) {
+	trn_server_t *server = data;
+	if(!server) {
+		return;
+	}
+	while(server->num_sessions > 0) {
+		mrb_trn_server_remove_session(mrb, server, server->num_sessions - 1);
+	}
+	if(server->port) {
+		svcCloseHandle(server->port);
+	}
+	mrb_free(mrb, server->commands);
+	mrb_free(mrb, server);
+}
+
+static const mrb_data_type dt_ipc_Server = {"Server", mrb_trn_server_dfree};
+
+static trn_server_t *mrb_trn_server_get(mrb_state *mrb, mrb_value self) {
+	trn_server_t *server = mrb_data_get_ptr(mrb, self, &dt_ipc_Server);
+	if(!server) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "server is closed");
+	}
+	return server;
+}
+
+static bool mrb_trn_server_parse(uint32_t *message, trn_server_request_t *rq) {
+	uint32_t *end = message + (TRN_SERVER_MESSAGE_SIZE / sizeof(uint32_t));
+	uint32_t *h = message;
+	// every count below comes from the client; each is checked against the
+	// words left in the buffer before anything it covers is read
+	rq->type = h[0] & 0xffff;
+	rq->num_x = (h[0] >> 16) & 0xf;
+	rq->num_a = (h[0] >> 20) & 0xf;
+	rq->num_b = (h[0] >> 24) & 0xf;
+	uint32_t num_w = (h[0] >> 28) & 0xf;
+	uint32_t raw_words = h[1] & 0x3ff;
+	bool has_handle_descriptor = h[1] >> 31;
+	h+= 2;
+
+	rq->has_pid = false;
+	rq->num_copy_handles = 0;
+	rq->num_move_handles = 0;
+	if(has_handle_descriptor) {
+		uint32_t hd = *h++;
+		rq->has_pid = hd & 1;
+		rq->num_copy_handles = (hd >> 1) & 0xf;
+		rq->num_move_handles = (hd >> 5) & 0xf;
+		size_t words = (rq->has_pid ? 2 : 0) + rq->num_copy_handles + rq->num_move_handles;
+		if(words > (size_t) (end - h)) {
+			return false;
+		}
+		if(rq->has_pid) {
+			rq->pid = h[0] | ((uint64_t) h[1] << 32);
+			h+= 2;
+		}
+		for(uint32_t i = 0; i < rq->num_copy_handles; i++) {
+			rq->copy_handles[i] = *h++;
+		}
+		for(uint32_t i = 0; i < rq->num_move_handles; i++) {
+			rq->move_handles[i] = *h++;
+		}
+	}
+
+	if(rq->num_x * 2 + (rq->num_a + rq->num_b + num_w) * 3 > (size_t) (end - h)) {
+		return false;
+	}
+	for(uint32_t i = 0; i < rq->num_x; i++, h+= 2) {
+		rq->x[i].addr = h[1] | ((uint64_t) ((h[0] >> 12) & 0xf) << 32) | ((uint64_t) ((h[0] >> 6) & 0x7) << 36);
+		rq->x[i].size = h[0] >> 16;
+	}
+	for(uint32_t i = 0; i < rq->num_a + rq->num_b + num_w; i++, h+= 3) {
+		if(i >= rq->num_a + rq->num_b) {
+			continue; // exchange buffers are not supported
+		}
+		trn_server_descriptor_t *d = i < rq->num_a ? &rq->a[i] : &rq->b[i - rq->num_a];
+		d->addr = h[1] | ((uint64_t) ((h[2] >> 28) & 0xf) << 32) | ((uint64_t) ((h[2] >> 2) & 0x7) << 36);
+		d->size = h[0] | ((uint64_t) ((h[2] >> 24) & 0xf) << 32);
+	}
+
+	// raw data is 16-byte aligned relative to the start of the message
+	uint8_t *raw = (uint8_t*) message + ((((uint8_t*) h - (uint8_t*) message) + 15) & ~15);
+	size_t raw_size = raw_words * sizeof(uint32_t);
+	if(raw_size < 0x20 || raw + 0x10 > (uint8_t*) end) {
+		// too small to hold the padding and an SFCI header
+		rq->raw = NULL;
+		rq->raw_size = 0;
+		rq->command_id = 0;
+		return rq->type == 2; // close carries no raw data
+	}
+	if(((uint32_t*) raw)[0] != SFCI_MAGIC) {
+		return false;
+	}
+	rq->command_id = ((uint32_t*) raw)[2] | ((uint64_t) ((uint32_t*) raw)[3] << 32);
+	rq->raw = raw + 0x10;
+	rq->raw_size = raw_size - 0x20; // minus alignment padding and the SFCI header
+	if(rq->raw + rq->raw_size > (uint8_t*) end) {
+		rq->raw_size = (uint8_t*) end - rq->raw;
+	}
+	return true;
+}
+
+// writes a response into message; data may be NULL for an empty body
+static bool mrb_trn_server_pack_reply(uint32_t *message, result_t result, const uint8_t *data, size_t data_size,
+                                      const handle_t *copy_handles, size_t num_copy_handles,
+                                      const handle_t *move_handles, size_t num_move_handles) {
+	size_t num_handles = num_copy_handles + num_move_handles;
+	if(num_copy_handles > TRN_SERVER_MAX_HANDLE_DESCRIPTORS || num_move_handles > TRN_SERVER_MAX_HANDLE_DESCRIPTORS) {
+		return false;
+	}
+	uint32_t *h = message;
+	h[0] = 0;
+	h[1] = (0x10 + 0x10 + data_size + 3) / 4;
+	if(num_handles > 0) {
+		h[1]|= 0x80000000;
+	}
+	h+= 2;
+	if(num_handles > 0) {
+		*h++ = (num_copy_handles << 1) | (num_move_handles << 5);
+		for(size_t i = 0; i < num_copy_handles; i++) {
+			*h++ = copy_handles[i];
+		}
+		for(size_t i = 0; i < num_move_handles; i++) {
+			*h++ = move_handles[i];
+		}
+	}
+	uint32_t *raw = (uint32_t*) ((uint8_t*) message + ((((uint8_t*) h - (uint8_t*) message) + 15) & ~15));
+	if((uint8_t*) raw + 0x10 + data_size > (uint8_t*) message + TRN_SERVER_MESSAGE_SIZE) {
+		return false;
+	}
+	raw[0] = SFCO_MAGIC;
+	raw[1] = 0;
+	raw[2] = result;
+	raw[3] = 0;
+	if(data_size > 0) {
+		memcpy(raw + 4, data, data_size);
+	}
+	return true;
+}
+
+static void mrb_trn_server_reply_error(uint32_t *message, result_t result) {
+	mrb_trn_server_pack_reply(message, result, NULL, 0, NULL, 0, NULL, 0);
+}
+
+// finds the descriptor carrying declared buffer index; auto buffers arrive as a
+// pointer and a mapped descriptor, only one of which is filled
+static trn_server_descriptor_t *mrb_trn_server_find_descriptor(message_format_t *fmt, trn_server_request_t *rq, size_t index) {
+	size_t x = 0, a = 0, b = 0;
+	for(size_t j = 0; j < index; j++) {
+		uint32_t type = fmt->buffer_types[j];
+		bool is_auto = type & TRN_IPC_BUFFER_AUTO;
+		if((type & 0x1) && (is_auto || (type & 0x8))) {
+			x++;
+		}
+		if((type & 0x1) && (is_auto || (type & 0x4))) {
+			a++;
+		}
+		if((type & 0x2) && (is_auto || (type & 0x4))) {
+			b++;
+		}
+	}
+
+	uint32_t type = fmt->buffer_types[index];
+	bool is_auto = type & TRN_IPC_BUFFER_AUTO;
+	if(type & 0x1) {
+		if((is_auto || (type & 0x8)) && x < rq->num_x && (!is_auto || rq->x[x].size > 0)) {
+			return &rq->x[x];
+		}
+		if((is_auto || (type & 0x4)) && a < rq->num_a) {
+			return &rq->a[a];
+		}
+	} else if((type & 0x2) && (is_auto || (type & 0x4)) && b < rq->num_b) {
+		return &rq->b[b];
+	}
+	return NULL; // receive (C) buffers aren't supported
+}
+
+// decodes the request into a params hash following the command's input fields;
+// buffer views are also pushed to lent so they can be revoked after the handler
+static mrb_value mrb_trn_server_unpack_request(mrb_state *mrb, message_format_t *fmt, trn_server_request_t *rq, mrb_value lent) {
+	mrb_value hash = mrb_hash_new_capa(mrb, fmt->num_in_fields);
+	for(size_t i = 0; i < fmt->num_in_fields; i++) {
+		trn_field_t *field = &fmt->in_fields[i];
+		mrb_value value = mrb_nil_value();
+		switch(field->kind) {
+		case TRN_FIELD_RAW:
+			if(field->offset + field->size > rq->raw_size) {
+				mrb_raise(mrb, E_RUNTIME_ERROR, "request raw data too short");
+			}
+			if(field->is_numeric) {
+				value = mrb_trn_ipc_unpack_numeric(mrb, rq->raw + field->offset, field->size, false);
+			} else {
+				value = mrb_str_new(mrb, (const char*) rq->raw + field->offset, field->size);
+			}
+			break;
+		case TRN_FIELD_COPY_HANDLE:
+			if(field->offset < rq->num_copy_handles) {
+				value = mrb_fixnum_value(rq->copy_handles[field->offset]);
+			}
+			break;
+		case TRN_FIELD_MOVE_HANDLE:
+			if(field->offset < rq->num_move_handles) {
+				value = mrb_fixnum_value(rq->move_handles[field->offset]);
+			}
+			break;
+		case TRN_FIELD_BUFFER: {
+			trn_server_descriptor_t *d = mrb_trn_server_find_descriptor(fmt, rq, field->offset);
+			if(d) {
+				// client memory mapped into this process for the duration of the request
+				value = mrb_trn_buffer_lend(mrb, (void*) d->addr, d->size, mrb_nil_value());
+				mrb_ary_push(mrb, lent, value);
+			}
+			break; }
+		case TRN_FIELD_OBJECT:
+		case TRN_FIELD_PID:
+			continue;
+		}
+		mrb_hash_set(mrb, hash, field->key, value);
+	}
+	if(rq->has_pid) {
+		mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "pid")), mrb_fixnum_value(rq->pid));
+	}
+	return hash;
+}
+
+// encodes the handler's result hash following the command's output fields
+static bool mrb_trn_server_pack_response(mrb_state *mrb, message_format_t *fmt, mrb_value hash, uint32_t *message) {
+	uint8_t raw[TRN_SERVER_MESSAGE_SIZE];
+	handle_t copy_handles[TRN_SERVER_MAX_HANDLE_DESCRIPTORS];
+	handle_t move_handles[TRN_SERVER_MAX_HANDLE_DESCRIPTORS];
+	if(fmt->rs.raw_data_size > sizeof(raw) ||
+	   fmt->rs.num_copy_handles > TRN_SERVER_MAX_HANDLE_DESCRIPTORS ||
+	   fmt->rs.num_move_handles > TRN_SERVER_MAX_HANDLE_DESCRIPTORS) {
+		return false;
+	}
+	memset(raw, 0, fmt->rs.raw_data_size);
+	for(size_t i = 0; i < fmt->num_out_fields; i++) {
+		trn_field_t *field = &fmt->out_fields[i];
+		mrb_value value = mrb_hash_p(hash) ? mrb_hash_get(mrb, hash, field->key) : mrb_nil_value();
+		switch(field->kind) {
+		case TRN_FIELD_RAW:
+			if(mrb_string_p(value) && RSTRING_LEN(value) == field->size) {
+				memcpy(raw + field->offset, RSTRING_PTR(value), field->size);
+			} else if(mrb_fixnum_p(value) && field->size <= sizeof(uint64_t)) {
+				uint64_t v = mrb_fixnum(value);
+				memcpy(raw + field->offset, &v, field->size); // little-endian
+			} else if(!mrb_nil_p(value)) {
+				return false;
+			}
+			break;
+		case TRN_FIELD_COPY_HANDLE:
+			copy_handles[field->offset] = mrb_fixnum_p(value) ? mrb_fixnum(value) : 0;
+			break;
+		case TRN_FIELD_MOVE_HANDLE:
+			move_handles[field->offset] = mrb_fixnum_p(value) ? mrb_fixnum(value) : 0;
+			break;
+		default:
+			break;
+		}
+	}
+	return mrb_trn_server_pack_reply(message, RESULT_OK, raw, fmt->rs.raw_data_size,
+	                                 copy_handles, fmt->rs.num_copy_handles,
+	                                 move_handles, fmt->rs.num_move_handles);
+}
+
+// sends the reply sitting in session's message buffer without waiting for the next request
+static void mrb_trn_server_send_reply(mrb_state *mrb, trn_server_t *server, size_t index) {
+	trn_server_session_t *session = server->sessions[index];
+	memcpy(get_tls(), session->message, TRN_SERVER_MESSAGE_SIZE);
+	uint32_t handle_index;
+	result_t r = svcReplyAndReceive(&handle_index, NULL, 0, session->handle, 0);
+	if(r == KERNEL_RESULT_SESSION_CLOSED) {
+		mrb_trn_server_remove_session(mrb, server, index);
+	}
+	// anything else (normally a timeout, with nothing to wait on) means the reply went out
+}
+
+static void mrb_trn_server_revoke(mrb_state *mrb, mrb_value lent) {
+	for(mrb_int i = 0; i < RARRAY_LEN(lent); i++) {
+		mrb_trn_buffer_revoke(mrb, mrb_ary_ref(mrb, lent, i));
+	}
+}
+
+static mrb_value mrb_trn_server_call_handler(mrb_state *mrb, mrb_value args) {
+	mrb_value handler = mrb_ary_entry(args, 0);
+	mrb_value method = mrb_ary_entry(args, 1);
+	mrb_value params = mrb_ary_entry(args, 2);
+	return mrb_funcall_argv(mrb, handler, mrb_symbol(method), 1, &params);
+}
+
+// handles the request sitting in session's message buffer and leaves the reply in its place
+static void mrb_trn_server_dispatch(mrb_state *mrb, mrb_value self, trn_server_t *server, size_t index) {
+	trn_server_session_t *session = server->sessions[index];
+	trn_server_request_t rq;
+	if(!mrb_trn_server_parse(session->message, &rq)) {
+		mrb_trn_server_reply_error(session->message, TRN_RESULT(TRN_ERR_MALFORMED_REQUEST));
+		server->reply_index = index;
+		return;
+	}
+
+	switch(rq.type) {
+	case 2: // close
+		mrb_trn_server_remove_session(mrb, server, index);
+		return;
+	case 5: // control
+	case 7:
+		if(rq.command_id == 3) { // QueryPointerBufferSize
+			uint16_t size = 0; // no pointer buffer; clients should use mapped buffers
+			mrb_trn_server_pack_reply(session->message, RESULT_OK, (uint8_t*) &size, sizeof(size), NULL, 0, NULL, 0);
+		} else {
+			mrb_trn_server_reply_error(session->message, TRN_RESULT(TRN_ERR_UNKNOWN_COMMAND));
+		}
+		server->reply_index = index;
+		return;
+	case 4: // request
+	case 6:
+		break;
+	default:
+		mrb_trn_server_reply_error(session->message, TRN_RESULT(TRN_ERR_MALFORMED_REQUEST));
+		server->reply_index = index;
+		return;
+	}
+
+	trn_server_command_t *command = NULL;
+	for(size_t i = 0; i < server->num_commands; i++) {
+		if(server->commands[i].id == rq.command_id) {
+			command = &server->commands[i];
+			break;
+		}
+	}
+	if(command == NULL) {
+		mrb_trn_server_reply_error(session->message, TRN_RESULT(TRN_ERR_UNKNOWN_COMMAND));
+		server->reply_index = index;
+		return;
+	}
+
+	int arena = mrb_gc_arena_save(mrb);
+	mrb_value lent = mrb_ary_new(mrb);
+	mrb_value args = mrb_ary_new_capa(mrb, 3);
+	mrb_ary_push(mrb, args, mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@handler")));
+	mrb_ary_push(mrb, args, mrb_symbol_value(command->method));
+	mrb_ary_push(mrb, args, mrb_trn_server_unpack_request(mrb, command->fmt, &rq, lent));
+
+	mrb_bool failed = false;
+	mrb_value result = mrb_protect(mrb, mrb_trn_server_call_handler, args, &failed);
+	// the client's buffers are only mapped until the reply goes out
+	mrb_trn_server_revoke(mrb, lent);
+	if(failed) {
+		// the client gets its answer now, since the loop may never come back
+		// around to send it; the exception goes to whoever is running the loop
+		mrb_trn_server_reply_error(session->message, TRN_RESULT(TRN_ERR_HANDLER_FAILED));
+		mrb_trn_server_send_reply(mrb, server, index);
+		mrb_gc_arena_restore(mrb, arena);
+		mrb_exc_raise(mrb, result);
+	}
+	if(!mrb_trn_server_pack_response(mrb, command->fmt, result, session->message)) {
+		mrb_trn_server_reply_error(session->message, TRN_RESULT(TRN_ERR_MALFORMED_RESPONSE));
+	}
+	mrb_gc_arena_restore(mrb, arena);
+	server->reply_index = index;
+}
+
+static mrb_value mrb_trn_server_new(mrb_state *mrb, mrb_value self) {
+	mrb_value handler;
+	mrb_int port = 0;
+	mrb_int num_args = mrb_get_args(mrb, "o|i", &handler, &port);
+
+	trn_server_t *server = mrb_calloc(mrb, sizeof(*server), 1);
+	server->port = port;
+	server->reply_index = -1;
+	if(port) {
+		server->handles[0] = port;
+	}
+	mrb_value obj = mrb_obj_value(Data_Wrap_Struct(mrb, class_ipc_Server, &dt_ipc_Server, server));
+	mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "@handler"), handler);
+	mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "@messages"), mrb_ary_new(mrb));
+	return obj;
+}
+
+static mrb_value mrb_trn_server_register(mrb_state *mrb, mrb_value self) {
+	trn_server_t *server = mrb_trn_server_get(mrb, self);
+	mrb_sym method;
+	mrb_value message;
+	mrb_int num_args = mrb_get_args(mrb, "no", &method, &message);
+
+	message_format_t *fmt = mrb_data_get_ptr(mrb, message, &dt_ipc_Message);
+	if(!fmt->is_compiled) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "message layout is not compiled");
+	}
+	for(size_t i = 0; i < fmt->num_in_fields; i++) {
+		if(fmt->in_fields[i].kind == TRN_FIELD_OBJECT) {
+			mrb_raise(mrb, E_NOTIMP_ERROR, "servers can't receive objects");
+		}
+	}
+	for(size_t i = 0; i < fmt->num_out_fields; i++) {
+		if(fmt->out_fields[i].kind == TRN_FIELD_OBJECT || fmt->out_fields[i].kind == TRN_FIELD_PID) {
+			mrb_raise(mrb, E_NOTIMP_ERROR, "servers can't send objects or pids");
+		}
+	}
+	if(fmt->rs.num_copy_handles > TRN_SERVER_MAX_HANDLE_DESCRIPTORS || fmt->rs.num_move_handles > TRN_SERVER_MAX_HANDLE_DESCRIPTORS) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "too many handles in response");
+	}
+
+	server->commands = mrb_realloc(mrb, server->commands, (server->num_commands + 1) * sizeof(trn_server_command_t));
+	trn_server_command_t *command = &server->commands[server->num_commands++];
+	command->id = fmt->rq.request_id;
+	command->method = method;
+	command->fmt = fmt;
+	// keeps the format alive
+	mrb_ary_push(mrb, mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@messages")), message);
+	return mrb_nil_value();
+}
+
+static mrb_value mrb_trn_server_add_session_m(mrb_state *mrb, mrb_value self) {
+	trn_server_t *server = mrb_trn_server_get(mrb, self);
+	mrb_int handle;
+	mrb_int num_args = mrb_get_args(mrb, "i", &handle);
+	mrb_trn_server_add_session(mrb, server, handle);
+	return mrb_nil_value();
+}
+
+static mrb_value mrb_trn_server_session_count(mrb_state *mrb, mrb_value self) {
+	trn_server_t *server = mrb_trn_server_get(mrb, self);
+	return mrb_fixnum_value(server->num_sessions);
+}
+
+// waits for and handles one event; returns false on timeout and nil once
+// there is nothing left to serve
+static mrb_value mrb_trn_server_process(mrb_state *mrb, mrb_value self) {
+	trn_server_t *server = mrb_trn_server_get(mrb, self);
+	mrb_int timeout = -1;
+	mrb_int num_args = mrb_get_args(mrb, "|i", &timeout);
+
+	size_t base = mrb_trn_server_handle_base(server);
+	size_t num_handles = base + server->num_sessions;
+	if(num_handles == 0) {
+		return mrb_nil_value(); // nothing left to wait on
+	}
+	handle_t reply_target = 0;
+	if(server->reply_index >= 0) {
+		trn_server_session_t *session = server->sessions[server->reply_index];
+		memcpy(get_tls(), session->message, TRN_SERVER_MESSAGE_SIZE);
+		reply_target = session->handle;
+	} else {
+		memset(get_tls(), 0, 8); // no pending reply
+	}
+	int reply_index = server->reply_index;
+	server->reply_index = -1;
+
+	uint32_t index = 0;
+	result_t r = svcReplyAndReceive(&index, server->handles, num_handles, reply_target, timeout);
+	if(r == KERNEL_RESULT_TIMED_OUT) {
+		return mrb_false_value();
+	}
+	if(r == KERNEL_RESULT_SESSION_CLOSED) {
+		// either the reply target or a waited session went away
+		if(reply_target && (index >= num_handles || server->handles[index] == reply_target)) {
+			mrb_trn_server_remove_session(mrb, server, reply_index);
+		} else if(index >= base && index < num_handles) {
+			mrb_trn_server_remove_session(mrb, server, index - base);
+		}
+		return mrb_true_value();
+	}
+	mrb_trn_assert_ok(mrb, r);
+
+	if(index < base) {
+		session_h session;
+		mrb_trn_assert_ok(mrb, svcAcceptSession(&session, server->port));
+		mrb_trn_server_add_session(mrb, server, session);
+		return mrb_true_value();
+	}
+
+	trn_server_session_t *session = server->sessions[index - base];
+	memcpy(session->message, get_tls(), TRN_SERVER_MESSAGE_SIZE);
+	mrb_trn_server_dispatch(mrb, self, server, index - base);
+	return mrb_true_value();
+}
+
+static mrb_value mrb_trn_server_close(mrb_state *mrb, mrb_value self) {
+	trn_server_t *server = mrb_data_get_ptr(mrb, self, &dt_ipc_Server);
+	if(server) {
+		DATA_PTR(self) = NULL;
+		mrb_trn_server_dfree(mrb, server);
+	}
+	return mrb_nil_value();
+}
+
+// benchmark client: sends a fixed request from its own thread until done
+
+typedef struct {
+	trn_thread_t thread;
+	ipc_object_t object;
+	uint32_t command_id;
+	uint64_t count;
+	volatile uint64_t completed;
+	volatile result_t result;
+	volatile bool done;
+} trn_server_bench_client_t;
+
+static void mrb_trn_server_bench_client_main(void *arg) {
+	trn_server_bench_client_t *client = arg;
+	uint32_t in = 0;
+	uint32_t out = 0;
+	ipc_request_t rq = ipc_default_request;
+	rq.request_id = client->command_id;
+	rq.raw_data_size = sizeof(in);
+	rq.raw_data = (void*) &in;
+	ipc_response_fmt_t rs = ipc_default_response_fmt;
+	rs.raw_data_size = sizeof(out);
+	rs.raw_data = (void*) &out;
+
+	client->result = RESULT_OK;
+	for(uint64_t i = 0; i < client->count; i++) {
+		in = i;
+		result_t r = ipc_send(client->object, &rq, &rs);
+		if(r != RESULT_OK) {
+			client->result = r;
+			break;
+		}
+		client->completed++;
+	}
+	ipc_close(client->object);
+	client->done = true;
+}
+
+static void mrb_trn_server_bench_client_dfree(mrb_state *mrb, void *data) {
+	trn_server_bench_client_t *client = data;
+	if(client) {
+		trn_thread_join(&client->thread, -1);
+		trn_thread_destroy(&client->thread);
+		mrb_free(mrb, client);
+	}
+}
+
+static const mrb_data_type dt_ipc_BenchClient = {"BenchClient", mrb_trn_server_bench_client_dfree};
+
+static mrb_value mrb_trn_server_bench_client_new(mrb_state *mrb, mrb_value self) {
+	mrb_int handle;
+	mrb_int command_id;
+	mrb_int count;
+	mrb_int num_args = mrb_get_args(mrb, "iii", &handle, &command_id, &count);
+
+	trn_server_bench_client_t *client = mrb_calloc(mrb, sizeof(*client), 1);
+	client->object = ipc_null_object;
+	client->object.session = handle;
+	client->command_id = command_id;
+	client->count = count;
+
+	result_t r = trn_thread_create(&client->thread, mrb_trn_server_bench_client_main, client, -1, -2, 0x4000, NULL);
+	if(r != RESULT_OK) {
+		mrb_free(mrb, client);
+		mrb_trn_assert_ok(mrb, r);
+	}
+	mrb_value obj = mrb_obj_value(Data_Wrap_Struct(mrb, mrb_class_ptr(self), &dt_ipc_BenchClient, client));
+	mrb_trn_assert_ok(mrb, trn_thread_start(&client->thread));
+	return obj;
+}
+
+static mrb_value mrb_trn_server_bench_client_done(mrb_state *mrb, mrb_value self) {
+	trn_server_bench_client_t *client = mrb_data_get_ptr(mrb, self, &dt_ipc_BenchClient);
+	return mrb_bool_value(client->done);
+}
+
+static mrb_value mrb_trn_server_bench_client_completed(mrb_state *mrb, mrb_value self) {
+	trn_server_bench_client_t *client = mrb_data_get_ptr(mrb, self, &dt_ipc_BenchClient);
+	return mrb_fixnum_value(client->completed);
+}
+
+static mrb_value mrb_trn_server_bench_client_result(mrb_state *mrb, mrb_value self) {
+	trn_server_bench_client_t *client = mrb_data_get_ptr(mrb, self, &dt_ipc_BenchClient);
+	return mrb_fixnum_value(client->result);
+}
+
+void mrb_transistor_server_init(mrb_state *mrb) {
+	class_ipc_Server = mrb_define_class_under(mrb, mod_transistor_ipc, "Server", mrb->object_class);
+	mrb_define_class_method(mrb, class_ipc_Server, "new", mrb_trn_server_new, MRB_ARGS_ARG(1, 1));
+	mrb_define_method(mrb, class_ipc_Server, "_register", mrb_trn_server_register, MRB_ARGS_ARG(2, 0));
+	mrb_define_method(mrb, class_ipc_Server, "add_session", mrb_trn_server_add_session_m, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_ipc_Server, "session_count", mrb_trn_server_session_count, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_ipc_Server, "process", mrb_trn_server_process, MRB_ARGS_ARG(0, 1));
+	mrb_define_method(mrb, class_ipc_Server, "close", mrb_trn_server_close, MRB_ARGS_ARG(0, 0));
+
+	struct RClass *class_BenchClient = mrb_define_class_under(mrb, class_ipc_Server, "BenchClient", mrb->object_class);
+	mrb_define_class_method(mrb, class_BenchClient, "new", mrb_trn_server_bench_client_new, MRB_ARGS_ARG(3, 0));
+	mrb_define_method(mrb, class_BenchClient, "done?", mrb_trn_server_bench_client_done, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_BenchClient, "completed", mrb_trn_server_bench_client_completed, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_BenchClient, "result", mrb_trn_server_bench_client_result, MRB_ARGS_ARG(0, 0));
+}
@@ -0,0 +1,104 @@
+#include<stdint.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/class.h>
+#include<mruby/hash.h>
+#include<mruby/irep.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include "trn.h"
+
+// TRN::Service: service classes are grouped by their idl/<name>.idl and
+// service/<name>.rb and nothing in a group exists until one of its
+// constants is referenced. const_missing then defines the group's native
+// commands and runs its precompiled Ruby, so startup cost doesn't grow with
+// the number of services. TRN::Service.constants only lists loaded groups.
+
+static mrb_value mrb_trn_service_loaded_hash(mrb_state *mrb, mrb_value mod_service) {
+	return mrb_iv_get(mrb, mod_service, mrb_intern_lit(mrb, "__loaded__"));
+}
+
+static void mrb_trn_service_load_group(mrb_state *mrb, mrb_value mod_service, size_t index) {
+	const trn_service_group_t *group = &trn_service_groups[index];
+	mrb_value loaded = mrb_trn_service_loaded_hash(mrb, mod_service);
+	mrb_value key = mrb_fixnum_value(index);
+	if(mrb_hash_key_p(mrb, loaded, key)) {
+		return;
+	}
+	// marked first, in case the group's Ruby refers to its own constants
+	mrb_hash_set(mrb, loaded, key, mrb_true_value());
+	if(group->define != NULL) {
+		group->define(mrb, mrb_class_ptr(mod_service));
+	}
+	if(group->irep != NULL) {
+		mrb_load_irep(mrb, group->irep);
+		if(mrb->exc) {
+			mrb_value exc = mrb_obj_value(mrb->exc);
+			mrb->exc = NULL;
+			mrb_hash_delete_key(mrb, loaded, key);
+			mrb_exc_raise(mrb, exc);
+		}
+	}
+}
+
+static mrb_value mrb_trn_service_const_missing(mrb_state *mrb, mrb_value self) {
+	mrb_sym name;
+	mrb_int num_args = mrb_get_args(mrb, "n", &name);
+	const char *str = mrb_sym2name(mrb, name);
+	for(size_t i = 0; trn_service_groups[i].name != NULL; i++) {
+		for(const char *const *constant = trn_service_groups[i].constants; *constant != NULL; constant++) {
+			if(strcmp(*constant, str) == 0) {
+				mrb_trn_service_load_group(mrb, self, i);
+				if(mrb_const_defined_at(mrb, self, name)) {
+					return mrb_const_get(mrb, self, name);
+				}
+				break;
+			}
+		}
+	}
+	mrb_name_error(mrb, name, "uninitialized constant TRN::Service::%S", mrb_sym2str(mrb, name));
+	return mrb_nil_value();
+}
+
+// load(group); group is the idl/service file basename, e.g. "usb"
+static mrb_value mrb_trn_service_load(mrb_state *mrb, mrb_value self) {
+	char *name;
+	mrb_int num_args = mrb_get_args(mrb, "z", &name);
+	for(size_t i = 0; trn_service_groups[i].name != NULL; i++) {
+		if(strcmp(trn_service_groups[i].name, name) == 0) {
+			mrb_trn_service_load_group(mrb, self, i);
+			return mrb_nil_value();
+		}
+	}
+	mrb_raisef(mrb, E_ARGUMENT_ERROR, "no service group %S", mrb_str_new_cstr(mrb, name));
+	return mrb_nil_value();
+}
+
+static mrb_value mrb_trn_service_load_all(mrb_state *mrb, mrb_value self) {
+	for(size_t i = 0; trn_service_groups[i].name != NULL; i++) {
+		mrb_trn_service_load_group(mrb, self, i);
+	}
+	return mrb_nil_value();
+}
+
+// groups -> {name => loaded}
+static mrb_value mrb_trn_service_groups(mrb_state *mrb, mrb_value self) {
+	mrb_value loaded = mrb_trn_service_loaded_hash(mrb, self);
+	mrb_value groups = mrb_hash_new(mrb);
+	for(size_t i = 0; trn_service_groups[i].name != NULL; i++) {
+		mrb_hash_set(mrb, groups, mrb_str_new_cstr(mrb, trn_service_groups[i].name), mrb_bool_value(mrb_hash_key_p(mrb, loaded, mrb_fixnum_value(i))));
+	}
+	return groups;
+}
+
+void mrb_transistor_service_init(mrb_state *mrb) {
+	struct RClass *mod_service = mrb_define_module_under(mrb, mod_transistor, "Service");
+	mrb_iv_set(mrb, mrb_obj_value(mod_service), mrb_intern_lit(mrb, "__loaded__"), mrb_hash_new(mrb));
+	mrb_define_class_method(mrb, mod_service, "const_missing", mrb_trn_service_const_missing, MRB_ARGS_ARG(1, 0));
+	mrb_define_class_method(mrb, mod_service, "load", mrb_trn_service_load, MRB_ARGS_ARG(1, 0));
+	mrb_define_class_method(mrb, mod_service, "load_all", mrb_trn_service_load_all, MRB_ARGS_ARG(0, 0));
+	mrb_define_class_method(mrb, mod_service, "groups", mrb_trn_service_groups, MRB_ARGS_ARG(0, 0));
+}
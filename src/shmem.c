@@ -0,0 +1,475 @@
+#include<stdint.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/array.h>
+#include<mruby/class.h>
+#include<mruby/data.h>
+#include<mruby/hash.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// TRN::SharedMemory: a shared or transfer memory handle mapped into a range
+// from as_reserve. Layouts describe structs inside the mapping; views read
+// their fields in place and track watched fields (generation counters, ring
+// indices) between polls. Named accessors are added in mrblib/shmem.rb.
+
+#define TRN_SHMEM_PERM_R 1
+#define TRN_SHMEM_PERM_W 2
+#define TRN_SHMEM_PERM_RW 3
+
+#define TRN_LAYOUT_MAX_FIELDS 64 // watched fields are a bitmask
+
+typedef struct {
+	handle_t handle;
+	void *addr;
+	size_t size;
+	uint32_t permission; // what this process mapped it with
+	bool transfer;
+	bool mapped;
+} trn_shmem_t;
+
+typedef struct {
+	mrb_sym name;
+	uint32_t offset;
+	uint8_t size;
+	bool is_signed;
+} trn_layout_field_t;
+
+typedef struct {
+	size_t count;
+	size_t extent;
+	trn_layout_field_t fields[];
+} trn_layout_t;
+
+typedef struct {
+	trn_shmem_t *shmem;
+	trn_layout_t *layout;
+	uint8_t *base;
+	uint64_t watched;
+	uint64_t snapshot[];
+} trn_shmem_view_t;
+
+static void mrb_trn_shmem_unmap(trn_shmem_t *shmem) {
+	if(!shmem->mapped) {
+		return;
+	}
+	if(shmem->transfer) {
+		svcUnmapTransferMemory(shmem->handle, shmem->addr, shmem->size);
+	} else {
+		svcUnmapSharedMemory(shmem->handle, shmem->addr, shmem->size);
+	}
+	as_release(shmem->addr, shmem->size);
+	svcCloseHandle(shmem->handle);
+	shmem->mapped = false;
+}
+
+static void mrb_trn_shmem_dfree(mrb_state *mrb, void *data) {
+	trn_shmem_t *shmem = data;
+	if(!shmem) {
+		return;
+	}
+	mrb_trn_shmem_unmap(shmem);
+	mrb_free(mrb, shmem);
+}
+
+static void mrb_trn_dfree(mrb_state *mrb, void *data) {
+	mrb_free(mrb, data);
+}
+
+static const mrb_data_type dt_SharedMemory = {"SharedMemory", mrb_trn_shmem_dfree};
+static const mrb_data_type dt_Layout = {"Layout", mrb_trn_dfree};
+static const mrb_data_type dt_View = {"View", mrb_trn_dfree};
+
+static trn_shmem_t *mrb_trn_shmem_get(mrb_state *mrb, mrb_value self) {
+	return mrb_data_get_ptr(mrb, self, &dt_SharedMemory);
+}
+
+static trn_shmem_t *mrb_trn_shmem_get_mapped(mrb_state *mrb, mrb_value self) {
+	trn_shmem_t *shmem = mrb_trn_shmem_get(mrb, self);
+	if(!shmem->mapped) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "shared memory is closed");
+	}
+	return shmem;
+}
+
+// takes ownership of handle; it is closed if mapping fails
+static mrb_value mrb_trn_shmem_map(mrb_state *mrb, struct RClass *klass, handle_t handle, size_t size, uint32_t permission, bool transfer) {
+	size = (size + 0xfff) & ~0xfffull;
+	trn_shmem_t *shmem = mrb_calloc(mrb, sizeof(*shmem), 1);
+	struct RData *data = Data_Wrap_Struct(mrb, klass, &dt_SharedMemory, shmem);
+	shmem->handle = handle;
+	shmem->size = size;
+	shmem->permission = permission;
+	shmem->transfer = transfer;
+
+	shmem->addr = as_reserve(size);
+	if(shmem->addr == NULL) {
+		svcCloseHandle(handle);
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of address space");
+	}
+	result_t r = transfer ?
+		svcMapTransferMemory(handle, shmem->addr, size, permission) :
+		svcMapSharedMemory(handle, shmem->addr, size, permission);
+	if(r != RESULT_OK) {
+		as_release(shmem->addr, size);
+		svcCloseHandle(handle);
+		mrb_trn_assert_ok(mrb, r);
+	}
+	shmem->mapped = true;
+	return mrb_obj_value(data);
+}
+
+// new(handle, size, permission = PERM_R)
+static mrb_value mrb_trn_shmem_new(mrb_state *mrb, mrb_value self) {
+	mrb_int handle;
+	mrb_int size;
+	mrb_int permission = TRN_SHMEM_PERM_R;
+	mrb_int num_args = mrb_get_args(mrb, "ii|i", &handle, &size, &permission);
+	return mrb_trn_shmem_map(mrb, mrb_class_ptr(self), handle, size, permission, false);
+}
+
+// create(size, local_permission = PERM_RW, remote_permission = PERM_R)
+static mrb_value mrb_trn_shmem_create(mrb_state *mrb, mrb_value self) {
+	mrb_int size;
+	mrb_int local_permission = TRN_SHMEM_PERM_RW;
+	mrb_int remote_permission = TRN_SHMEM_PERM_R;
+	mrb_int num_args = mrb_get_args(mrb, "i|ii", &size, &local_permission, &remote_permission);
+	size = (size + 0xfff) & ~0xfffull;
+	shared_memory_h handle;
+	mrb_trn_assert_ok(mrb, svcCreateSharedMemory(&handle, size, local_permission, remote_permission));
+	return mrb_trn_shmem_map(mrb, mrb_class_ptr(self), handle, size, local_permission, false);
+}
+
+// transfer(handle, size, permission = PERM_RW)
+static mrb_value mrb_trn_shmem_transfer(mrb_state *mrb, mrb_value self) {
+	mrb_int handle;
+	mrb_int size;
+	mrb_int permission = TRN_SHMEM_PERM_RW;
+	mrb_int num_args = mrb_get_args(mrb, "ii|i", &handle, &size, &permission);
+	return mrb_trn_shmem_map(mrb, mrb_class_ptr(self), handle, size, permission, true);
+}
+
+static mrb_value mrb_trn_shmem_handle(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(mrb_trn_shmem_get(mrb, self)->handle);
+}
+
+static mrb_value mrb_trn_shmem_address(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value((uint64_t) mrb_trn_shmem_get_mapped(mrb, self)->addr);
+}
+
+static mrb_value mrb_trn_shmem_size(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(mrb_trn_shmem_get(mrb, self)->size);
+}
+
+static mrb_value mrb_trn_shmem_mapped_p(mrb_state *mrb, mrb_value self) {
+	return mrb_bool_value(mrb_trn_shmem_get(mrb, self)->mapped);
+}
+
+// unmaps, releases the range and closes the handle; views raise and the
+// buffer reads as empty afterwards
+static mrb_value mrb_trn_shmem_close(mrb_state *mrb, mrb_value self) {
+	mrb_trn_buffer_revoke(mrb, mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "@buffer")));
+	mrb_trn_shmem_unmap(mrb_trn_shmem_get(mrb, self));
+	return mrb_nil_value();
+}
+
+// raw access through a TRN::Buffer, revoked by close
+static mrb_value mrb_trn_shmem_buffer(mrb_state *mrb, mrb_value self) {
+	trn_shmem_t *shmem = mrb_trn_shmem_get_mapped(mrb, self);
+	mrb_sym sym = mrb_intern_lit(mrb, "@buffer");
+	mrb_value buffer = mrb_iv_get(mrb, self, sym);
+	if(mrb_nil_p(buffer)) {
+		buffer = mrb_trn_buffer_lend(mrb, shmem->addr, shmem->size, self);
+		mrb_iv_set(mrb, self, sym, buffer);
+	}
+	return buffer;
+}
+
+static trn_layout_t *mrb_trn_layout_get(mrb_state *mrb, mrb_value self) {
+	return mrb_data_get_ptr(mrb, self, &dt_Layout);
+}
+
+static bool mrb_trn_layout_type(mrb_state *mrb, mrb_sym type, trn_layout_field_t *field) {
+	static const struct {
+		const char *name;
+		uint8_t size;
+		bool is_signed;
+	} types[] = {
+		{"u8", 1, false}, {"u16", 2, false}, {"u32", 4, false}, {"u64", 8, false},
+		{"i8", 1, true}, {"i16", 2, true}, {"i32", 4, true}, {"i64", 8, true},
+	};
+	for(size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if(type == mrb_intern_cstr(mrb, types[i].name)) {
+			field->size = types[i].size;
+			field->is_signed = types[i].is_signed;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Layout.new(name: [type, offset], ...), type being :u8 .. :i64. fields must
+// be naturally aligned so they can be read atomically.
+static mrb_value mrb_trn_layout_new(mrb_state *mrb, mrb_value self) {
+	mrb_value fields;
+	mrb_int num_args = mrb_get_args(mrb, "H", &fields);
+	mrb_value keys = mrb_hash_keys(mrb, fields);
+	mrb_int count = RARRAY_LEN(keys);
+	if(count == 0 || count > TRN_LAYOUT_MAX_FIELDS) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid number of fields");
+	}
+
+	trn_layout_t *layout = mrb_calloc(mrb, sizeof(*layout) + count * sizeof(layout->fields[0]), 1);
+	struct RData *data = Data_Wrap_Struct(mrb, mrb_class_ptr(self), &dt_Layout, layout);
+	layout->count = count;
+	for(mrb_int i = 0; i < count; i++) {
+		mrb_value key = mrb_ary_ref(mrb, keys, i);
+		mrb_value spec = mrb_hash_get(mrb, fields, key);
+		trn_layout_field_t *field = &layout->fields[i];
+		if(!mrb_symbol_p(key) || !mrb_array_p(spec) || RARRAY_LEN(spec) != 2 ||
+		   !mrb_symbol_p(mrb_ary_ref(mrb, spec, 0)) || !mrb_fixnum_p(mrb_ary_ref(mrb, spec, 1))) {
+			mrb_raise(mrb, E_ARGUMENT_ERROR, "fields are name: [type, offset]");
+		}
+		if(!mrb_trn_layout_type(mrb, mrb_symbol(mrb_ary_ref(mrb, spec, 0)), field)) {
+			mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown field type %S", mrb_ary_ref(mrb, spec, 0));
+		}
+		mrb_int offset = mrb_fixnum(mrb_ary_ref(mrb, spec, 1));
+		if(offset < 0 || offset % field->size != 0) {
+			mrb_raisef(mrb, E_ARGUMENT_ERROR, "misaligned field %S", key);
+		}
+		field->name = mrb_symbol(key);
+		field->offset = offset;
+		if(offset + field->size > layout->extent) {
+			layout->extent = offset + field->size;
+		}
+	}
+	return mrb_obj_value(data);
+}
+
+static mrb_value mrb_trn_layout_names(mrb_state *mrb, mrb_value self) {
+	trn_layout_t *layout = mrb_trn_layout_get(mrb, self);
+	mrb_value names = mrb_ary_new_capa(mrb, layout->count);
+	for(size_t i = 0; i < layout->count; i++) {
+		mrb_ary_push(mrb, names, mrb_symbol_value(layout->fields[i].name));
+	}
+	return names;
+}
+
+static mrb_value mrb_trn_layout_size(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(mrb_trn_layout_get(mrb, self)->extent);
+}
+
+static mrb_int mrb_trn_layout_index(mrb_state *mrb, trn_layout_t *layout, mrb_sym name) {
+	for(size_t i = 0; i < layout->count; i++) {
+		if(layout->fields[i].name == name) {
+			return i;
+		}
+	}
+	mrb_raisef(mrb, E_KEY_ERROR, "no field %S", mrb_symbol_value(name));
+	return -1;
+}
+
+static trn_shmem_view_t *mrb_trn_view_get(mrb_state *mrb, mrb_value self) {
+	trn_shmem_view_t *view = mrb_data_get_ptr(mrb, self, &dt_View);
+	if(!view->shmem->mapped) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "shared memory is closed");
+	}
+	return view;
+}
+
+// views over a mapping without PERM_W would fault on store
+static trn_shmem_view_t *mrb_trn_view_get_writable(mrb_state *mrb, mrb_value self) {
+	trn_shmem_view_t *view = mrb_trn_view_get(mrb, self);
+	if(!(view->shmem->permission & TRN_SHMEM_PERM_W)) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "shared memory is not mapped writable");
+	}
+	return view;
+}
+
+static uint64_t mrb_trn_view_load(trn_shmem_view_t *view, size_t index) {
+	const trn_layout_field_t *field = &view->layout->fields[index];
+	uint8_t *p = view->base + field->offset;
+	uint64_t v;
+	switch(field->size) {
+	case 1: v = __atomic_load_n((uint8_t*) p, __ATOMIC_ACQUIRE); break;
+	case 2: v = __atomic_load_n((uint16_t*) p, __ATOMIC_ACQUIRE); break;
+	case 4: v = __atomic_load_n((uint32_t*) p, __ATOMIC_ACQUIRE); break;
+	default: v = __atomic_load_n((uint64_t*) p, __ATOMIC_ACQUIRE); break;
+	}
+	if(field->is_signed && field->size < 8) {
+		int shift = 64 - field->size * 8;
+		v = (uint64_t) ((int64_t) (v << shift) >> shift);
+	}
+	return v;
+}
+
+static void mrb_trn_view_store(trn_shmem_view_t *view, size_t index, uint64_t v) {
+	const trn_layout_field_t *field = &view->layout->fields[index];
+	uint8_t *p = view->base + field->offset;
+	switch(field->size) {
+	case 1: __atomic_store_n((uint8_t*) p, v, __ATOMIC_RELEASE); break;
+	case 2: __atomic_store_n((uint16_t*) p, v, __ATOMIC_RELEASE); break;
+	case 4: __atomic_store_n((uint32_t*) p, v, __ATOMIC_RELEASE); break;
+	default: __atomic_store_n((uint64_t*) p, v, __ATOMIC_RELEASE); break;
+	}
+}
+
+static void mrb_trn_view_take_snapshot(trn_shmem_view_t *view) {
+	for(size_t i = 0; i < view->layout->count; i++) {
+		if(view->watched & (1ull << i)) {
+			view->snapshot[i] = mrb_trn_view_load(view, i);
+		}
+	}
+}
+
+// View.wrap(memory, layout, offset); every field is watched to begin with
+static mrb_value mrb_trn_view_wrap(mrb_state *mrb, mrb_value self) {
+	mrb_value memory;
+	mrb_value layout_v;
+	mrb_int offset;
+	mrb_int num_args = mrb_get_args(mrb, "ooi", &memory, &layout_v, &offset);
+	trn_shmem_t *shmem = mrb_trn_shmem_get_mapped(mrb, memory);
+	trn_layout_t *layout = mrb_trn_layout_get(mrb, layout_v);
+	if(offset < 0 || (size_t) offset > shmem->size || layout->extent > shmem->size - offset) {
+		mrb_raise(mrb, E_INDEX_ERROR, "layout doesn't fit in shared memory");
+	}
+	if(offset % 8 != 0) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "misaligned view");
+	}
+
+	trn_shmem_view_t *view = mrb_calloc(mrb, sizeof(*view) + layout->count * sizeof(view->snapshot[0]), 1);
+	mrb_value obj = mrb_obj_value(Data_Wrap_Struct(mrb, mrb_class_ptr(self), &dt_View, view));
+	mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "@memory"), memory);
+	mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "@layout"), layout_v);
+	view->shmem = shmem;
+	view->layout = layout;
+	view->base = (uint8_t*) shmem->addr + offset;
+	view->watched = layout->count == 64 ? UINT64_MAX : (1ull << layout->count) - 1;
+	mrb_trn_view_take_snapshot(view);
+	return obj;
+}
+
+static mrb_value mrb_trn_view_get_m(mrb_state *mrb, mrb_value self) {
+	trn_shmem_view_t *view = mrb_trn_view_get(mrb, self);
+	mrb_int index;
+	mrb_int num_args = mrb_get_args(mrb, "i", &index);
+	if(index < 0 || (size_t) index >= view->layout->count) {
+		mrb_raise(mrb, E_INDEX_ERROR, "no such field");
+	}
+	return mrb_fixnum_value(mrb_trn_view_load(view, index));
+}
+
+static mrb_value mrb_trn_view_set_m(mrb_state *mrb, mrb_value self) {
+	trn_shmem_view_t *view = mrb_trn_view_get_writable(mrb, self);
+	mrb_int index;
+	mrb_int value;
+	mrb_int num_args = mrb_get_args(mrb, "ii", &index, &value);
+	if(index < 0 || (size_t) index >= view->layout->count) {
+		mrb_raise(mrb, E_INDEX_ERROR, "no such field");
+	}
+	mrb_trn_view_store(view, index, value);
+	return mrb_fixnum_value(value);
+}
+
+static mrb_value mrb_trn_view_aref(mrb_state *mrb, mrb_value self) {
+	trn_shmem_view_t *view = mrb_trn_view_get(mrb, self);
+	mrb_sym name;
+	mrb_int num_args = mrb_get_args(mrb, "n", &name);
+	return mrb_fixnum_value(mrb_trn_view_load(view, mrb_trn_layout_index(mrb, view->layout, name)));
+}
+
+static mrb_value mrb_trn_view_aset(mrb_state *mrb, mrb_value self) {
+	trn_shmem_view_t *view = mrb_trn_view_get_writable(mrb, self);
+	mrb_sym name;
+	mrb_int value;
+	mrb_int num_args = mrb_get_args(mrb, "ni", &name, &value);
+	mrb_trn_view_store(view, mrb_trn_layout_index(mrb, view->layout, name), value);
+	return mrb_fixnum_value(value);
+}
+
+static mrb_value mrb_trn_view_to_h(mrb_state *mrb, mrb_value self) {
+	trn_shmem_view_t *view = mrb_trn_view_get(mrb, self);
+	mrb_value hash = mrb_hash_new_capa(mrb, view->layout->count);
+	for(size_t i = 0; i < view->layout->count; i++) {
+		mrb_hash_set(mrb, hash, mrb_symbol_value(view->layout->fields[i].name), mrb_fixnum_value(mrb_trn_view_load(view, i)));
+	}
+	return hash;
+}
+
+static mrb_value mrb_trn_view_address(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value((uint64_t) mrb_trn_view_get(mrb, self)->base);
+}
+
+// watch(*names): only these fields count for changed?; none means all of them
+static mrb_value mrb_trn_view_watch(mrb_state *mrb, mrb_value self) {
+	trn_shmem_view_t *view = mrb_trn_view_get(mrb, self);
+	mrb_value *names;
+	mrb_int count;
+	mrb_int num_args = mrb_get_args(mrb, "*", &names, &count);
+	uint64_t watched = 0;
+	for(mrb_int i = 0; i < count; i++) {
+		if(!mrb_symbol_p(names[i])) {
+			mrb_raise(mrb, E_TYPE_ERROR, "expected field names");
+		}
+		watched|= 1ull << mrb_trn_layout_index(mrb, view->layout, mrb_symbol(names[i]));
+	}
+	if(count == 0) {
+		watched = view->layout->count == 64 ? UINT64_MAX : (1ull << view->layout->count) - 1;
+	}
+	view->watched = watched;
+	mrb_trn_view_take_snapshot(view);
+	return self;
+}
+
+// true if a watched field changed since the last poll (or watch/wrap);
+// only the watched fields are read
+static mrb_value mrb_trn_view_changed_p(mrb_state *mrb, mrb_value self) {
+	trn_shmem_view_t *view = mrb_trn_view_get(mrb, self);
+	bool changed = false;
+	for(uint64_t watched = view->watched; watched; watched&= watched - 1) {
+		size_t i = __builtin_ctzll(watched);
+		uint64_t v = mrb_trn_view_load(view, i);
+		if(v != view->snapshot[i]) {
+			view->snapshot[i] = v;
+			changed = true;
+		}
+	}
+	return mrb_bool_value(changed);
+}
+
+void mrb_transistor_shmem_init(mrb_state *mrb) {
+	struct RClass *class_SharedMemory = mrb_define_class_under(mrb, mod_transistor, "SharedMemory", mrb->object_class);
+	mrb_define_class_method(mrb, class_SharedMemory, "new", mrb_trn_shmem_new, MRB_ARGS_ARG(2, 1));
+	mrb_define_class_method(mrb, class_SharedMemory, "create", mrb_trn_shmem_create, MRB_ARGS_ARG(1, 2));
+	mrb_define_class_method(mrb, class_SharedMemory, "transfer", mrb_trn_shmem_transfer, MRB_ARGS_ARG(2, 1));
+	mrb_define_method(mrb, class_SharedMemory, "handle", mrb_trn_shmem_handle, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_SharedMemory, "address", mrb_trn_shmem_address, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_SharedMemory, "size", mrb_trn_shmem_size, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_SharedMemory, "mapped?", mrb_trn_shmem_mapped_p, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_SharedMemory, "close", mrb_trn_shmem_close, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_SharedMemory, "buffer", mrb_trn_shmem_buffer, MRB_ARGS_ARG(0, 0));
+	mrb_define_const(mrb, class_SharedMemory, "PERM_R", mrb_fixnum_value(TRN_SHMEM_PERM_R));
+	mrb_define_const(mrb, class_SharedMemory, "PERM_W", mrb_fixnum_value(TRN_SHMEM_PERM_W));
+	mrb_define_const(mrb, class_SharedMemory, "PERM_RW", mrb_fixnum_value(TRN_SHMEM_PERM_RW));
+
+	struct RClass *class_Layout = mrb_define_class_under(mrb, class_SharedMemory, "Layout", mrb->object_class);
+	mrb_define_class_method(mrb, class_Layout, "new", mrb_trn_layout_new, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_Layout, "names", mrb_trn_layout_names, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Layout, "size", mrb_trn_layout_size, MRB_ARGS_ARG(0, 0));
+
+	struct RClass *class_View = mrb_define_class_under(mrb, class_SharedMemory, "View", mrb->object_class);
+	mrb_define_class_method(mrb, class_View, "wrap", mrb_trn_view_wrap, MRB_ARGS_ARG(3, 0));
+	mrb_define_method(mrb, class_View, "get", mrb_trn_view_get_m, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_View, "set", mrb_trn_view_set_m, MRB_ARGS_ARG(2, 0));
+	mrb_define_method(mrb, class_View, "[]", mrb_trn_view_aref, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_View, "[]=", mrb_trn_view_aset, MRB_ARGS_ARG(2, 0));
+	mrb_define_method(mrb, class_View, "to_h", mrb_trn_view_to_h, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_View, "address", mrb_trn_view_address, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_View, "watch", mrb_trn_view_watch, MRB_ARGS_ANY());
+	mrb_define_method(mrb, class_View, "changed?", mrb_trn_view_changed_p, MRB_ARGS_ARG(0, 0));
+}
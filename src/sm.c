@@ -0,0 +1,169 @@
+#include<stdint.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/data.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// A service manager connection that lives as long as the mrb_state, plus
+// a cache of resolved sessions that get cloned for each user.
+
+typedef struct trn_service_manager trn_service_manager_t;
+
+typedef struct trn_service_entry {
+	struct trn_service_entry *next;
+	trn_service_manager_t *manager; // NULL once invalidated
+	char name[9];
+	ipc_object_t session;
+	size_t refs;
+} trn_service_entry_t;
+
+struct trn_service_manager {
+	bool sm_initialized;
+	trn_service_entry_t *services;
+};
+
+static __thread struct RClass *class_ipc_ServiceManager;
+
+static void mrb_trn_service_unlink(trn_service_entry_t *entry) {
+	if(!entry->manager) {
+		return;
+	}
+	for(trn_service_entry_t **head = &entry->manager->services; *head != NULL; head = &(*head)->next) {
+		if(*head == entry) {
+			*head = entry->next;
+			break;
+		}
+	}
+	entry->manager = NULL;
+	entry->next = NULL;
+}
+
+static void mrb_trn_service_drop(mrb_state *mrb, trn_service_entry_t *entry) {
+	mrb_trn_service_unlink(entry);
+	ipc_close(entry->session);
+	mrb_free(mrb, entry);
+}
+
+void mrb_trn_service_release(mrb_state *mrb, trn_service_entry_t *entry) {
+	if(--entry->refs == 0) {
+		mrb_trn_service_drop(mrb, entry);
+	}
+}
+
+static void mrb_trn_service_manager_dfree(mrb_state *mrb, void *data) {
+	trn_service_manager_t *manager = data;
+	// clones that are still alive keep their entries until they're closed
+	while(manager->services) {
+		trn_service_entry_t *entry = manager->services;
+		mrb_trn_service_unlink(entry);
+		if(entry->refs == 0) {
+			mrb_trn_service_drop(mrb, entry);
+		}
+	}
+	if(manager->sm_initialized) {
+		sm_finalize();
+	}
+	mrb_free(mrb, manager);
+}
+
+static const mrb_data_type dt_ipc_ServiceManager = {"ServiceManager", mrb_trn_service_manager_dfree};
+
+static trn_service_manager_t *mrb_trn_service_manager_get(mrb_state *mrb) {
+	mrb_value manager_value = mrb_iv_get(mrb, mrb_obj_value(mod_transistor_ipc), mrb_intern_lit(mrb, "__service_manager__"));
+	trn_service_manager_t *manager;
+	if(mrb_nil_p(manager_value)) {
+		manager = mrb_calloc(mrb, sizeof(*manager), 1);
+		manager_value = mrb_obj_value(Data_Wrap_Struct(mrb, class_ipc_ServiceManager, &dt_ipc_ServiceManager, manager));
+		mrb_iv_set(mrb, mrb_obj_value(mod_transistor_ipc), mrb_intern_lit(mrb, "__service_manager__"), manager_value);
+	} else {
+		manager = mrb_data_get_ptr(mrb, manager_value, &dt_ipc_ServiceManager);
+	}
+	if(!manager->sm_initialized) {
+		mrb_trn_assert_ok(mrb, sm_init());
+		manager->sm_initialized = true;
+	}
+	return manager;
+}
+
+static mrb_value mrb_trn_get_service(mrb_state *mrb, mrb_value self) {
+	char *str;
+	mrb_int size;
+	mrb_bool cached = false;
+	mrb_int num_args = mrb_get_args(mrb, "s|b", &str, &size, &cached);
+
+	char name[9] = {0};
+	if(size >= sizeof(name)) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "service name too long");
+	}
+	memcpy(name, str, size);
+
+	trn_service_manager_t *manager = mrb_trn_service_manager_get(mrb);
+	ipc_object_t session;
+	if(!cached) {
+		mrb_trn_assert_ok(mrb, sm_get_service(&session, name));
+		mrb_value object = mrb_trn_ipc_object_wrap(mrb, session);
+		memcpy(&((trn_ipc_object_t*) DATA_PTR(object))->service_label, name, 8);
+		return object;
+	}
+
+	trn_service_entry_t *entry = manager->services;
+	while(entry != NULL && strcmp(entry->name, name) != 0) {
+		entry = entry->next;
+	}
+	if(entry == NULL) {
+		ipc_object_t resolved;
+		mrb_trn_assert_ok(mrb, sm_get_service(&resolved, name));
+		entry = mrb_calloc(mrb, sizeof(*entry), 1);
+		memcpy(entry->name, name, sizeof(name));
+		entry->session = resolved;
+		entry->manager = manager;
+		entry->next = manager->services;
+		manager->services = entry;
+	}
+
+	result_t r = mrb_trn_ipc_clone(entry->session, &session);
+	if(r != RESULT_OK && entry->refs == 0) {
+		mrb_trn_service_drop(mrb, entry);
+	}
+	mrb_trn_assert_ok(mrb, r);
+
+	mrb_value object = mrb_trn_ipc_object_wrap(mrb, session);
+	entry->refs++;
+	((trn_ipc_object_t*) DATA_PTR(object))->service = entry;
+	memcpy(&((trn_ipc_object_t*) DATA_PTR(object))->service_label, name, 8);
+	return object;
+}
+
+static mrb_value mrb_trn_invalidate_service(mrb_state *mrb, mrb_value self) {
+	char *str = NULL;
+	mrb_int size = 0;
+	mrb_int num_args = mrb_get_args(mrb, "|s!", &str, &size);
+
+	trn_service_manager_t *manager = mrb_trn_service_manager_get(mrb);
+	trn_service_entry_t *entry = manager->services;
+	while(entry != NULL) {
+		trn_service_entry_t *next = entry->next;
+		if(str == NULL || (strlen(entry->name) == size && memcmp(entry->name, str, size) == 0)) {
+			// sessions already handed out stay usable; the entry goes away with the last one
+			mrb_trn_service_unlink(entry);
+			if(entry->refs == 0) {
+				mrb_trn_service_drop(mrb, entry);
+			}
+		}
+		entry = next;
+	}
+	return mrb_nil_value();
+}
+
+void mrb_transistor_sm_init(mrb_state *mrb) {
+	class_ipc_ServiceManager = mrb_define_class_under(mrb, mod_transistor_ipc, "ServiceManager", mrb->object_class);
+	mrb_define_class_method(mrb, mod_transistor, "get_service", mrb_trn_get_service, MRB_ARGS_ARG(1, 1));
+	mrb_define_class_method(mrb, mod_transistor, "invalidate_service", mrb_trn_invalidate_service, MRB_ARGS_ARG(0, 1));
+}
@@ -0,0 +1,163 @@
+#include<stdint.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/array.h>
+#include<mruby/hash.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// Per-(service, command) IPC timing. Entries live in a fixed open-addressed
+// table that is claimed and updated with atomics only, so recording never
+// takes a lock or allocates.
+
+#define TRN_IPC_STATS_TABLE_SIZE 256 // power of two
+#define TRN_IPC_STATS_BUCKETS 16
+#define TRN_IPC_STATS_FIRST_BUCKET 4 // bucket 0 holds everything under 2^4 ticks
+
+enum {
+	TRN_IPC_STATS_EMPTY,
+	TRN_IPC_STATS_CLAIMING,
+	TRN_IPC_STATS_READY,
+};
+
+typedef struct {
+	uint32_t state;
+	uint32_t command_id;
+	uint64_t service;
+	uint64_t count;
+	uint64_t errors;
+	uint64_t pack_ticks;
+	uint64_t send_ticks;
+	uint64_t unpack_ticks;
+	uint64_t max_ticks;
+	uint64_t buckets[TRN_IPC_STATS_BUCKETS]; // total latency, log2 of ticks
+} trn_ipc_stats_entry_t;
+
+#if TRN_IPC_STATS
+static trn_ipc_stats_entry_t trn_ipc_stats_table[TRN_IPC_STATS_TABLE_SIZE];
+
+static trn_ipc_stats_entry_t *trn_ipc_stats_find(uint64_t service, uint32_t command_id) {
+	uint64_t hash = (service ^ (command_id * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+	for(size_t probe = 0; probe < TRN_IPC_STATS_TABLE_SIZE; probe++) {
+		trn_ipc_stats_entry_t *entry = &trn_ipc_stats_table[(hash + probe) & (TRN_IPC_STATS_TABLE_SIZE - 1)];
+		uint32_t state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+		if(state == TRN_IPC_STATS_EMPTY) {
+			uint32_t expected = TRN_IPC_STATS_EMPTY;
+			if(__atomic_compare_exchange_n(&entry->state, &expected, TRN_IPC_STATS_CLAIMING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				entry->service = service;
+				entry->command_id = command_id;
+				__atomic_store_n(&entry->state, TRN_IPC_STATS_READY, __ATOMIC_RELEASE);
+				return entry;
+			}
+			state = expected;
+		}
+		while(state == TRN_IPC_STATS_CLAIMING) {
+			// another thread is filling in the key
+			state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+		}
+		if(entry->service == service && entry->command_id == command_id) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+void mrb_trn_ipc_stats_record(uint64_t service, uint32_t command_id, uint64_t start, uint64_t packed, uint64_t sent, uint64_t end, result_t r) {
+	trn_ipc_stats_entry_t *entry = trn_ipc_stats_find(service, command_id);
+	if(entry == NULL) {
+		return; // table full
+	}
+	uint64_t total = end - start;
+	size_t bucket = 0;
+	if(total >= (1ull << TRN_IPC_STATS_FIRST_BUCKET)) {
+		bucket = 64 - __builtin_clzll(total) - TRN_IPC_STATS_FIRST_BUCKET;
+		if(bucket >= TRN_IPC_STATS_BUCKETS) {
+			bucket = TRN_IPC_STATS_BUCKETS - 1;
+		}
+	}
+	__atomic_fetch_add(&entry->count, 1, __ATOMIC_RELAXED);
+	if(r != RESULT_OK) {
+		__atomic_fetch_add(&entry->errors, 1, __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_add(&entry->pack_ticks, packed - start, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&entry->send_ticks, sent - packed, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&entry->unpack_ticks, end - sent, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&entry->buckets[bucket], 1, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&entry->max_ticks, __ATOMIC_RELAXED);
+	while(total > max && !__atomic_compare_exchange_n(&entry->max_ticks, &max, total, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+#endif
+
+static mrb_value mrb_trn_ipc_stats_service_name(mrb_state *mrb, uint64_t service) {
+	if(service == 0) {
+		return mrb_nil_value();
+	}
+	char name[9] = {0};
+	memcpy(name, &service, 8);
+	return mrb_str_new_cstr(mrb, name);
+}
+
+static mrb_value mrb_trn_ipc_stats(mrb_state *mrb, mrb_value self) {
+	mrb_value stats = mrb_hash_new(mrb);
+#if TRN_IPC_STATS
+	int arena = mrb_gc_arena_save(mrb);
+	for(size_t i = 0; i < TRN_IPC_STATS_TABLE_SIZE; i++) {
+		trn_ipc_stats_entry_t *entry = &trn_ipc_stats_table[i];
+		if(__atomic_load_n(&entry->state, __ATOMIC_ACQUIRE) != TRN_IPC_STATS_READY) {
+			continue;
+		}
+		mrb_value key = mrb_ary_new_capa(mrb, 2);
+		mrb_ary_push(mrb, key, mrb_trn_ipc_stats_service_name(mrb, entry->service));
+		mrb_ary_push(mrb, key, mrb_fixnum_value(entry->command_id));
+
+		mrb_value buckets = mrb_ary_new_capa(mrb, TRN_IPC_STATS_BUCKETS);
+		for(size_t b = 0; b < TRN_IPC_STATS_BUCKETS; b++) {
+			mrb_ary_push(mrb, buckets, mrb_fixnum_value(__atomic_load_n(&entry->buckets[b], __ATOMIC_RELAXED)));
+		}
+
+		mrb_value value = mrb_hash_new_capa(mrb, 7);
+		mrb_hash_set(mrb, value, mrb_symbol_value(mrb_intern_lit(mrb, "count")), mrb_fixnum_value(__atomic_load_n(&entry->count, __ATOMIC_RELAXED)));
+		mrb_hash_set(mrb, value, mrb_symbol_value(mrb_intern_lit(mrb, "errors")), mrb_fixnum_value(__atomic_load_n(&entry->errors, __ATOMIC_RELAXED)));
+		mrb_hash_set(mrb, value, mrb_symbol_value(mrb_intern_lit(mrb, "pack_ticks")), mrb_fixnum_value(__atomic_load_n(&entry->pack_ticks, __ATOMIC_RELAXED)));
+		mrb_hash_set(mrb, value, mrb_symbol_value(mrb_intern_lit(mrb, "send_ticks")), mrb_fixnum_value(__atomic_load_n(&entry->send_ticks, __ATOMIC_RELAXED)));
+		mrb_hash_set(mrb, value, mrb_symbol_value(mrb_intern_lit(mrb, "unpack_ticks")), mrb_fixnum_value(__atomic_load_n(&entry->unpack_ticks, __ATOMIC_RELAXED)));
+		mrb_hash_set(mrb, value, mrb_symbol_value(mrb_intern_lit(mrb, "max_ticks")), mrb_fixnum_value(__atomic_load_n(&entry->max_ticks, __ATOMIC_RELAXED)));
+		mrb_hash_set(mrb, value, mrb_symbol_value(mrb_intern_lit(mrb, "histogram")), buckets);
+		mrb_hash_set(mrb, stats, key, value);
+		mrb_gc_arena_restore(mrb, arena);
+	}
+#endif
+	return stats;
+}
+
+// counters are zeroed in place; keys stay claimed so concurrent recorders never see a torn entry
+static mrb_value mrb_trn_ipc_reset_stats(mrb_state *mrb, mrb_value self) {
+#if TRN_IPC_STATS
+	for(size_t i = 0; i < TRN_IPC_STATS_TABLE_SIZE; i++) {
+		trn_ipc_stats_entry_t *entry = &trn_ipc_stats_table[i];
+		__atomic_store_n(&entry->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry->errors, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry->pack_ticks, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry->send_ticks, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry->unpack_ticks, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry->max_ticks, 0, __ATOMIC_RELAXED);
+		for(size_t b = 0; b < TRN_IPC_STATS_BUCKETS; b++) {
+			__atomic_store_n(&entry->buckets[b], 0, __ATOMIC_RELAXED);
+		}
+	}
+#endif
+	return mrb_nil_value();
+}
+
+void mrb_transistor_stats_init(mrb_state *mrb) {
+	mrb_define_class_method(mrb, mod_transistor_ipc, "stats", mrb_trn_ipc_stats, MRB_ARGS_ARG(0, 0));
+	mrb_define_class_method(mrb, mod_transistor_ipc, "reset_stats", mrb_trn_ipc_reset_stats, MRB_ARGS_ARG(0, 0));
+	mrb_define_const(mrb, mod_transistor_ipc, "STATS_ENABLED", mrb_bool_value(TRN_IPC_STATS));
+	mrb_define_const(mrb, mod_transistor_ipc, "STATS_FIRST_BUCKET", mrb_fixnum_value(TRN_IPC_STATS_FIRST_BUCKET));
+}
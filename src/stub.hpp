@@ -0,0 +1,359 @@
+#pragma once
+
+#include<mruby.h>
+#include<mruby/array.h>
+#include<mruby/data.h>
+#include<mruby/hash.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include<libtransistor/types.h>
+#include<libtransistor/ipc.h>
+
+#include<string.h>
+
+#include<array>
+#include<tuple>
+#include<type_traits>
+#include<utility>
+
+#include "trn.h"
+
+// Marshalling for IDL-generated service stubs (see tools/idlc.rb).
+// Layouts are computed at compile time; only the values cross at runtime.
+namespace stub {
+
+enum class Kind {
+	Raw,
+	Buffer,
+	Object,
+	CopyHandle,
+	MoveHandle,
+	Pid,
+	Count
+};
+
+template<typename T>
+struct Raw {
+	using type = T;
+	static constexpr Kind kind = Kind::Raw;
+	static constexpr size_t size = sizeof(T);
+	static constexpr size_t align = alignof(T);
+	static constexpr bool is_numeric = true;
+};
+
+template<size_t Size, size_t Align = 1>
+struct Bytes {
+	static constexpr Kind kind = Kind::Raw;
+	static constexpr size_t size = Size;
+	static constexpr size_t align = Align;
+	static constexpr bool is_numeric = false;
+};
+
+template<uint32_t Type>
+struct Buffer {
+	static constexpr Kind kind = Kind::Buffer;
+	static constexpr size_t size = 0;
+	static constexpr size_t align = 1;
+	static constexpr uint32_t type = Type;
+};
+
+template<Kind K>
+struct Simple {
+	static constexpr Kind kind = K;
+	static constexpr size_t size = 0;
+	static constexpr size_t align = 1;
+};
+
+// number of section entries a field occupies; auto buffers take two descriptors
+template<typename F>
+constexpr uint32_t Width() {
+	if constexpr(F::kind == Kind::Buffer) {
+		return (F::type & TRN_IPC_BUFFER_AUTO) ? 2 : 1;
+	} else {
+		return 1;
+	}
+}
+
+using Object = Simple<Kind::Object>;
+using CopyHandle = Simple<Kind::CopyHandle>;
+using MoveHandle = Simple<Kind::MoveHandle>;
+using Pid = Simple<Kind::Pid>;
+
+template<typename... Fields>
+struct In {};
+
+template<typename... Fields>
+struct Out {};
+
+template<typename... Fields>
+struct Layout {
+	static constexpr size_t count = sizeof...(Fields);
+	// trailing sentinels keep these well-formed for empty layouts
+	static constexpr Kind kinds[] = {Fields::kind..., Kind::Count};
+	static constexpr size_t sizes[] = {Fields::size..., 0};
+	static constexpr size_t aligns[] = {Fields::align..., 1};
+	static constexpr uint32_t widths[] = {Width<Fields>()..., 0};
+
+	// raw data offset for raw fields, index within its section otherwise
+	static constexpr std::array<uint32_t, count> Slots() {
+		std::array<uint32_t, count> slots {};
+		size_t raw = 0;
+		uint32_t counters[(size_t) Kind::Count] = {};
+		for(size_t i = 0; i < count; i++) {
+			if(kinds[i] == Kind::Raw) {
+				raw+= aligns[i] - 1;
+				raw-= raw % aligns[i];
+				slots[i] = raw;
+				raw+= sizes[i];
+			} else {
+				slots[i] = counters[(size_t) kinds[i]];
+				counters[(size_t) kinds[i]]+= widths[i];
+			}
+		}
+		return slots;
+	}
+
+	// ruby argument index; pid fields don't consume an argument
+	static constexpr std::array<uint32_t, count> ArgIndices() {
+		std::array<uint32_t, count> indices {};
+		uint32_t arg = 0;
+		for(size_t i = 0; i < count; i++) {
+			indices[i] = arg;
+			if(kinds[i] != Kind::Pid) {
+				arg++;
+			}
+		}
+		return indices;
+	}
+
+	static constexpr size_t RawSize() {
+		size_t raw = 0;
+		for(size_t i = 0; i < count; i++) {
+			if(kinds[i] == Kind::Raw) {
+				raw+= aligns[i] - 1;
+				raw-= raw % aligns[i];
+				raw+= sizes[i];
+			}
+		}
+		return raw;
+	}
+
+	static constexpr size_t Count(Kind kind) {
+		size_t n = 0;
+		for(size_t i = 0; i < count; i++) {
+			if(kinds[i] == kind) {
+				n++;
+			}
+		}
+		return n;
+	}
+
+	static constexpr size_t Entries(Kind kind) {
+		size_t n = 0;
+		for(size_t i = 0; i < count; i++) {
+			if(kinds[i] == kind) {
+				n+= widths[i];
+			}
+		}
+		return n;
+	}
+
+	static constexpr std::array<uint32_t, count> slots = Slots();
+	static constexpr std::array<uint32_t, count> arg_indices = ArgIndices();
+	static constexpr size_t raw_size = RawSize();
+	static constexpr size_t num_buffers = Entries(Kind::Buffer);
+	static constexpr size_t num_objects = Count(Kind::Object);
+	static constexpr size_t num_copy_handles = Count(Kind::CopyHandle);
+	static constexpr size_t num_move_handles = Count(Kind::MoveHandle);
+	static constexpr bool has_pid = Count(Kind::Pid) > 0;
+	static constexpr size_t num_args = count - Count(Kind::Pid);
+};
+
+template<typename InLayout, typename OutLayout>
+struct Storage {
+	alignas(16) std::array<uint8_t, InLayout::raw_size> rq_raw;
+	alignas(16) std::array<uint8_t, OutLayout::raw_size> rs_raw;
+	std::array<ipc_buffer_t, InLayout::num_buffers> buffers;
+	std::array<ipc_buffer_t*, InLayout::num_buffers> buffer_ptrs;
+	std::array<ipc_object_t, InLayout::num_objects> rq_objects;
+	std::array<ipc_object_t, OutLayout::num_objects> rs_objects;
+	std::array<handle_t, InLayout::num_copy_handles> rq_copy_handles;
+	std::array<handle_t, OutLayout::num_copy_handles> rs_copy_handles;
+	std::array<handle_t, InLayout::num_move_handles> rq_move_handles;
+	std::array<handle_t, OutLayout::num_move_handles> rs_move_handles;
+	uint64_t pid;
+};
+
+// accepts either a TRN::IPC::Object or a service wrapper holding one in @object
+static inline trn_ipc_object_t *GetObject(mrb_state *mrb, mrb_value value) {
+	if(!mrb_obj_is_kind_of(mrb, value, class_ipc_Object)) {
+		value = mrb_iv_get(mrb, value, mrb_intern_lit(mrb, "@object"));
+	}
+	return mrb_trn_ipc_object_get(mrb, value);
+}
+
+template<typename Cmd, typename In, typename Out>
+struct Marshal;
+
+template<typename Cmd, typename... Ins, typename... Outs>
+struct Marshal<Cmd, In<Ins...>, Out<Outs...>> {
+	using InLayout = Layout<Ins...>;
+	using OutLayout = Layout<Outs...>;
+	using Store = Storage<InLayout, OutLayout>;
+
+	template<size_t I>
+	static void Inject(mrb_state *mrb, trn_ipc_object_t *object, mrb_value *argv, Store &s) {
+		using F = std::tuple_element_t<I, std::tuple<Ins...>>;
+		constexpr uint32_t slot = InLayout::slots[I];
+		mrb_value value = argv[InLayout::arg_indices[I]];
+		if constexpr(F::kind == Kind::Raw) {
+			if(mrb_string_p(value)) {
+				if(RSTRING_LEN(value) != F::size) {
+					mrb_raisef(mrb, E_ARGUMENT_ERROR, "invalid value for '%S'", mrb_str_new_cstr(mrb, Cmd::in_names[I]));
+				}
+				memcpy(s.rq_raw.data() + slot, RSTRING_PTR(value), F::size);
+			} else if constexpr(F::size <= sizeof(uint64_t)) {
+				if(!mrb_fixnum_p(value)) {
+					mrb_raisef(mrb, E_TYPE_ERROR, "invalid value for '%S'", mrb_str_new_cstr(mrb, Cmd::in_names[I]));
+				}
+				uint64_t v = mrb_fixnum(value);
+				memcpy(s.rq_raw.data() + slot, &v, F::size); // little-endian
+			} else {
+				mrb_raisef(mrb, E_TYPE_ERROR, "invalid value for '%S'", mrb_str_new_cstr(mrb, Cmd::in_names[I]));
+			}
+		} else if constexpr(F::kind == Kind::Buffer) {
+			void *data;
+			size_t size;
+			mrb_trn_buffer_region(mrb, value, &data, &size);
+			if constexpr((F::type & TRN_IPC_BUFFER_AUTO) != 0) {
+				mrb_trn_ipc_place_auto_buffer(object, F::type, &s.buffers[slot], &s.buffers[slot + 1], data, size);
+				s.buffer_ptrs[slot + 1] = &s.buffers[slot + 1];
+			} else {
+				s.buffers[slot].addr = data;
+				s.buffers[slot].size = size;
+				s.buffers[slot].type = F::type;
+			}
+			s.buffer_ptrs[slot] = &s.buffers[slot];
+		} else if constexpr(F::kind == Kind::Object) {
+			s.rq_objects[slot] = GetObject(mrb, value)->object;
+		} else if constexpr(F::kind == Kind::CopyHandle || F::kind == Kind::MoveHandle) {
+			if(!mrb_fixnum_p(value)) {
+				mrb_raisef(mrb, E_TYPE_ERROR, "invalid value for '%S'", mrb_str_new_cstr(mrb, Cmd::in_names[I]));
+			}
+			if constexpr(F::kind == Kind::CopyHandle) {
+				s.rq_copy_handles[slot] = mrb_fixnum(value);
+			} else {
+				s.rq_move_handles[slot] = mrb_fixnum(value);
+			}
+		}
+	}
+
+	template<size_t I>
+	static mrb_value Extract(mrb_state *mrb, trn_ipc_object_t *sender, Store &s) {
+		using F = std::tuple_element_t<I, std::tuple<Outs...>>;
+		constexpr uint32_t slot = OutLayout::slots[I];
+		if constexpr(F::kind == Kind::Raw) {
+			if constexpr(F::is_numeric) {
+				return mrb_trn_ipc_unpack_numeric(mrb, s.rs_raw.data() + slot, F::size, std::is_signed_v<typename F::type>);
+			} else {
+				return mrb_str_new(mrb, (const char*) s.rs_raw.data() + slot, F::size);
+			}
+		} else if constexpr(F::kind == Kind::Object) {
+			mrb_value object = mrb_trn_ipc_object_wrap_child(mrb, sender->domain, sender->service_label, s.rs_objects[slot]);
+			if(Cmd::out_classes[I] == NULL) {
+				return object;
+			}
+			struct RClass *mod_service = mrb_module_get_under(mrb, mod_transistor, "Service");
+			return mrb_obj_new(mrb, mrb_class_get_under(mrb, mod_service, Cmd::out_classes[I]), 1, &object);
+		} else if constexpr(F::kind == Kind::CopyHandle) {
+			return mrb_fixnum_value(s.rs_copy_handles[slot]);
+		} else if constexpr(F::kind == Kind::MoveHandle) {
+			return mrb_fixnum_value(s.rs_move_handles[slot]);
+		} else if constexpr(F::kind == Kind::Pid) {
+			return mrb_fixnum_value(s.pid);
+		} else {
+			return mrb_nil_value();
+		}
+	}
+
+	template<size_t... I>
+	static void InjectAll(mrb_state *mrb, trn_ipc_object_t *object, mrb_value *argv, Store &s, std::index_sequence<I...>) {
+		(Inject<I>(mrb, object, argv, s), ...);
+	}
+
+	template<size_t... I>
+	static void ExtractAll(mrb_state *mrb, trn_ipc_object_t *sender, Store &s, mrb_value hash, std::index_sequence<I...>) {
+		(mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_cstr(mrb, Cmd::out_names[I])), Extract<I>(mrb, sender, s)), ...);
+	}
+
+	static mrb_value Bind(mrb_state *mrb, mrb_value self) {
+		mrb_value *argv;
+		mrb_int argc;
+		mrb_get_args(mrb, "*", &argv, &argc);
+		if(argc != InLayout::num_args) {
+			mrb_raisef(mrb, E_ARGUMENT_ERROR, "wrong number of arguments (%S for %S)",
+			           mrb_fixnum_value(argc), mrb_fixnum_value(InLayout::num_args));
+		}
+		trn_ipc_object_t *object = GetObject(mrb, self);
+
+		Store s;
+		ipc_request_t rq = ipc_default_request;
+		ipc_response_fmt_t rs = ipc_default_response_fmt;
+		rq.request_id = Cmd::id;
+		rq.num_buffers = InLayout::num_buffers;
+		rq.buffers = s.buffer_ptrs.data();
+		rq.raw_data_size = InLayout::raw_size;
+		rq.raw_data = (decltype(rq.raw_data)) s.rq_raw.data();
+		rq.send_pid = InLayout::has_pid;
+		rq.num_objects = InLayout::num_objects;
+		rq.objects = s.rq_objects.data();
+		rq.num_copy_handles = InLayout::num_copy_handles;
+		rq.copy_handles = s.rq_copy_handles.data();
+		rq.num_move_handles = InLayout::num_move_handles;
+		rq.move_handles = s.rq_move_handles.data();
+
+		rs.raw_data_size = OutLayout::raw_size;
+		rs.raw_data = (decltype(rs.raw_data)) s.rs_raw.data();
+		rs.has_pid = OutLayout::has_pid;
+		rs.pid = &s.pid;
+		rs.num_objects = OutLayout::num_objects;
+		rs.objects = s.rs_objects.data();
+		rs.num_copy_handles = OutLayout::num_copy_handles;
+		rs.copy_handles = s.rs_copy_handles.data();
+		rs.num_move_handles = OutLayout::num_move_handles;
+		rs.move_handles = s.rs_move_handles.data();
+
+		TRN_IPC_STATS_TICK(start);
+		s.rq_raw.fill(0);
+		InjectAll(mrb, object, argv, s, std::index_sequence_for<Ins...>());
+
+		TRN_IPC_STATS_TICK(packed);
+		result_t r = mrb_trn_ipc_send(object, &rq, &rs);
+		TRN_IPC_STATS_TICK(sent);
+		if(r != RESULT_OK) {
+			TRN_IPC_STATS_RECORD(object->service_label, Cmd::id, start, packed, sent, sent, r);
+			mrb_trn_assert_ok(mrb, r);
+		}
+
+		mrb_value response;
+		if constexpr(OutLayout::count == 0) {
+			response = mrb_nil_value();
+		} else if constexpr(OutLayout::count == 1) {
+			response = Extract<0>(mrb, object, s);
+		} else {
+			response = mrb_hash_new_capa(mrb, OutLayout::count);
+			ExtractAll(mrb, object, s, response, std::index_sequence_for<Outs...>());
+		}
+		TRN_IPC_STATS_RECORD(object->service_label, Cmd::id, start, packed, sent, svcGetSystemTick(), r);
+		return response;
+	}
+};
+
+template<typename Cmd>
+struct C : Marshal<Cmd, typename Cmd::in, typename Cmd::out> {
+	static constexpr size_t num_args = Marshal<Cmd, typename Cmd::in, typename Cmd::out>::InLayout::num_args;
+};
+
+} // namespace stub
@@ -4,15 +4,201 @@
 extern "C" {
 #endif
 
+#include<stdbool.h>
+
 #include<mruby.h>
+#include<mruby/data.h>
+
+#include<libtransistor/types.h>
+#include<libtransistor/ipc.h>
+#include<libtransistor/svc.h>
+
+// per-command IPC timing (TRN::IPC.stats); build with TRN_IPC_STATS=0 to compile it out
+#ifndef TRN_IPC_STATS
+#define TRN_IPC_STATS 1
+#endif
+
+#if TRN_IPC_STATS
+#define TRN_IPC_STATS_TICK(name) uint64_t name = svcGetSystemTick()
+#define TRN_IPC_STATS_RECORD(...) mrb_trn_ipc_stats_record(__VA_ARGS__)
+#else
+#define TRN_IPC_STATS_TICK(name)
+#define TRN_IPC_STATS_RECORD(...)
+#endif
+
+// 19.2 MHz system tick; split so neither conversion overflows for any input
+#define TRN_TICKS_PER_SECOND 19200000
+
+static inline uint64_t trn_ns_to_ticks(uint64_t ns) {
+	return ns / 625 * 12 + ns % 625 * 12 / 625;
+}
+
+static inline uint64_t trn_ticks_to_ns(uint64_t ticks) {
+	return ticks / 12 * 625 + ticks % 12 * 625 / 12;
+}
+
+// class pointers are per thread: every thread opens its own mrb_state (see
+// TRN::Worker) and a state must stay on the thread that opened it
+extern __thread struct RClass *mod_transistor;
+extern __thread struct RClass *mod_transistor_ll;
+extern __thread struct RClass *exc_ResultError;
+
+extern __thread struct RClass *class_Buffer;
+extern const mrb_data_type dt_Buffer;
+
+extern __thread struct RClass *mod_transistor_ipc;
+extern __thread struct RClass *class_ipc_Object;
+extern __thread struct RClass *class_ipc_Message;
+extern const mrb_data_type dt_ipc_Object;
+extern const mrb_data_type dt_ipc_Message;
+
+struct trn_service_entry;
+
+// service classes, defined on first reference (src/service.c); the table is
+// generated by tools/idlc.rb
+typedef struct {
+	const char *name;
+	void (*define)(mrb_state *mrb, struct RClass *mod_service); // native commands, or NULL
+	const uint8_t *irep; // compiled service/<name>.rb, or NULL
+	const char *const *constants; // NULL-terminated
+} trn_service_group_t;
 
-extern struct RClass *mod_transistor;
-extern struct RClass *mod_transistor_ll;
-extern struct RClass *exc_ResultError;
+extern const trn_service_group_t trn_service_groups[];
 
+// results raised by this gem's own IPC code (module 0x1ad)
+#define TRN_RESULT_MODULE 0x1ad
+#define TRN_RESULT(desc) (TRN_RESULT_MODULE | ((desc) << 9))
+
+enum {
+	TRN_ERR_UNKNOWN_COMMAND = 1,
+	TRN_ERR_HANDLER_FAILED = 2,
+	TRN_ERR_MALFORMED_REQUEST = 3,
+	TRN_ERR_MALFORMED_RESPONSE = 4,
+};
+
+typedef enum {
+	TRN_BUFFER_BORROWED, // slice or foreign memory
+	TRN_BUFFER_MALLOC,
+	TRN_BUFFER_PAGES,
+} trn_buffer_owner_t;
+
+// data of a TRN::Buffer
+typedef struct trn_buffer {
+	uint8_t *data;
+	size_t size;
+	trn_buffer_owner_t owner;
+	struct trn_buffer *lease; // lent view this memory came from, if it can be taken back
+	bool revoked;
+} trn_buffer_t;
+
+// kernel session shared by all objects of a domain
+typedef struct {
+	session_h session;
+	size_t refs;
+	bool has_pointer_buffer_size;
+	uint16_t pointer_buffer_size;
+} trn_domain_t;
+
+typedef struct trn_session_pool trn_session_pool_t;
+
+// data of a TRN::IPC::Object
+typedef struct {
+	ipc_object_t object;
+	struct trn_service_entry *service; // cache entry this session was cloned from, if any
+	trn_domain_t *domain; // domain this object lives on, if any
+	trn_session_pool_t *pool; // requests go through a pooled session; object is the pool's
+	uint64_t service_label; // sm name of the service this object was opened from, packed; 0 if unknown
+	bool has_pointer_buffer_size; // cached per session; see trn_domain_t for domain objects
+	uint16_t pointer_buffer_size;
+} trn_ipc_object_t;
+
+// buffer type flag: send both a mapped (A/B) and a pointer (X/C) descriptor
+// and put the payload in whichever suits its size
+#define TRN_IPC_BUFFER_AUTO 0x20
+
+typedef enum {
+	TRN_FIELD_RAW,
+	TRN_FIELD_OBJECT,
+	TRN_FIELD_COPY_HANDLE,
+	TRN_FIELD_MOVE_HANDLE,
+	TRN_FIELD_BUFFER,
+	TRN_FIELD_PID,
+} trn_field_kind_t;
+
+// one entry of a message's frozen layout
+typedef struct {
+	trn_field_kind_t kind;
+	mrb_value key;
+	uint32_t offset; // raw data offset, or object/handle/buffer index
+	uint32_t size;
+	bool is_numeric;
+} trn_field_t;
+
+typedef struct {
+	ipc_request_t rq;
+	ipc_response_fmt_t rs;
+	uint64_t pid_storage;
+	void *arena; // backs every array below and in rq/rs, laid out by _invalidate
+	size_t arena_size;
+	trn_domain_t *domain; // domain of the last sender, for wrapping response objects
+	uint64_t service_label; // label of the last sender, inherited by response objects
+
+	size_t num_declared_buffers;
+	uint32_t *buffer_types; // as declared, possibly auto
+	uint32_t *buffer_slots; // first rq.buffers entry of each declared buffer
+
+	bool is_compiled;
+	size_t num_in_fields;
+	size_t num_out_fields;
+	trn_field_t *in_fields;
+	trn_field_t *out_fields;
+} message_format_t;
+
+mrb_value mrb_trn_result_error_new(mrb_state *mrb, result_t r); // TRN::ResultError with #code
 void mrb_trn_assert_ok(mrb_state *mrb, result_t r);
 void mrb_transistor_bind_init(mrb_state *mrb);
 void mrb_transistor_ipc_init(mrb_state *mrb);
+void mrb_transistor_service_init(mrb_state *mrb);
+void mrb_transistor_sm_init(mrb_state *mrb);
+void mrb_transistor_server_init(mrb_state *mrb);
+void mrb_transistor_usb_init(mrb_state *mrb);
+void mrb_transistor_buffer_init(mrb_state *mrb);
+void mrb_transistor_stats_init(mrb_state *mrb);
+void mrb_transistor_heap_init(mrb_state *mrb);
+void mrb_transistor_worker_init(mrb_state *mrb);
+void mrb_transistor_pool_init(mrb_state *mrb);
+void mrb_transistor_reactor_init(mrb_state *mrb);
+void mrb_transistor_memory_init(mrb_state *mrb);
+void mrb_transistor_shmem_init(mrb_state *mrb);
+void mrb_transistor_recorder_init(mrb_state *mrb);
+void mrb_transistor_profiler_init(mrb_state *mrb);
+#ifdef TRN_HOST_SIM
+void mrb_transistor_sim_init(mrb_state *mrb);
+#endif
+
+mrb_value mrb_trn_buffer_wrap(mrb_state *mrb, void *data, size_t size, trn_buffer_owner_t owner, mrb_value parent);
+mrb_value mrb_trn_buffer_lend(mrb_state *mrb, void *data, size_t size, mrb_value parent);
+void mrb_trn_buffer_revoke(mrb_state *mrb, mrb_value value);
+void mrb_trn_buffer_region(mrb_state *mrb, mrb_value value, void **data, size_t *size);
+mrb_value mrb_trn_memory_info_new(mrb_state *mrb, const memory_info_t *info);
+mrb_value mrb_trn_ipc_object_wrap(mrb_state *mrb, ipc_object_t object);
+mrb_value mrb_trn_ipc_object_wrap_child(mrb_state *mrb, trn_domain_t *domain, uint64_t service_label, ipc_object_t object);
+trn_ipc_object_t *mrb_trn_ipc_object_get(mrb_state *mrb, mrb_value value);
+result_t mrb_trn_ipc_clone(ipc_object_t object, ipc_object_t *out);
+result_t mrb_trn_ipc_send(trn_ipc_object_t *obj, ipc_request_t *rq, ipc_response_fmt_t *rs);
+
+// TRN::IPC::Recorder; mrb_trn_ipc_send records while trn_ipc_recording is set
+extern bool trn_ipc_recording;
+void mrb_trn_ipc_recorder_record(trn_ipc_object_t *obj, ipc_request_t *rq, ipc_response_fmt_t *rs, result_t r, uint64_t start, uint64_t end);
+result_t mrb_trn_session_pool_send(trn_session_pool_t *pool, ipc_request_t *rq, ipc_response_fmt_t *rs);
+void mrb_trn_session_pool_release(trn_session_pool_t *pool);
+void mrb_trn_ipc_place_auto_buffer(trn_ipc_object_t *obj, uint32_t type, ipc_buffer_t *mapped, ipc_buffer_t *pointer, void *data, size_t size);
+void mrb_trn_ipc_message_resolve_buffers(trn_ipc_object_t *obj, message_format_t *fmt);
+void mrb_trn_service_release(mrb_state *mrb, struct trn_service_entry *entry);
+void mrb_trn_ipc_message_pack(mrb_state *mrb, message_format_t *fmt, mrb_value hash);
+mrb_value mrb_trn_ipc_message_unpack(mrb_state *mrb, message_format_t *fmt);
+mrb_value mrb_trn_ipc_unpack_numeric(mrb_state *mrb, const void *src, size_t size, bool is_signed);
+void mrb_trn_ipc_stats_record(uint64_t service, uint32_t command_id, uint64_t start, uint64_t packed, uint64_t sent, uint64_t end, result_t r);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,478 @@
+#include<stdint.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/class.h>
+#include<mruby/data.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+
+// Bulk transfers over an IDsEndpoint through a ring of page-aligned
+// buffers. Several URBs stay posted at once and completions are picked up
+// from the endpoint's completion event and URB report.
+
+#define TRN_USB_MAX_DEPTH 8 // one URB report holds eight entries
+#define TRN_USB_URB_STATUS_DONE 3
+
+typedef enum {
+	TRN_USB_SLOT_FREE,
+	TRN_USB_SLOT_IN_FLIGHT,
+	TRN_USB_SLOT_DONE,
+} trn_usb_slot_state_t;
+
+typedef struct {
+	uint8_t *data;
+	uint32_t urb_id;
+	uint32_t length; // bytes filled before posting, transferred after completion
+	uint32_t status;
+	trn_usb_slot_state_t state;
+} trn_usb_slot_t;
+
+typedef struct {
+	mrb_value endpoint; // TRN::IPC::Object, kept alive by @ipc_object
+	ipc_object_t teardown; // raw session for cancelling from dfree, when endpoint may already be gone
+	handle_t event;
+	bool is_read;
+	size_t buffer_size;
+	size_t depth;
+	size_t head; // read: next slot to hand out
+	size_t tail; // write: slot being filled
+	size_t in_flight;
+	bool held; // read: head slot is lent out through acquire
+	trn_usb_slot_t slots[TRN_USB_MAX_DEPTH];
+} trn_usb_stream_t;
+
+typedef struct {
+	uint32_t id;
+	uint32_t requested_size;
+	uint32_t transferred_size;
+	uint32_t urb_status;
+} trn_usb_urb_report_entry_t;
+
+typedef struct {
+	trn_usb_urb_report_entry_t entries[8];
+	uint32_t count;
+} trn_usb_urb_report_t;
+
+// requests go through mrb_trn_ipc_send so stats, the recorder and session
+// pools see streaming traffic like any other command
+static result_t trn_usb_send(trn_ipc_object_t *endpoint, ipc_request_t *rq, ipc_response_fmt_t *rs) {
+	TRN_IPC_STATS_TICK(start);
+	result_t r = mrb_trn_ipc_send(endpoint, rq, rs);
+	TRN_IPC_STATS_TICK(end);
+	TRN_IPC_STATS_RECORD(endpoint->service_label, rq->request_id, start, start, end, end, r);
+	return r;
+}
+
+static result_t trn_usb_post_buffer(trn_ipc_object_t *endpoint, void *data, uint32_t size, uint32_t *urb_id) {
+	struct {
+		uint32_t size;
+		uint32_t padding;
+		uint64_t address;
+	} raw = {size, 0, (uint64_t) data};
+	ipc_request_t rq = ipc_default_request;
+	rq.request_id = 0; // PostBufferAsync
+	rq.raw_data_size = sizeof(raw);
+	rq.raw_data = (void*) &raw;
+
+	ipc_response_fmt_t rs = ipc_default_response_fmt;
+	rs.raw_data_size = sizeof(*urb_id);
+	rs.raw_data = (void*) urb_id;
+	return trn_usb_send(endpoint, &rq, &rs);
+}
+
+static result_t trn_usb_simple_command(trn_ipc_object_t *endpoint, uint32_t id) {
+	ipc_request_t rq = ipc_default_request;
+	rq.request_id = id;
+	ipc_response_fmt_t rs = ipc_default_response_fmt;
+	return trn_usb_send(endpoint, &rq, &rs);
+}
+
+static result_t trn_usb_get_completion_event(trn_ipc_object_t *endpoint, handle_t *event) {
+	ipc_request_t rq = ipc_default_request;
+	rq.request_id = 2; // GetCompletionEvent
+	ipc_response_fmt_t rs = ipc_default_response_fmt;
+	rs.num_copy_handles = 1;
+	rs.copy_handles = event;
+	return trn_usb_send(endpoint, &rq, &rs);
+}
+
+static result_t trn_usb_get_urb_report(trn_ipc_object_t *endpoint, trn_usb_urb_report_t *report) {
+	ipc_request_t rq = ipc_default_request;
+	rq.request_id = 3; // GetUrbReport
+	ipc_response_fmt_t rs = ipc_default_response_fmt;
+	rs.raw_data_size = sizeof(*report);
+	rs.raw_data = (void*) report;
+	return trn_usb_send(endpoint, &rq, &rs);
+}
+
+static void mrb_trn_usb_stream_dfree(mrb_state *mrb, void *data) {
+	trn_usb_stream_t *stream = data;
+	if(!stream) {
+		return;
+	}
+	if(stream->in_flight > 0) {
+		// the buffers can't be released while the controller may still write to
+		// them; the endpoint object may have been collected first, so this goes
+		// out on the bare session without pooling
+		trn_ipc_object_t endpoint = {.object = stream->teardown};
+		trn_usb_simple_command(&endpoint, 1); // Cancel
+		while(stream->in_flight > 0) {
+			uint32_t index;
+			trn_usb_urb_report_t report;
+			if(svcWaitSynchronization(&index, &stream->event, 1, 1000000000) != RESULT_OK ||
+			   svcResetSignal(stream->event) != RESULT_OK ||
+			   trn_usb_get_urb_report(&endpoint, &report) != RESULT_OK) {
+				break;
+			}
+			stream->in_flight = 0;
+			for(uint32_t i = 0; i < report.count && i < 8; i++) {
+				if(report.entries[i].urb_status < TRN_USB_URB_STATUS_DONE) {
+					stream->in_flight++;
+				}
+			}
+		}
+	}
+	if(stream->in_flight == 0) {
+		for(size_t i = 0; i < stream->depth; i++) {
+			if(stream->slots[i].data) {
+				free_pages(stream->slots[i].data);
+			}
+		}
+	}
+	if(stream->event) {
+		svcCloseHandle(stream->event);
+	}
+	mrb_free(mrb, stream);
+}
+
+static const mrb_data_type dt_UsbStream = {"UsbStream", mrb_trn_usb_stream_dfree};
+
+static trn_usb_stream_t *mrb_trn_usb_stream_get(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_data_get_ptr(mrb, self, &dt_UsbStream);
+	if(!stream) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "usb stream is closed");
+	}
+	return stream;
+}
+
+static trn_ipc_object_t *mrb_trn_usb_stream_endpoint(mrb_state *mrb, trn_usb_stream_t *stream) {
+	return mrb_trn_ipc_object_get(mrb, stream->endpoint);
+}
+
+static void mrb_trn_usb_stream_post(mrb_state *mrb, trn_usb_stream_t *stream, trn_usb_slot_t *slot, uint32_t size) {
+	mrb_trn_assert_ok(mrb, trn_usb_post_buffer(mrb_trn_usb_stream_endpoint(mrb, stream), slot->data, size, &slot->urb_id));
+	slot->length = size;
+	slot->state = TRN_USB_SLOT_IN_FLIGHT;
+	stream->in_flight++;
+}
+
+// waits for the completion event and retires every finished urb; returns false on timeout
+static bool mrb_trn_usb_stream_reap(mrb_state *mrb, trn_usb_stream_t *stream, uint64_t timeout) {
+	uint32_t index;
+	result_t r = svcWaitSynchronization(&index, &stream->event, 1, timeout);
+	if(r == 0xea01) { // timed out
+		return false;
+	}
+	mrb_trn_assert_ok(mrb, r);
+	mrb_trn_assert_ok(mrb, svcResetSignal(stream->event));
+
+	trn_usb_urb_report_t report;
+	mrb_trn_assert_ok(mrb, trn_usb_get_urb_report(mrb_trn_usb_stream_endpoint(mrb, stream), &report));
+	for(uint32_t i = 0; i < report.count && i < 8; i++) {
+		trn_usb_urb_report_entry_t *entry = &report.entries[i];
+		if(entry->urb_status < TRN_USB_URB_STATUS_DONE) {
+			continue; // still pending
+		}
+		for(size_t j = 0; j < stream->depth; j++) {
+			trn_usb_slot_t *slot = &stream->slots[j];
+			if(slot->state == TRN_USB_SLOT_IN_FLIGHT && slot->urb_id == entry->id) {
+				// written data is finished with as soon as it's sent, and the
+				// slot starts filling again from the beginning
+				slot->length = stream->is_read ? entry->transferred_size : 0;
+				slot->status = entry->urb_status;
+				slot->state = stream->is_read ? TRN_USB_SLOT_DONE : TRN_USB_SLOT_FREE;
+				stream->in_flight--;
+				if(!stream->is_read && slot->status != TRN_USB_URB_STATUS_DONE) {
+					mrb_raisef(mrb, E_RUNTIME_ERROR, "usb transfer failed (status %S)", mrb_fixnum_value(slot->status));
+				}
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+static mrb_value mrb_trn_usb_stream_new(mrb_state *mrb, mrb_value self) {
+	mrb_value endpoint;
+	mrb_sym mode;
+	mrb_int buffer_size = 0x10000;
+	mrb_int depth = 4;
+	mrb_int num_args = mrb_get_args(mrb, "on|ii", &endpoint, &mode, &buffer_size, &depth);
+
+	bool is_read;
+	if(mode == mrb_intern_lit(mrb, "read")) {
+		is_read = true;
+	} else if(mode == mrb_intern_lit(mrb, "write")) {
+		is_read = false;
+	} else {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "mode must be :read or :write");
+	}
+	if(depth < 1 || depth > TRN_USB_MAX_DEPTH) {
+		mrb_raisef(mrb, E_ARGUMENT_ERROR, "depth must be between 1 and %S", mrb_fixnum_value(TRN_USB_MAX_DEPTH));
+	}
+	if(buffer_size <= 0 || buffer_size > UINT32_MAX) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid buffer size");
+	}
+	buffer_size = (buffer_size + 0xfff) & ~0xfff;
+
+	// accept either a TRN::IPC::Object or a service wrapper that keeps one in @object
+	mrb_value object = endpoint;
+	if(!mrb_obj_is_kind_of(mrb, object, class_ipc_Object)) {
+		object = mrb_iv_get(mrb, endpoint, mrb_intern_lit(mrb, "@object"));
+	}
+	trn_ipc_object_t *ipc_object = mrb_trn_ipc_object_get(mrb, object);
+
+	trn_usb_stream_t *stream = mrb_calloc(mrb, sizeof(*stream), 1);
+	stream->endpoint = object;
+	stream->teardown = ipc_object->object;
+	stream->is_read = is_read;
+	stream->buffer_size = buffer_size;
+	stream->depth = depth;
+	mrb_value obj = mrb_obj_value(Data_Wrap_Struct(mrb, mrb_class_ptr(self), &dt_UsbStream, stream));
+	// the endpoint session has to outlive the stream
+	mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "@endpoint"), endpoint);
+	mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "@ipc_object"), object);
+
+	for(size_t i = 0; i < stream->depth; i++) {
+		stream->slots[i].data = alloc_pages(buffer_size, buffer_size, NULL);
+		if(stream->slots[i].data == NULL) {
+			mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+		}
+	}
+	mrb_trn_assert_ok(mrb, trn_usb_get_completion_event(ipc_object, &stream->event));
+
+	if(is_read) {
+		for(size_t i = 0; i < stream->depth; i++) {
+			mrb_trn_usb_stream_post(mrb, stream, &stream->slots[i], stream->buffer_size);
+		}
+	}
+	return obj;
+}
+
+// takes back the view handed out by acquire; it reads as empty from then on
+static void mrb_trn_usb_stream_revoke(mrb_state *mrb, mrb_value self) {
+	mrb_sym lent = mrb_intern_lit(mrb, "@lent");
+	mrb_trn_buffer_revoke(mrb, mrb_iv_get(mrb, self, lent));
+	mrb_iv_set(mrb, self, lent, mrb_nil_value());
+}
+
+static mrb_value mrb_trn_usb_stream_lend(mrb_state *mrb, mrb_value self, void *data, size_t size) {
+	mrb_trn_usb_stream_revoke(mrb, self);
+	mrb_value view = mrb_trn_buffer_lend(mrb, data, size, self);
+	mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "@lent"), view);
+	return view;
+}
+
+// read: waits for the next completed buffer and lends it out as a TRN::Buffer;
+// the view is only valid until release
+static mrb_value mrb_trn_usb_stream_acquire_read(mrb_state *mrb, mrb_value self, trn_usb_stream_t *stream, uint64_t timeout) {
+	trn_usb_slot_t *slot = &stream->slots[stream->head];
+	if(stream->held) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "previous buffer has not been released");
+	}
+	while(slot->state != TRN_USB_SLOT_DONE) {
+		if(!mrb_trn_usb_stream_reap(mrb, stream, timeout)) {
+			return mrb_nil_value();
+		}
+	}
+	if(slot->status != TRN_USB_URB_STATUS_DONE) {
+		// give the slot back to the controller so the stream stays usable
+		uint32_t status = slot->status;
+		mrb_trn_usb_stream_post(mrb, stream, slot, stream->buffer_size);
+		stream->head = (stream->head + 1) % stream->depth;
+		mrb_raisef(mrb, E_RUNTIME_ERROR, "usb transfer failed (status %S)", mrb_fixnum_value(status));
+	}
+	stream->held = true;
+	return mrb_trn_usb_stream_lend(mrb, self, slot->data, slot->length);
+}
+
+// write: waits for the fill slot to come back and lends out its free space as a
+// TRN::Buffer; the view is only valid until commit
+static mrb_value mrb_trn_usb_stream_acquire_write(mrb_state *mrb, mrb_value self, trn_usb_stream_t *stream, uint64_t timeout) {
+	trn_usb_slot_t *slot = &stream->slots[stream->tail];
+	while(slot->state == TRN_USB_SLOT_IN_FLIGHT) {
+		if(!mrb_trn_usb_stream_reap(mrb, stream, timeout)) {
+			return mrb_nil_value();
+		}
+	}
+	return mrb_trn_usb_stream_lend(mrb, self, slot->data + slot->length, stream->buffer_size - slot->length);
+}
+
+static mrb_value mrb_trn_usb_stream_acquire(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_trn_usb_stream_get(mrb, self);
+	mrb_int timeout = -1;
+	mrb_int num_args = mrb_get_args(mrb, "|i", &timeout);
+	if(stream->is_read) {
+		return mrb_trn_usb_stream_acquire_read(mrb, self, stream, timeout);
+	} else {
+		return mrb_trn_usb_stream_acquire_write(mrb, self, stream, timeout);
+	}
+}
+
+// read: hands the acquired buffer back to the controller
+static mrb_value mrb_trn_usb_stream_release(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_trn_usb_stream_get(mrb, self);
+	if(!stream->is_read || !stream->held) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "no buffer to release");
+	}
+	stream->held = false;
+	mrb_trn_usb_stream_revoke(mrb, self);
+	mrb_trn_usb_stream_post(mrb, stream, &stream->slots[stream->head], stream->buffer_size);
+	stream->head = (stream->head + 1) % stream->depth;
+	return mrb_nil_value();
+}
+
+static void mrb_trn_usb_stream_post_tail(mrb_state *mrb, trn_usb_stream_t *stream) {
+	trn_usb_slot_t *slot = &stream->slots[stream->tail];
+	mrb_trn_usb_stream_post(mrb, stream, slot, slot->length);
+	stream->tail = (stream->tail + 1) % stream->depth;
+}
+
+// write: marks length more bytes of the acquired buffer as filled, posting it once full
+static mrb_value mrb_trn_usb_stream_commit(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_trn_usb_stream_get(mrb, self);
+	mrb_int length;
+	mrb_int num_args = mrb_get_args(mrb, "i", &length);
+	trn_usb_slot_t *slot = &stream->slots[stream->tail];
+	if(stream->is_read || slot->state != TRN_USB_SLOT_FREE) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "no buffer to commit");
+	}
+	if(length < 0 || slot->length + length > stream->buffer_size) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "commit exceeds buffer");
+	}
+	mrb_trn_usb_stream_revoke(mrb, self);
+	slot->length+= length;
+	if(slot->length == stream->buffer_size) {
+		mrb_trn_usb_stream_post_tail(mrb, stream);
+	}
+	return mrb_nil_value();
+}
+
+static mrb_value mrb_trn_usb_stream_write(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_trn_usb_stream_get(mrb, self);
+	mrb_value source;
+	mrb_int num_args = mrb_get_args(mrb, "o", &source);
+	if(stream->is_read) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "stream is not writable");
+	}
+
+	void *data;
+	size_t size;
+	mrb_trn_buffer_region(mrb, source, &data, &size);
+	const char *str = data;
+	mrb_trn_usb_stream_revoke(mrb, self); // the fill slot's free space is about to be used
+
+	size_t written = 0;
+	while(written < size) {
+		trn_usb_slot_t *slot = &stream->slots[stream->tail];
+		while(slot->state == TRN_USB_SLOT_IN_FLIGHT) {
+			mrb_trn_usb_stream_reap(mrb, stream, -1);
+		}
+		size_t chunk = stream->buffer_size - slot->length;
+		if(chunk > size - written) {
+			chunk = size - written;
+		}
+		memcpy(slot->data + slot->length, str + written, chunk);
+		slot->length+= chunk;
+		written+= chunk;
+		if(slot->length == stream->buffer_size) {
+			mrb_trn_usb_stream_post_tail(mrb, stream);
+		}
+	}
+	return mrb_fixnum_value(written);
+}
+
+// write: posts the partially filled buffer, if any
+static mrb_value mrb_trn_usb_stream_flush(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_trn_usb_stream_get(mrb, self);
+	trn_usb_slot_t *slot = &stream->slots[stream->tail];
+	if(!stream->is_read && slot->state == TRN_USB_SLOT_FREE && slot->length > 0) {
+		mrb_trn_usb_stream_revoke(mrb, self);
+		mrb_trn_usb_stream_post_tail(mrb, stream);
+	}
+	return self;
+}
+
+// write: flushes and waits until every posted buffer has gone out
+static mrb_value mrb_trn_usb_stream_drain(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_trn_usb_stream_get(mrb, self);
+	if(stream->is_read) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "stream is not writable");
+	}
+	mrb_trn_usb_stream_flush(mrb, self);
+	while(stream->in_flight > 0) {
+		mrb_trn_usb_stream_reap(mrb, stream, -1);
+	}
+	return self;
+}
+
+static mrb_value mrb_trn_usb_stream_read(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_trn_usb_stream_get(mrb, self);
+	mrb_int timeout = -1;
+	mrb_int num_args = mrb_get_args(mrb, "|i", &timeout);
+	if(!stream->is_read) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "stream is not readable");
+	}
+	if(mrb_nil_p(mrb_trn_usb_stream_acquire_read(mrb, self, stream, timeout))) {
+		return mrb_nil_value();
+	}
+	trn_usb_slot_t *slot = &stream->slots[stream->head];
+	mrb_value str = mrb_str_new(mrb, (const char*) slot->data, slot->length);
+	mrb_trn_usb_stream_release(mrb, self);
+	return str;
+}
+
+static mrb_value mrb_trn_usb_stream_in_flight(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_trn_usb_stream_get(mrb, self);
+	return mrb_fixnum_value(stream->in_flight);
+}
+
+static mrb_value mrb_trn_usb_stream_buffer_size(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_trn_usb_stream_get(mrb, self);
+	return mrb_fixnum_value(stream->buffer_size);
+}
+
+static mrb_value mrb_trn_usb_stream_close(mrb_state *mrb, mrb_value self) {
+	trn_usb_stream_t *stream = mrb_data_get_ptr(mrb, self, &dt_UsbStream);
+	if(stream) {
+		if(!stream->is_read) {
+			mrb_trn_usb_stream_drain(mrb, self);
+		}
+		mrb_trn_usb_stream_revoke(mrb, self);
+		DATA_PTR(self) = NULL;
+		mrb_trn_usb_stream_dfree(mrb, stream);
+	}
+	return mrb_nil_value();
+}
+
+void mrb_transistor_usb_init(mrb_state *mrb) {
+	struct RClass *mod_service = mrb_define_module_under(mrb, mod_transistor, "Service");
+	struct RClass *class_UsbStream = mrb_define_class_under(mrb, mod_service, "UsbStream", mrb->object_class);
+	mrb_define_class_method(mrb, class_UsbStream, "new", mrb_trn_usb_stream_new, MRB_ARGS_ARG(2, 2));
+	mrb_define_method(mrb, class_UsbStream, "acquire", mrb_trn_usb_stream_acquire, MRB_ARGS_ARG(0, 1));
+	mrb_define_method(mrb, class_UsbStream, "release", mrb_trn_usb_stream_release, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_UsbStream, "commit", mrb_trn_usb_stream_commit, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_UsbStream, "read", mrb_trn_usb_stream_read, MRB_ARGS_ARG(0, 1));
+	mrb_define_method(mrb, class_UsbStream, "write", mrb_trn_usb_stream_write, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_UsbStream, "flush", mrb_trn_usb_stream_flush, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_UsbStream, "drain", mrb_trn_usb_stream_drain, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_UsbStream, "in_flight", mrb_trn_usb_stream_in_flight, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_UsbStream, "buffer_size", mrb_trn_usb_stream_buffer_size, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_UsbStream, "close", mrb_trn_usb_stream_close, MRB_ARGS_ARG(0, 0));
+}
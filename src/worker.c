@@ -0,0 +1,522 @@
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include<mruby.h>
+#include<mruby/array.h>
+#include<mruby/class.h>
+#include<mruby/compile.h>
+#include<mruby/data.h>
+#include<mruby/hash.h>
+#include<mruby/string.h>
+#include<mruby/value.h>
+#include<mruby/variable.h>
+
+#include<libtransistor/nx.h>
+
+#include "trn.h"
+#include "trn_allocf.h"
+
+// TRN::Worker: a kernel thread with its own mrb_state that runs a script.
+// Parent and worker exchange serialized values through a pair of bounded
+// single-producer/single-consumer rings. Values are nil, booleans, Integer,
+// Float, String, Symbol and Arrays/Hashes of those.
+
+#define TRN_WORKER_DEFAULT_DEPTH 64
+#define TRN_WORKER_MAX_NESTING 64
+#define TRN_WORKER_SPIN 64 // polls before a waiter starts sleeping
+#define TRN_WORKER_SLEEP_NS 100000
+
+enum {
+	TRN_WORKER_NIL,
+	TRN_WORKER_TRUE,
+	TRN_WORKER_FALSE,
+	TRN_WORKER_INTEGER,
+	TRN_WORKER_FLOAT,
+	TRN_WORKER_STRING,
+	TRN_WORKER_SYMBOL,
+	TRN_WORKER_ARRAY,
+	TRN_WORKER_HASH,
+};
+
+typedef struct {
+	size_t size;
+	uint8_t data[];
+} trn_worker_message_t;
+
+typedef struct {
+	trn_worker_message_t **slots;
+	uint32_t mask; // capacity - 1, capacity is a power of two
+	uint32_t head __attribute__((aligned(64))); // next slot to pop, written by the consumer
+	uint32_t tail __attribute__((aligned(64))); // next slot to push, written by the producer
+} trn_worker_queue_t;
+
+typedef struct {
+	trn_thread_t thread;
+	trn_worker_queue_t inbox; // parent -> worker
+	trn_worker_queue_t outbox; // worker -> parent
+	char *script;
+	size_t script_size;
+	int32_t core;
+	bool page_heap; // parent runs on mrb_trn_allocf, so the worker does too
+	bool started;
+	bool closed; // parent closed; worker pops drain and then return nil
+	bool finished; // script returned
+	char *error; // inspected exception, if the script raised
+} trn_worker_t;
+
+static __thread trn_worker_t *trn_worker_current; // set on worker threads
+
+// queues
+
+static bool trn_worker_queue_init(trn_worker_queue_t *queue, uint32_t depth) {
+	uint32_t capacity = 1;
+	while(capacity < depth) {
+		capacity<<= 1;
+	}
+	queue->slots = calloc(capacity, sizeof(*queue->slots));
+	queue->mask = capacity - 1;
+	queue->head = 0;
+	queue->tail = 0;
+	return queue->slots != NULL;
+}
+
+static void trn_worker_queue_finalize(trn_worker_queue_t *queue) {
+	if(queue->slots == NULL) {
+		return;
+	}
+	for(uint32_t i = queue->head; i != queue->tail; i++) {
+		free(queue->slots[i & queue->mask]);
+	}
+	free(queue->slots);
+	queue->slots = NULL;
+}
+
+static bool trn_worker_queue_push(trn_worker_queue_t *queue, trn_worker_message_t *message) {
+	uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+	if(tail - head > queue->mask) {
+		return false; // full
+	}
+	queue->slots[tail & queue->mask] = message;
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static trn_worker_message_t *trn_worker_queue_pop(trn_worker_queue_t *queue) {
+	uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+	if(head == tail) {
+		return NULL;
+	}
+	trn_worker_message_t *message = queue->slots[head & queue->mask];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	return message;
+}
+
+// spins briefly, then sleeps between polls; false once the deadline passes
+static bool trn_worker_wait(size_t *polls, uint64_t deadline) {
+	if(deadline != UINT64_MAX && svcGetSystemTick() >= deadline) {
+		return false;
+	}
+	if(++*polls > TRN_WORKER_SPIN) {
+		svcSleepThread(TRN_WORKER_SLEEP_NS);
+	}
+	return true;
+}
+
+static uint64_t trn_worker_deadline(mrb_int timeout) {
+	if(timeout < 0) {
+		return UINT64_MAX;
+	}
+	return svcGetSystemTick() + trn_ns_to_ticks(timeout);
+}
+
+// serialization
+
+typedef struct {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	mrb_value unsupported; // set if a value can't be serialized
+	bool failed;
+} trn_worker_writer_t;
+
+static void trn_worker_write(trn_worker_writer_t *writer, const void *data, size_t size) {
+	if(writer->failed) {
+		return;
+	}
+	if(writer->size + size > writer->capacity) {
+		size_t capacity = writer->capacity ? writer->capacity * 2 : 64;
+		while(capacity < writer->size + size) {
+			capacity*= 2;
+		}
+		uint8_t *grown = realloc(writer->data, capacity);
+		if(grown == NULL) {
+			writer->failed = true;
+			return;
+		}
+		writer->data = grown;
+		writer->capacity = capacity;
+	}
+	memcpy(writer->data + writer->size, data, size);
+	writer->size+= size;
+}
+
+static void trn_worker_write_tag(trn_worker_writer_t *writer, uint8_t tag) {
+	trn_worker_write(writer, &tag, sizeof(tag));
+}
+
+static void trn_worker_write_bytes(trn_worker_writer_t *writer, const char *data, uint32_t size) {
+	trn_worker_write(writer, &size, sizeof(size));
+	trn_worker_write(writer, data, size);
+}
+
+static void trn_worker_serialize(mrb_state *mrb, trn_worker_writer_t *writer, mrb_value value, int nesting) {
+	if(writer->failed) {
+		return;
+	}
+	if(nesting > TRN_WORKER_MAX_NESTING) {
+		writer->unsupported = value;
+		writer->failed = true;
+		return;
+	}
+	switch(mrb_type(value)) {
+	case MRB_TT_FALSE:
+		trn_worker_write_tag(writer, mrb_nil_p(value) ? TRN_WORKER_NIL : TRN_WORKER_FALSE);
+		break;
+	case MRB_TT_TRUE:
+		trn_worker_write_tag(writer, TRN_WORKER_TRUE);
+		break;
+	case MRB_TT_FIXNUM: {
+		int64_t v = mrb_fixnum(value);
+		trn_worker_write_tag(writer, TRN_WORKER_INTEGER);
+		trn_worker_write(writer, &v, sizeof(v));
+		break; }
+	case MRB_TT_FLOAT: {
+		double v = mrb_float(value);
+		trn_worker_write_tag(writer, TRN_WORKER_FLOAT);
+		trn_worker_write(writer, &v, sizeof(v));
+		break; }
+	case MRB_TT_STRING:
+		trn_worker_write_tag(writer, TRN_WORKER_STRING);
+		trn_worker_write_bytes(writer, RSTRING_PTR(value), RSTRING_LEN(value));
+		break;
+	case MRB_TT_SYMBOL: {
+		mrb_int size;
+		const char *name = mrb_sym2name_len(mrb, mrb_symbol(value), &size);
+		trn_worker_write_tag(writer, TRN_WORKER_SYMBOL);
+		trn_worker_write_bytes(writer, name, size);
+		break; }
+	case MRB_TT_ARRAY: {
+		uint32_t count = RARRAY_LEN(value);
+		trn_worker_write_tag(writer, TRN_WORKER_ARRAY);
+		trn_worker_write(writer, &count, sizeof(count));
+		for(uint32_t i = 0; i < count; i++) {
+			trn_worker_serialize(mrb, writer, mrb_ary_entry(value, i), nesting + 1);
+		}
+		break; }
+	case MRB_TT_HASH: {
+		mrb_value keys = mrb_hash_keys(mrb, value);
+		uint32_t count = RARRAY_LEN(keys);
+		trn_worker_write_tag(writer, TRN_WORKER_HASH);
+		trn_worker_write(writer, &count, sizeof(count));
+		for(uint32_t i = 0; i < count; i++) {
+			mrb_value key = mrb_ary_entry(keys, i);
+			trn_worker_serialize(mrb, writer, key, nesting + 1);
+			trn_worker_serialize(mrb, writer, mrb_hash_get(mrb, value, key), nesting + 1);
+		}
+		break; }
+	default:
+		writer->unsupported = value;
+		writer->failed = true;
+		break;
+	}
+}
+
+static trn_worker_message_t *mrb_trn_worker_pack(mrb_state *mrb, mrb_value value) {
+	trn_worker_writer_t writer = {0};
+	writer.unsupported = mrb_undef_value();
+	// room for the header, patched below
+	size_t header = 0;
+	trn_worker_write(&writer, &header, sizeof(header));
+	trn_worker_serialize(mrb, &writer, value, 0);
+	if(writer.failed) {
+		free(writer.data);
+		if(mrb_undef_p(writer.unsupported)) {
+			mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+		}
+		mrb_raisef(mrb, E_TYPE_ERROR, "can't send %S to a worker", writer.unsupported);
+	}
+	trn_worker_message_t *message = (trn_worker_message_t*) writer.data;
+	message->size = writer.size - sizeof(*message);
+	return message;
+}
+
+static mrb_value trn_worker_deserialize(mrb_state *mrb, const uint8_t **cursor) {
+	uint8_t tag = *(*cursor)++;
+	switch(tag) {
+	case TRN_WORKER_TRUE:
+		return mrb_true_value();
+	case TRN_WORKER_FALSE:
+		return mrb_false_value();
+	case TRN_WORKER_INTEGER: {
+		int64_t v;
+		memcpy(&v, *cursor, sizeof(v));
+		*cursor+= sizeof(v);
+		return mrb_fixnum_value(v); }
+	case TRN_WORKER_FLOAT: {
+		double v;
+		memcpy(&v, *cursor, sizeof(v));
+		*cursor+= sizeof(v);
+		return mrb_float_value(mrb, v); }
+	case TRN_WORKER_STRING:
+	case TRN_WORKER_SYMBOL: {
+		uint32_t size;
+		memcpy(&size, *cursor, sizeof(size));
+		*cursor+= sizeof(size);
+		const char *data = (const char*) *cursor;
+		*cursor+= size;
+		if(tag == TRN_WORKER_SYMBOL) {
+			return mrb_symbol_value(mrb_intern(mrb, data, size));
+		}
+		return mrb_str_new(mrb, data, size); }
+	case TRN_WORKER_ARRAY: {
+		uint32_t count;
+		memcpy(&count, *cursor, sizeof(count));
+		*cursor+= sizeof(count);
+		mrb_value array = mrb_ary_new_capa(mrb, count);
+		for(uint32_t i = 0; i < count; i++) {
+			mrb_ary_push(mrb, array, trn_worker_deserialize(mrb, cursor));
+		}
+		return array; }
+	case TRN_WORKER_HASH: {
+		uint32_t count;
+		memcpy(&count, *cursor, sizeof(count));
+		*cursor+= sizeof(count);
+		mrb_value hash = mrb_hash_new_capa(mrb, count);
+		for(uint32_t i = 0; i < count; i++) {
+			mrb_value key = trn_worker_deserialize(mrb, cursor);
+			mrb_hash_set(mrb, hash, key, trn_worker_deserialize(mrb, cursor));
+		}
+		return hash; }
+	default:
+		return mrb_nil_value();
+	}
+}
+
+static mrb_value mrb_trn_worker_unpack(mrb_state *mrb, trn_worker_message_t *message) {
+	const uint8_t *cursor = message->data;
+	mrb_value value = trn_worker_deserialize(mrb, &cursor);
+	free(message);
+	return value;
+}
+
+// both ends
+
+static void mrb_trn_worker_push_message(mrb_state *mrb, trn_worker_queue_t *queue, mrb_value value, bool *peer_gone) {
+	trn_worker_message_t *message = mrb_trn_worker_pack(mrb, value);
+	size_t polls = 0;
+	while(!trn_worker_queue_push(queue, message)) {
+		if(__atomic_load_n(peer_gone, __ATOMIC_ACQUIRE)) {
+			free(message);
+			mrb_raise(mrb, E_RUNTIME_ERROR, "worker channel is closed");
+		}
+		trn_worker_wait(&polls, UINT64_MAX);
+	}
+}
+
+// nil on timeout, or once the peer is gone and the queue is drained
+static mrb_value mrb_trn_worker_pop_message(mrb_state *mrb, trn_worker_queue_t *queue, mrb_int timeout, bool *peer_gone) {
+	uint64_t deadline = trn_worker_deadline(timeout);
+	size_t polls = 0;
+	while(true) {
+		trn_worker_message_t *message = trn_worker_queue_pop(queue);
+		if(message) {
+			return mrb_trn_worker_unpack(mrb, message);
+		}
+		if(__atomic_load_n(peer_gone, __ATOMIC_ACQUIRE)) {
+			// it may have pushed right before leaving
+			message = trn_worker_queue_pop(queue);
+			return message ? mrb_trn_worker_unpack(mrb, message) : mrb_nil_value();
+		}
+		if(!trn_worker_wait(&polls, deadline)) {
+			return mrb_nil_value();
+		}
+	}
+}
+
+// worker thread
+
+static void mrb_trn_worker_main(void *arg) {
+	trn_worker_t *worker = arg;
+	trn_worker_current = worker;
+
+	mrb_state *mrb = worker->page_heap ? mrb_open_allocf(mrb_trn_allocf, NULL) : mrb_open();
+	if(mrb == NULL) {
+		worker->error = strdup("can't open mrb_state");
+	} else {
+		mrb_load_nstring(mrb, worker->script, worker->script_size);
+		if(mrb->exc) {
+			mrb_value inspected = mrb_inspect(mrb, mrb_obj_value(mrb->exc));
+			worker->error = strndup(RSTRING_PTR(inspected), RSTRING_LEN(inspected));
+		}
+		mrb_close(mrb);
+	}
+	trn_worker_current = NULL;
+	__atomic_store_n(&worker->finished, true, __ATOMIC_RELEASE);
+}
+
+static void mrb_trn_worker_join(trn_worker_t *worker) {
+	if(worker->started) {
+		__atomic_store_n(&worker->closed, true, __ATOMIC_RELEASE);
+		trn_thread_join(&worker->thread, -1);
+		trn_thread_destroy(&worker->thread);
+		worker->started = false;
+	}
+}
+
+static void mrb_trn_worker_dfree(mrb_state *mrb, void *data) {
+	trn_worker_t *worker = data;
+	if(!worker) {
+		return;
+	}
+	mrb_trn_worker_join(worker);
+	trn_worker_queue_finalize(&worker->inbox);
+	trn_worker_queue_finalize(&worker->outbox);
+	free(worker->script);
+	free(worker->error);
+	free(worker);
+}
+
+static const mrb_data_type dt_Worker = {"Worker", mrb_trn_worker_dfree};
+
+static trn_worker_t *mrb_trn_worker_get(mrb_state *mrb, mrb_value self) {
+	return mrb_data_get_ptr(mrb, self, &dt_Worker);
+}
+
+static trn_worker_t *mrb_trn_worker_get_current(mrb_state *mrb) {
+	if(trn_worker_current == NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "not running in a worker");
+	}
+	return trn_worker_current;
+}
+
+// parent side
+
+static mrb_value mrb_trn_worker_new(mrb_state *mrb, mrb_value self) {
+	char *script;
+	mrb_int script_size;
+	mrb_int core = -2; // default core
+	mrb_int depth = TRN_WORKER_DEFAULT_DEPTH;
+	mrb_int num_args = mrb_get_args(mrb, "s|ii", &script, &script_size, &core, &depth);
+	if(depth <= 0 || depth > 0x10000) {
+		mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid queue depth");
+	}
+
+	trn_worker_t *worker = calloc(1, sizeof(*worker));
+	if(worker == NULL) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	mrb_value obj = mrb_obj_value(Data_Wrap_Struct(mrb, mrb_class_ptr(self), &dt_Worker, worker));
+	worker->core = core;
+	worker->page_heap = mrb->allocf == mrb_trn_allocf;
+	worker->script = malloc(script_size > 0 ? script_size : 1);
+	if(worker->script == NULL || !trn_worker_queue_init(&worker->inbox, depth) || !trn_worker_queue_init(&worker->outbox, depth)) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "out of memory");
+	}
+	memcpy(worker->script, script, script_size);
+	worker->script_size = script_size;
+
+	mrb_trn_assert_ok(mrb, trn_thread_create(&worker->thread, mrb_trn_worker_main, worker, -1, core, 0x10000, NULL));
+	result_t r = trn_thread_start(&worker->thread);
+	if(r != RESULT_OK) {
+		trn_thread_destroy(&worker->thread);
+		mrb_trn_assert_ok(mrb, r);
+	}
+	worker->started = true;
+	return obj;
+}
+
+static mrb_value mrb_trn_worker_push(mrb_state *mrb, mrb_value self) {
+	trn_worker_t *worker = mrb_trn_worker_get(mrb, self);
+	mrb_value value;
+	mrb_int num_args = mrb_get_args(mrb, "o", &value);
+	if(__atomic_load_n(&worker->closed, __ATOMIC_ACQUIRE)) {
+		mrb_raise(mrb, E_RUNTIME_ERROR, "worker is closed");
+	}
+	mrb_trn_worker_push_message(mrb, &worker->inbox, value, &worker->finished);
+	return self;
+}
+
+static mrb_value mrb_trn_worker_pop(mrb_state *mrb, mrb_value self) {
+	trn_worker_t *worker = mrb_trn_worker_get(mrb, self);
+	mrb_int timeout = -1;
+	mrb_int num_args = mrb_get_args(mrb, "|i", &timeout);
+	return mrb_trn_worker_pop_message(mrb, &worker->outbox, timeout, &worker->finished);
+}
+
+static mrb_value mrb_trn_worker_close(mrb_state *mrb, mrb_value self) {
+	trn_worker_t *worker = mrb_trn_worker_get(mrb, self);
+	mrb_trn_worker_join(worker);
+	return mrb_nil_value();
+}
+
+static mrb_value mrb_trn_worker_is_finished(mrb_state *mrb, mrb_value self) {
+	trn_worker_t *worker = mrb_trn_worker_get(mrb, self);
+	return mrb_bool_value(__atomic_load_n(&worker->finished, __ATOMIC_ACQUIRE));
+}
+
+static mrb_value mrb_trn_worker_error(mrb_state *mrb, mrb_value self) {
+	trn_worker_t *worker = mrb_trn_worker_get(mrb, self);
+	if(!__atomic_load_n(&worker->finished, __ATOMIC_ACQUIRE) || worker->error == NULL) {
+		return mrb_nil_value();
+	}
+	return mrb_str_new_cstr(mrb, worker->error);
+}
+
+static mrb_value mrb_trn_worker_core(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(mrb_trn_worker_get(mrb, self)->core);
+}
+
+// worker side
+
+static mrb_value mrb_trn_worker_is_worker(mrb_state *mrb, mrb_value self) {
+	return mrb_bool_value(trn_worker_current != NULL);
+}
+
+static mrb_value mrb_trn_worker_current_push(mrb_state *mrb, mrb_value self) {
+	trn_worker_t *worker = mrb_trn_worker_get_current(mrb);
+	mrb_value value;
+	mrb_int num_args = mrb_get_args(mrb, "o", &value);
+	mrb_trn_worker_push_message(mrb, &worker->outbox, value, &worker->closed);
+	return self;
+}
+
+static mrb_value mrb_trn_worker_current_pop(mrb_state *mrb, mrb_value self) {
+	trn_worker_t *worker = mrb_trn_worker_get_current(mrb);
+	mrb_int timeout = -1;
+	mrb_int num_args = mrb_get_args(mrb, "|i", &timeout);
+	return mrb_trn_worker_pop_message(mrb, &worker->inbox, timeout, &worker->closed);
+}
+
+static mrb_value mrb_trn_worker_current_core(mrb_state *mrb, mrb_value self) {
+	return mrb_fixnum_value(mrb_trn_worker_get_current(mrb)->core);
+}
+
+void mrb_transistor_worker_init(mrb_state *mrb) {
+	struct RClass *class_Worker = mrb_define_class_under(mrb, mod_transistor, "Worker", mrb->object_class);
+	mrb_define_class_method(mrb, class_Worker, "new", mrb_trn_worker_new, MRB_ARGS_ARG(1, 2));
+	mrb_define_method(mrb, class_Worker, "push", mrb_trn_worker_push, MRB_ARGS_ARG(1, 0));
+	mrb_define_method(mrb, class_Worker, "pop", mrb_trn_worker_pop, MRB_ARGS_ARG(0, 1));
+	mrb_define_method(mrb, class_Worker, "close", mrb_trn_worker_close, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Worker, "finished?", mrb_trn_worker_is_finished, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Worker, "error", mrb_trn_worker_error, MRB_ARGS_ARG(0, 0));
+	mrb_define_method(mrb, class_Worker, "core", mrb_trn_worker_core, MRB_ARGS_ARG(0, 0));
+
+	// for scripts running inside a worker
+	mrb_define_class_method(mrb, class_Worker, "worker?", mrb_trn_worker_is_worker, MRB_ARGS_ARG(0, 0));
+	mrb_define_class_method(mrb, class_Worker, "push", mrb_trn_worker_current_push, MRB_ARGS_ARG(1, 0));
+	mrb_define_class_method(mrb, class_Worker, "pop", mrb_trn_worker_current_pop, MRB_ARGS_ARG(0, 1));
+	mrb_define_class_method(mrb, class_Worker, "core", mrb_trn_worker_current_core, MRB_ARGS_ARG(0, 0));
+}
@@ -0,0 +1,55 @@
+#!/usr/bin/env ruby
+# Compares two bench/binding.rb reports and flags metrics that moved by
+# more than the threshold in the wrong direction.
+#
+#   ruby tools/bench_compare.rb base.jsonl head.jsonl [threshold_percent]
+#
+# Exits 1 if anything regressed.
+
+require "json"
+
+# units where a bigger number is better; everything else is a cost
+HIGHER_IS_BETTER = ["ops/s", "MiB/s"]
+
+def load_report(path)
+  metrics = {}
+  File.foreach(path) do |line|
+    line = line.strip
+    next if line.empty?
+    entry = JSON.parse(line)
+    metrics[entry["name"]] = entry
+  end
+  metrics
+end
+
+if ARGV.length < 2 then
+  STDERR.puts "usage: #{$0} base.jsonl head.jsonl [threshold_percent]"
+  exit 2
+end
+
+base = load_report(ARGV[0])
+head = load_report(ARGV[1])
+threshold = (ARGV[2] || 5).to_f
+
+regressed = false
+names = (base.keys + head.keys).uniq
+width = names.map(&:length).max || 0
+names.each do |name|
+  if !base[name] || !head[name] then
+    puts "#{name.ljust(width)}  #{base[name] ? "removed" : "added"}"
+    next
+  end
+  before = base[name]["value"].to_f
+  after = head[name]["value"].to_f
+  unit = head[name]["unit"]
+  change = before == 0 ? 0.0 : (after - before) / before * 100
+  better = HIGHER_IS_BETTER.include?(unit) ? change > 0 : change < 0
+  flag = ""
+  if change.abs >= threshold then
+    flag = better ? "  improved" : "  REGRESSED"
+    regressed = true if !better
+  end
+  puts format("%-#{width}s  %12.3f -> %12.3f %-6s %+7.1f%%%s", name, before, after, unit, change, flag)
+end
+
+exit(regressed ? 1 : 0)
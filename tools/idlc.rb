@@ -0,0 +1,221 @@
+# Compiles interface definitions (idl/*.idl) into C++ service stubs.
+#
+#   # comment
+#   interface IDsService {
+#     [4] GetState() -> (u32 state);
+#     [6] _AddUsbStringDescriptor(buffer<5> descriptor) -> (u8 index);
+#   }
+#
+# Field types:
+#   u8 u16 u32 u64 i8 i16 i32 i64  numeric raw data
+#   bytes<size[, alignment]>       raw data passed as a String
+#   buffer<type>                   String or TRN::Buffer with the given descriptor type
+#   buffer<auto_in>, buffer<auto_out>
+#                                  auto-select (0x21/0x22): pointer descriptor for
+#                                  small payloads, mapped descriptor for large ones
+#   object, object<Class>          ipc object, optionally wrapped in TRN::Service::Class
+#   handle<copy>, handle<move>     handle
+#   pid                            send (in) or receive (out) the process id
+#
+# Each interface becomes native methods on TRN::Service::<interface>; the
+# receiver is expected to keep its TRN::IPC::Object in @object.
+#
+# idl/<name>.idl and service/<name>.rb make up one service group. Nothing in
+# a group is defined at startup: the first reference to one of its constants
+# goes through TRN::Service.const_missing (src/service.c), which defines the
+# native commands and then runs the group's precompiled Ruby. Constants are
+# the interfaces plus the classes and modules service/<name>.rb opens
+# directly inside TRN::Service.
+module IDLC
+  class Error < StandardError; end
+
+  Field = Struct.new(:type, :name)
+  Command = Struct.new(:id, :name, :ins, :outs)
+  Interface = Struct.new(:name, :commands)
+  Group = Struct.new(:name, :interfaces, :ruby, :constants)
+
+  NUMERIC = {
+    "u8" => "uint8_t", "u16" => "uint16_t", "u32" => "uint32_t", "u64" => "uint64_t",
+    "i8" => "int8_t", "i16" => "int16_t", "i32" => "int32_t", "i64" => "int64_t",
+  }
+
+  BUFFER_TYPES = {"auto_in" => 0x21, "auto_out" => 0x22}
+
+  def self.parse(source, filename="(idl)")
+    interfaces = []
+    current = nil
+    source.each_line.with_index(1) do |line, lineno|
+      line = line.sub(/#.*/, "").strip
+      next if line.empty?
+      where = "#{filename}:#{lineno}"
+      if current.nil? then
+        m = /\Ainterface\s+(\w+)\s*\{\z/.match(line)
+        raise Error, "#{where}: expected interface" unless m
+        current = Interface.new(m[1], [])
+      elsif line == "}" then
+        interfaces.push(current)
+        current = nil
+      else
+        m = /\A\[(\w+)\]\s*(\w+)\s*\((.*?)\)\s*(?:->\s*\((.*?)\))?\s*;\z/.match(line)
+        raise Error, "#{where}: malformed command" unless m
+        ins = parse_fields(m[3], where, :in)
+        outs = parse_fields(m[4] || "", where, :out)
+        current.commands.push(Command.new(Integer(m[1]), m[2], ins, outs))
+      end
+    end
+    raise Error, "#{filename}: unterminated interface #{current.name}" if current
+    interfaces
+  end
+
+  def self.parse_fields(list, where, direction)
+    split_fields(list).map do |decl|
+      m = /\A(\w+(?:<[^>]*>)?)(?:\s+(\w+))?\z/.match(decl)
+      raise Error, "#{where}: malformed field '#{decl}'" unless m
+      if m[2].nil? && !(m[1] == "pid" && direction == :in) then
+        raise Error, "#{where}: field '#{decl}' needs a name"
+      end
+      if m[1].start_with?("buffer") && direction == :out then
+        raise Error, "#{where}: buffers are declared as inputs"
+      end
+      Field.new(m[1], m[2])
+    end
+  end
+
+  def self.split_fields(list)
+    fields = []
+    depth = 0
+    current = ""
+    list.each_char do |c|
+      depth+= 1 if c == "<"
+      depth-= 1 if c == ">"
+      if c == "," && depth == 0 then
+        fields.push(current.strip)
+        current = ""
+      else
+        current+= c
+      end
+    end
+    fields.push(current.strip) unless current.strip.empty?
+    fields
+  end
+
+  def self.cxx_type(field, where)
+    case field.type
+    when *NUMERIC.keys
+      "stub::Raw<#{NUMERIC[field.type]}>"
+    when /\Abytes<\s*(\w+)\s*(?:,\s*(\w+)\s*)?>\z/
+      "stub::Bytes<#{Integer($1)}, #{Integer($2 || 1)}>"
+    when /\Abuffer<\s*(\w+)\s*>\z/
+      "stub::Buffer<#{BUFFER_TYPES[$1] || Integer($1)}>"
+    when /\Aobject(?:<\s*\w+\s*>)?\z/
+      "stub::Object"
+    when "handle<copy>"
+      "stub::CopyHandle"
+    when "handle<move>"
+      "stub::MoveHandle"
+    when "pid"
+      "stub::Pid"
+    else
+      raise Error, "#{where}: unknown type '#{field.type}'"
+    end
+  end
+
+  def self.object_class(field)
+    m = /\Aobject<\s*(\w+)\s*>\z/.match(field.type)
+    m ? "\"#{m[1]}\"" : "NULL"
+  end
+
+  def self.c_strings(list)
+    (list + ["NULL"]).join(", ")
+  end
+
+  def self.generate(groups)
+    out = []
+    out << "// generated by tools/idlc.rb, do not edit"
+    out << ""
+    out << "#include \"stub.hpp\""
+    out << ""
+    out << "namespace {"
+    groups.flat_map(&:interfaces).each do |iface|
+      iface.commands.each do |cmd|
+        where = "#{iface.name}##{cmd.name}"
+        out << ""
+        out << "struct #{iface.name}_#{cmd.name} {"
+        out << "\tstatic constexpr uint32_t id = #{cmd.id};"
+        out << "\tusing in = stub::In<#{cmd.ins.map { |f| cxx_type(f, where) }.join(", ")}>;"
+        out << "\tusing out = stub::Out<#{cmd.outs.map { |f| cxx_type(f, where) }.join(", ")}>;"
+        out << "\tstatic constexpr const char *in_names[] = {#{c_strings(cmd.ins.map { |f| "\"#{f.name || f.type}\"" })}};"
+        out << "\tstatic constexpr const char *out_names[] = {#{c_strings(cmd.outs.map { |f| "\"#{f.name}\"" })}};"
+        out << "\tstatic constexpr const char *out_classes[] = {#{c_strings(cmd.outs.map { |f| object_class(f) })}};"
+        out << "};"
+      end
+    end
+    out << ""
+    out << "} // anonymous namespace"
+    groups.each do |group|
+      next if group.interfaces.empty?
+      out << ""
+      out << "static void define_#{group.name}(mrb_state *mrb, struct RClass *mod_service) {"
+      out << "\tstruct RClass *klass;"
+      group.interfaces.each do |iface|
+        out << "\tklass = mrb_define_class_under(mrb, mod_service, \"#{iface.name}\", mrb->object_class);"
+        iface.commands.each do |cmd|
+          stub = "stub::C<#{iface.name}_#{cmd.name}>"
+          out << "\tmrb_define_method(mrb, klass, \"#{cmd.name}\", &#{stub}::Bind, MRB_ARGS_ARG(#{stub}::num_args, 0));"
+        end
+      end
+      out << "}"
+    end
+    out << ""
+    groups.each do |group|
+      out << "extern \"C\" const uint8_t trn_service_irep_#{group.name}[];" if group.ruby
+    end
+    groups.each do |group|
+      out << "static const char *const constants_#{group.name}[] = {#{c_strings(group.constants.map { |c| "\"#{c}\"" })}};"
+    end
+    out << ""
+    out << "extern \"C\" const trn_service_group_t trn_service_groups[] = {"
+    groups.each do |group|
+      define = group.interfaces.empty? ? "NULL" : "define_#{group.name}"
+      irep = group.ruby ? "trn_service_irep_#{group.name}" : "NULL"
+      out << "\t{\"#{group.name}\", #{define}, #{irep}, constants_#{group.name}},"
+    end
+    out << "\t{NULL, NULL, NULL, NULL},"
+    out << "};"
+    out << ""
+    out.join("\n")
+  end
+
+  # classes and modules a service file opens directly inside TRN::Service
+  def self.ruby_constants(source)
+    source.scan(/^    (?:class|module)\s+([A-Z]\w*)/).flatten
+  end
+
+  def self.group_name(path)
+    File.basename(path).sub(/\.\w+\z/, "")
+  end
+
+  # idl_paths and ruby_paths are grouped by basename
+  def self.compile(idl_paths, ruby_paths=[])
+    names = (idl_paths + ruby_paths).map { |path| group_name(path) }.uniq.sort
+    groups = names.map do |name|
+      raise Error, "#{name}: service group names must be identifiers" unless /\A[a-z_]\w*\z/.match(name)
+      idl = idl_paths.find { |path| group_name(path) == name }
+      ruby = ruby_paths.find { |path| group_name(path) == name }
+      interfaces = idl ? parse(File.read(idl), idl) : []
+      constants = interfaces.map(&:name)
+      constants|= ruby_constants(File.read(ruby)) if ruby
+      Group.new(name, interfaces, ruby, constants)
+    end
+    generate(groups)
+  end
+end
+
+if $0 == __FILE__ then
+  if ARGV.length < 2 then
+    $stderr.puts "usage: #{$0} output.cpp input.idl|input.rb..."
+    exit 1
+  end
+  inputs = ARGV[1..-1]
+  File.write(ARGV[0], IDLC.compile(inputs.grep(/\.idl\z/), inputs.grep(/\.rb\z/)))
+end
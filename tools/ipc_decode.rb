@@ -0,0 +1,99 @@
+#!/usr/bin/env ruby
+# Prints a TRN::IPC::Recorder file, one line per request.
+#
+#   ruby tools/ipc_decode.rb trn.ipcrec [--json] [--service NAME] [--raw]
+#
+# --json emits one object per line for other tooling; --raw adds hex dumps
+# of the recorded request and response data.
+
+require "json"
+
+HEADER_FORMAT = "a8 L< L< Q<"
+HEADER_SIZE = 24
+RECORD_FORMAT = "Q<4 L< l< L<3 S<2 C8 L<8 a208 a208"
+FLAG_PID = 1
+
+def decode(data, raw_max, ticks_per_second)
+  seq, start, finish, service, session, object_id, type, command_id, result,
+    rq_size, rs_size,
+    rq_copy, rq_move, rq_objects, rq_buffers, rs_copy, rs_move, rs_objects, flags,
+    *rest = data.unpack(RECORD_FORMAT)
+  handles = rest[0, 8]
+  rq_raw, rs_raw = rest[8, 2]
+  {
+    "seq" => seq,
+    "start" => start,
+    "duration_us" => (finish - start) * 1_000_000.0 / ticks_per_second,
+    "service" => service == 0 ? nil : [service].pack("Q<").delete("\0"),
+    "session" => session,
+    "object_id" => object_id,
+    "type" => type,
+    "command_id" => command_id,
+    "result" => result,
+    "pid" => flags & FLAG_PID != 0,
+    "buffers" => rq_buffers,
+    "objects" => rq_objects,
+    "copy_handles" => handles[0, rq_copy],
+    "move_handles" => handles[rq_copy, rq_move] || [],
+    "response_objects" => rs_objects,
+    "response_copy_handles" => rs_copy,
+    "response_move_handles" => rs_move,
+    "request_size" => rq_size,
+    "request" => rq_raw[0, [rq_size, raw_max].min].unpack1("H*"),
+    "response_size" => rs_size,
+    "response" => rs_raw[0, [rs_size, raw_max].min].unpack1("H*"),
+  }
+end
+
+args = ARGV.dup
+json = !!args.delete("--json")
+raw = !!args.delete("--raw")
+service_filter = nil
+if (i = args.index("--service")) then
+  service_filter = args.delete_at(i + 1)
+  args.delete_at(i)
+end
+path = args.first
+
+if !path then
+  STDERR.puts "usage: #{$0} file.ipcrec [--json] [--service NAME] [--raw]"
+  exit 2
+end
+
+File.open(path, "rb") do |f|
+  magic, record_size, raw_max, ticks_per_second = f.read(HEADER_SIZE).to_s.unpack(HEADER_FORMAT)
+  if magic != "TRNIPCR1" then
+    STDERR.puts "#{path}: not an IPC recording"
+    exit 1
+  end
+  if record_size != 512 || raw_max != 208 then
+    STDERR.puts "#{path}: unsupported record layout (#{record_size} byte records, #{raw_max} byte raw data)"
+    exit 1
+  end
+
+  first = nil
+  expected = 1
+  while (data = f.read(record_size)) && data.bytesize == record_size do
+    record = decode(data, raw_max, ticks_per_second)
+    if record["seq"] > expected && !json then
+      puts "-- #{record["seq"] - expected} record(s) dropped"
+    end
+    expected = record["seq"] + 1
+    next if service_filter && record["service"] != service_filter
+    first ||= record["start"]
+    if json then
+      puts JSON.generate(record)
+      next
+    end
+    elapsed = (record["start"] - first) * 1000.0 / ticks_per_second
+    target = record["service"] || format("0x%x", record["session"])
+    target += "##{record["object_id"]}" if record["object_id"] >= 0
+    puts format("%8d %12.3fms %-16s type %d cmd %-5d %10.2fus result 0x%x",
+                record["seq"], elapsed, target, record["type"], record["command_id"],
+                record["duration_us"], record["result"])
+    if raw then
+      puts "           rq #{record["request"]}" if record["request_size"] > 0
+      puts "           rs #{record["response"]}" if record["response_size"] > 0
+    end
+  end
+end